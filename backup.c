@@ -0,0 +1,330 @@
+#include <backup.h>
+#include <pthread.h>
+#include <delta.h>
+
+#define BACKUP_SLOTS		(4)
+
+struct backup_slot_t {
+	void * buf;
+	uint32_t sec;
+	uint32_t cnt;
+	uint32_t index;
+	int filled;
+};
+
+struct backup_ctx_t {
+	const char * store;
+	struct backup_slot_t slot[BACKUP_SLOTS];
+	uint8_t (* digest)[SHA256_DIGEST_SIZE];
+	uint32_t nchunk;
+	uint32_t nstored;
+	int done;
+	int error;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+static char * backup_chunk_path(char * path, size_t size, const char * store, const uint8_t * digest, int dir)
+{
+	char hex[SHA256_DIGEST_SIZE * 2 + 1];
+
+	sha256_hex(hex, digest);
+	if(dir)
+		snprintf(path, size, "%s/%c%c", store, hex[0], hex[1]);
+	else
+		snprintf(path, size, "%s/%c%c/%s", store, hex[0], hex[1], hex);
+	return path;
+}
+
+static int backup_chunk_store(struct backup_ctx_t * bctx, const uint8_t * digest, void * buf, size_t len)
+{
+	char path[4096], tmp[4096 + 8];
+	FILE * f;
+
+	backup_chunk_path(path, sizeof(path), bctx->store, digest, 0);
+	if(access(path, F_OK) == 0)
+		return 1;
+	if(!file_mkdir(backup_chunk_path(tmp, sizeof(tmp), bctx->store, digest, 1)))
+		return 0;
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	f = fopen(tmp, "wb");
+	if(!f)
+		return 0;
+	if(fwrite(buf, 1, len, f) != len)
+	{
+		fclose(f);
+		remove(tmp);
+		return 0;
+	}
+	fclose(f);
+	if(rename(tmp, path) != 0)
+	{
+		remove(tmp);
+		return 0;
+	}
+	bctx->nstored++;
+	return 1;
+}
+
+static void * backup_worker(void * data)
+{
+	struct backup_ctx_t * bctx = (struct backup_ctx_t *)data;
+	struct backup_slot_t * s;
+	int i = 0, error;
+
+	while(1)
+	{
+		s = &bctx->slot[i];
+		pthread_mutex_lock(&bctx->lock);
+		while(!s->filled && !bctx->done)
+			pthread_cond_wait(&bctx->cond, &bctx->lock);
+		if(!s->filled)
+		{
+			pthread_mutex_unlock(&bctx->lock);
+			break;
+		}
+		error = bctx->error;
+		pthread_mutex_unlock(&bctx->lock);
+
+		if(!error)
+		{
+			sha256_hash(s->buf, (size_t)s->cnt << 9, bctx->digest[s->index]);
+			if(!backup_chunk_store(bctx, bctx->digest[s->index], s->buf, (size_t)s->cnt << 9))
+				error = 1;
+		}
+
+		pthread_mutex_lock(&bctx->lock);
+		if(error)
+			bctx->error = 1;
+		s->filled = 0;
+		pthread_cond_broadcast(&bctx->cond);
+		pthread_mutex_unlock(&bctx->lock);
+		i = (i + 1) % BACKUP_SLOTS;
+	}
+	return NULL;
+}
+
+static int backup_manifest_save(struct backup_ctx_t * bctx, uint32_t sec, uint32_t cnt, const char * manifest)
+{
+	char hex[SHA256_DIGEST_SIZE * 2 + 1];
+	FILE * f;
+
+	f = fopen(manifest, "w");
+	if(!f)
+		return 0;
+	fprintf(f, "xrock-backup 1\n");
+	fprintf(f, "sector %u\n", sec);
+	fprintf(f, "count %u\n", cnt);
+	for(uint32_t i = 0; i < bctx->nchunk; i++)
+	{
+		uint32_t n = XMIN(cnt - i * BACKUP_CHUNK_SECTORS, (uint32_t)BACKUP_CHUNK_SECTORS);
+		fprintf(f, "%s %u %u\n", sha256_hex(hex, bctx->digest[i]), sec + i * BACKUP_CHUNK_SECTORS, n);
+	}
+	if(fclose(f) != 0)
+		return 0;
+	return 1;
+}
+
+/*
+ * The number of chunks that were new to the store is returned in nstored,
+ * which may be NULL.
+ */
+int rock_flash_backup_progress(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt, const char * store, const char * manifest, uint32_t * nstored)
+{
+	struct backup_ctx_t bctx;
+	struct progress_t p;
+	pthread_t worker;
+	uint32_t start = sec, total = cnt;
+	int i, error, ret = 1;
+
+	if(!file_mkdir(store))
+	{
+		ctx->error = XROCK_ERROR_FILE;
+		return 0;
+	}
+
+	memset(&bctx, 0, sizeof(struct backup_ctx_t));
+	bctx.store = store;
+	bctx.nchunk = (cnt + BACKUP_CHUNK_SECTORS - 1) / BACKUP_CHUNK_SECTORS;
+	bctx.digest = calloc(XMAX(bctx.nchunk, (uint32_t)1), SHA256_DIGEST_SIZE);
+	if(!bctx.digest)
+	{
+		ctx->error = XROCK_ERROR_NOMEM;
+		return 0;
+	}
+	for(i = 0; i < BACKUP_SLOTS; i++)
+	{
+		bctx.slot[i].buf = malloc(BACKUP_CHUNK_SECTORS << 9);
+		if(!bctx.slot[i].buf)
+		{
+			while(--i >= 0)
+				free(bctx.slot[i].buf);
+			free(bctx.digest);
+			ctx->error = XROCK_ERROR_NOMEM;
+			return 0;
+		}
+	}
+	pthread_mutex_init(&bctx.lock, NULL);
+	pthread_cond_init(&bctx.cond, NULL);
+	if(pthread_create(&worker, NULL, backup_worker, &bctx) != 0)
+	{
+		pthread_cond_destroy(&bctx.cond);
+		pthread_mutex_destroy(&bctx.lock);
+		for(i = 0; i < BACKUP_SLOTS; i++)
+			free(bctx.slot[i].buf);
+		free(bctx.digest);
+		ctx->error = XROCK_ERROR_THREAD;
+		return 0;
+	}
+
+	rock_progress_start(ctx, &p, (uint64_t)cnt << 9);
+	for(uint32_t index = 0; cnt > 0; index++)
+	{
+		struct backup_slot_t * s = &bctx.slot[index % BACKUP_SLOTS];
+		uint32_t n = cnt > BACKUP_CHUNK_SECTORS ? BACKUP_CHUNK_SECTORS : cnt;
+
+		pthread_mutex_lock(&bctx.lock);
+		while(s->filled)
+			pthread_cond_wait(&bctx.cond, &bctx.lock);
+		error = bctx.error;
+		pthread_mutex_unlock(&bctx.lock);
+		if(error)
+		{
+			ret = 0;
+			break;
+		}
+		if(!rock_flash_read_lba(ctx, sec, n, s->buf))
+		{
+			ret = 0;
+			break;
+		}
+		s->sec = sec;
+		s->cnt = n;
+		s->index = index;
+		pthread_mutex_lock(&bctx.lock);
+		s->filled = 1;
+		pthread_cond_broadcast(&bctx.cond);
+		pthread_mutex_unlock(&bctx.lock);
+		sec += n;
+		cnt -= n;
+		progress_update(&p, (uint64_t)n << 9);
+	}
+	progress_stop(&p);
+
+	pthread_mutex_lock(&bctx.lock);
+	bctx.done = 1;
+	pthread_cond_broadcast(&bctx.cond);
+	pthread_mutex_unlock(&bctx.lock);
+	pthread_join(worker, NULL);
+	if(bctx.error)
+	{
+		ctx->error = XROCK_ERROR_FILE;
+		ret = 0;
+	}
+
+	if(ret && !backup_manifest_save(&bctx, start, total, manifest))
+	{
+		ctx->error = XROCK_ERROR_FILE;
+		ret = 0;
+	}
+	if(ret && nstored)
+		*nstored = bctx.nstored;
+
+	pthread_cond_destroy(&bctx.cond);
+	pthread_mutex_destroy(&bctx.lock);
+	for(i = 0; i < BACKUP_SLOTS; i++)
+		free(bctx.slot[i].buf);
+	free(bctx.digest);
+	return ret;
+}
+
+int rock_flash_restore_progress(struct xrock_ctx_t * ctx, uint32_t maxcnt, const char * store, const char * manifest)
+{
+	struct progress_t p;
+	char line[256], hex[SHA256_DIGEST_SIZE * 2 + 1], path[4096];
+	uint8_t digest[SHA256_DIGEST_SIZE], sum[SHA256_DIGEST_SIZE];
+	uint32_t start = 0, total = 0, done = 0, sec, cnt;
+	void * buf;
+	FILE * f, * c;
+	int ret = 1;
+
+	f = fopen(manifest, "r");
+	if(!f)
+	{
+		ctx->error = XROCK_ERROR_FILE;
+		return 0;
+	}
+	if(!fgets(line, sizeof(line), f) || (strncmp(line, "xrock-backup 1", 14) != 0)
+		|| !fgets(line, sizeof(line), f) || (sscanf(line, "sector %u", &start) != 1)
+		|| !fgets(line, sizeof(line), f) || (sscanf(line, "count %u", &total) != 1)
+		|| (start >= maxcnt) || (total > maxcnt - start))
+	{
+		fclose(f);
+		ctx->error = XROCK_ERROR_FORMAT;
+		return 0;
+	}
+	if(!rock_flash_update_invalidate(ctx, start, total))
+	{
+		fclose(f);
+		return 0;
+	}
+	buf = malloc(BACKUP_CHUNK_SECTORS << 9);
+	if(!buf)
+	{
+		fclose(f);
+		ctx->error = XROCK_ERROR_NOMEM;
+		return 0;
+	}
+
+	rock_progress_start(ctx, &p, (uint64_t)total << 9);
+	while(fgets(line, sizeof(line), f))
+	{
+		if((sscanf(line, "%64s %u %u", hex, &sec, &cnt) != 3) || (strlen(hex) != SHA256_DIGEST_SIZE * 2)
+			|| (cnt == 0) || (cnt > BACKUP_CHUNK_SECTORS) || (sec != start + done) || (cnt > total - done))
+		{
+			ctx->error = XROCK_ERROR_FORMAT;
+			ret = 0;
+			break;
+		}
+		for(int i = 0; i < SHA256_DIGEST_SIZE; i++)
+			digest[i] = hex_string(hex, i * 2);
+		c = fopen(backup_chunk_path(path, sizeof(path), store, digest, 0), "rb");
+		if(!c)
+		{
+			ctx->error = XROCK_ERROR_FILE;
+			ret = 0;
+			break;
+		}
+		if(fread(buf, 512, cnt, c) != cnt)
+		{
+			fclose(c);
+			ctx->error = XROCK_ERROR_FILE;
+			ret = 0;
+			break;
+		}
+		fclose(c);
+		if(memcmp(sha256_hash(buf, (size_t)cnt << 9, sum), digest, SHA256_DIGEST_SIZE) != 0)
+		{
+			ctx->error = XROCK_ERROR_VERIFY;
+			ret = 0;
+			break;
+		}
+		if(!rock_flash_write_lba(ctx, sec, cnt, buf))
+		{
+			ret = 0;
+			break;
+		}
+		done += cnt;
+		progress_update(&p, (uint64_t)cnt << 9);
+	}
+	progress_stop(&p);
+	if(ret && (done != total))
+	{
+		ctx->error = XROCK_ERROR_FORMAT;
+		ret = 0;
+	}
+
+	free(buf);
+	fclose(f);
+	return ret;
+}
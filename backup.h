@@ -0,0 +1,25 @@
+#ifndef __BACKUP_H__
+#define __BACKUP_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <rock.h>
+#include <sha256.h>
+
+/*
+ * Content addressed flash backup store. The device is split into fixed chunks,
+ * each chunk is saved once as '<store>/<xx>/<sha256>' and a manifest records
+ * the chunk list needed to restore the whole region.
+ */
+#define BACKUP_CHUNK_SECTORS	(2048)
+
+int rock_flash_backup_progress(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt, const char * store, const char * manifest, uint32_t * nstored);
+int rock_flash_restore_progress(struct xrock_ctx_t * ctx, uint32_t maxcnt, const char * store, const char * manifest);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __BACKUP_H__ */
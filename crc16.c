@@ -1,4 +1,6 @@
 #include <crc16.h>
+#include <crcfold.h>
+#include <pthread.h>
 
 static const uint16_t crc16_table[256] = {
 	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
@@ -35,7 +37,11 @@ static const uint16_t crc16_table[256] = {
 	0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0,
 };
 
-uint16_t crc16_sum(uint16_t crc, const uint8_t * buf, int len)
+static uint16_t crc16_slice_table[8][256];
+static struct crc_fold_t crc16_fold;
+static pthread_once_t crc16_once = PTHREAD_ONCE_INIT;
+
+static uint16_t crc16_sum_bytes(uint16_t crc, const uint8_t * buf, int len)
 {
 	int i;
 
@@ -43,3 +49,45 @@ uint16_t crc16_sum(uint16_t crc, const uint8_t * buf, int len)
 		crc = crc16_table[((crc >> 8) ^ *buf++) & 0xff] ^ (crc << 8);
 	return crc;
 }
+
+static uint16_t crc16_sum_slice(uint16_t crc, const uint8_t * buf, int len)
+{
+	const uint16_t (*t)[256] = (const uint16_t (*)[256])crc16_slice_table;
+
+	for(; len >= 8; buf += 8, len -= 8)
+	{
+		crc = t[7][(crc >> 8) ^ buf[0]] ^ t[6][(crc & 0xff) ^ buf[1]] ^ t[5][buf[2]] ^ t[4][buf[3]] ^
+			t[3][buf[4]] ^ t[2][buf[5]] ^ t[1][buf[6]] ^ t[0][buf[7]];
+	}
+	return crc16_sum_bytes(crc, buf, len);
+}
+
+static uint16_t crc16_sum_fold(uint16_t crc, const uint8_t * buf, int len)
+{
+	uint8_t rem[16];
+	int n;
+
+	n = crc_fold(&crc16_fold, crc, buf, len, rem);
+	return crc16_sum_slice(crc16_sum_slice(0, rem, 16), buf + n, len - n);
+}
+
+static void crc16_init(void)
+{
+	int i, k;
+
+	for(i = 0; i < 256; i++)
+	{
+		crc16_slice_table[0][i] = crc16_table[i];
+		for(k = 1; k < 8; k++)
+			crc16_slice_table[k][i] = (crc16_slice_table[k - 1][i] << 8) ^ crc16_table[crc16_slice_table[k - 1][i] >> 8];
+	}
+	crc_fold_init(&crc16_fold, 0x1021, 16);
+}
+
+uint16_t crc16_sum(uint16_t crc, const uint8_t * buf, int len)
+{
+	pthread_once(&crc16_once, crc16_init);
+	if(crc16_fold.fold && (len >= CRC_FOLD_MIN_LENGTH))
+		return crc16_sum_fold(crc, buf, len);
+	return crc16_sum_slice(crc, buf, len);
+}
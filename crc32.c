@@ -1,4 +1,9 @@
 #include <crc32.h>
+#include <crcfold.h>
+#include <pthread.h>
+#if defined(_WIN32)
+#include <windows.h>
+#endif
 
 static const uint32_t crc32_table[256] = {
 	0x00000000, 0x04c10db7, 0x09821b6e, 0x0d4316d9,
@@ -67,9 +72,166 @@ static const uint32_t crc32_table[256] = {
 	0xbcbb966d, 0xb87a9bda, 0xb5398d03, 0xb1f880b4,
 };
 
-uint32_t crc32_sum(uint32_t crc, const uint8_t * buf, int len)
+static uint32_t crc32_slice_table[8][256];
+static struct crc_fold_t crc32_fold;
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+
+static uint32_t crc32_sum_bytes(uint32_t crc, const uint8_t * buf, int len)
 {
 	while(len-- > 0)
 		crc = (crc << 8) ^ crc32_table[(crc >> 24) ^ *buf++];
 	return crc;
 }
+
+static uint32_t crc32_sum_slice(uint32_t crc, const uint8_t * buf, int len)
+{
+	const uint32_t (*t)[256] = (const uint32_t (*)[256])crc32_slice_table;
+
+	for(; len >= 8; buf += 8, len -= 8)
+	{
+		crc ^= get_unaligned_be32(buf);
+		crc = t[7][crc >> 24] ^ t[6][(crc >> 16) & 0xff] ^ t[5][(crc >> 8) & 0xff] ^ t[4][crc & 0xff] ^
+			t[3][buf[4]] ^ t[2][buf[5]] ^ t[1][buf[6]] ^ t[0][buf[7]];
+	}
+	return crc32_sum_bytes(crc, buf, len);
+}
+
+static uint32_t crc32_sum_fold(uint32_t crc, const uint8_t * buf, int len)
+{
+	uint8_t rem[16];
+	int n;
+
+	n = crc_fold(&crc32_fold, crc, buf, len, rem);
+	return crc32_sum_slice(crc32_sum_slice(0, rem, 16), buf + n, len - n);
+}
+
+static void crc32_init(void)
+{
+	int i, k;
+
+	for(i = 0; i < 256; i++)
+	{
+		crc32_slice_table[0][i] = crc32_table[i];
+		for(k = 1; k < 8; k++)
+			crc32_slice_table[k][i] = (crc32_slice_table[k - 1][i] << 8) ^ crc32_table[crc32_slice_table[k - 1][i] >> 24];
+	}
+	crc_fold_init(&crc32_fold, 0x04c10db7, 32);
+}
+
+uint32_t crc32_sum(uint32_t crc, const uint8_t * buf, int len)
+{
+	pthread_once(&crc32_once, crc32_init);
+	if(crc32_fold.fold && (len >= CRC_FOLD_MIN_LENGTH))
+		return crc32_sum_fold(crc, buf, len);
+	return crc32_sum_slice(crc, buf, len);
+}
+
+/*
+ * Multiply two remainders modulo the polynomial, a * b mod p
+ */
+static uint32_t crc32_mulmod(uint32_t a, uint32_t b)
+{
+	uint32_t r = 0;
+	int i;
+
+	for(i = 31; i >= 0; i--)
+	{
+		r = (r & 0x80000000) ? ((r << 1) ^ 0x04c10db7) : (r << 1);
+		if(b & (1U << i))
+			r ^= a;
+	}
+	return r;
+}
+
+/*
+ * The crc of a || b, given the crc of a with any initial value and the crc of
+ * b starting from zero, shifts the first by x^(8 * len2) mod p
+ */
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2)
+{
+	uint32_t x = 0x100;
+	uint32_t r = 1;
+
+	while(len2 > 0)
+	{
+		if(len2 & 1)
+			r = crc32_mulmod(r, x);
+		x = crc32_mulmod(x, x);
+		len2 >>= 1;
+	}
+	return crc32_mulmod(crc1, r) ^ crc2;
+}
+
+#define CRC32_PARALLEL_CHUNK	(8 * 1024 * 1024)
+#define CRC32_PARALLEL_THREADS	(64)
+
+struct crc32_part_t {
+	pthread_t thread;
+	const uint8_t * buf;
+	uint64_t len;
+	uint32_t crc;
+	int running;
+};
+
+static uint32_t crc32_sum_large(uint32_t crc, const uint8_t * buf, uint64_t len)
+{
+	while(len > 0)
+	{
+		int n = (len > 0x40000000) ? 0x40000000 : (int)len;
+		crc = crc32_sum(crc, buf, n);
+		buf += n;
+		len -= n;
+	}
+	return crc;
+}
+
+static void * crc32_part_thread(void * arg)
+{
+	struct crc32_part_t * p = (struct crc32_part_t *)arg;
+
+	p->crc = crc32_sum_large(p->crc, p->buf, p->len);
+	return NULL;
+}
+
+static int crc32_cpus(void)
+{
+#if defined(_WIN32)
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return (int)si.dwNumberOfProcessors;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return (n > 0) ? (int)n : 1;
+#endif
+}
+
+uint32_t crc32_sum_parallel(uint32_t crc, const uint8_t * buf, uint64_t len)
+{
+	struct crc32_part_t part[CRC32_PARALLEL_THREADS];
+	uint64_t size, off;
+	int nthread, i;
+
+	nthread = XMIN(crc32_cpus(), CRC32_PARALLEL_THREADS);
+	if(len / CRC32_PARALLEL_CHUNK < nthread)
+		nthread = len / CRC32_PARALLEL_CHUNK;
+	if(nthread < 2)
+		return crc32_sum_large(crc, buf, len);
+
+	size = len / nthread;
+	for(i = 0, off = 0; i < nthread; i++, off += size)
+	{
+		part[i].buf = buf + off;
+		part[i].len = (i == nthread - 1) ? (len - off) : size;
+		part[i].crc = (i == 0) ? crc : 0;
+		part[i].running = (i > 0) && (pthread_create(&part[i].thread, NULL, crc32_part_thread, &part[i]) == 0);
+	}
+	for(i = 0; i < nthread; i++)
+	{
+		if(part[i].running)
+			pthread_join(part[i].thread, NULL);
+		else
+			crc32_part_thread(&part[i]);
+		crc = (i == 0) ? part[i].crc : crc32_combine(crc, part[i].crc, part[i].len);
+	}
+	return crc;
+}
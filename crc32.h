@@ -8,6 +8,8 @@ extern "C" {
 #include <x.h>
 
 uint32_t crc32_sum(uint32_t crc, const uint8_t * buf, int len);
+uint32_t crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+uint32_t crc32_sum_parallel(uint32_t crc, const uint8_t * buf, uint64_t len);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,145 @@
+#include <crcfold.h>
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CRC_FOLD_PCLMUL
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define CRC_FOLD_PMULL
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#if defined(__clang__)
+#define CRC_FOLD_PMULL_TARGET	__attribute__((target("aes")))
+#else
+#define CRC_FOLD_PMULL_TARGET	__attribute__((target("+crypto")))
+#endif
+#endif
+
+/*
+ * x^n mod p, where p has an implicit x^width term
+ */
+static uint32_t crc_fold_xpow(uint32_t poly, int width, int n)
+{
+	uint64_t top = (uint64_t)1 << width;
+	uint64_t r = 1;
+
+	while(n-- > 0)
+	{
+		r <<= 1;
+		if(r & top)
+			r ^= top | poly;
+	}
+	return (uint32_t)r;
+}
+
+#if defined(CRC_FOLD_PCLMUL)
+__attribute__((target("pclmul,ssse3")))
+static inline __m128i crc_fold_pclmul_load(const uint8_t * buf)
+{
+	const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)buf), bswap);
+}
+
+__attribute__((target("pclmul,ssse3")))
+static inline __m128i crc_fold_pclmul_step(__m128i a, __m128i k, __m128i b)
+{
+	return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(a, k, 0x01), _mm_clmulepi64_si128(a, k, 0x10)), b);
+}
+
+__attribute__((target("pclmul,ssse3")))
+static int crc_fold_pclmul(const struct crc_fold_t * f, uint32_t crc, const uint8_t * buf, int len, uint8_t * out)
+{
+	const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	__m128i k128 = _mm_set_epi64x(f->k128[1], f->k128[0]);
+	__m128i k512 = _mm_set_epi64x(f->k512[1], f->k512[0]);
+	__m128i x0, x1, x2, x3;
+	int n;
+
+	x0 = _mm_xor_si128(crc_fold_pclmul_load(buf), _mm_set_epi32((int)(crc << (32 - f->width)), 0, 0, 0));
+	x1 = crc_fold_pclmul_load(buf + 16);
+	x2 = crc_fold_pclmul_load(buf + 32);
+	x3 = crc_fold_pclmul_load(buf + 48);
+	for(n = 64; n + 64 <= len; n += 64)
+	{
+		x0 = crc_fold_pclmul_step(x0, k512, crc_fold_pclmul_load(buf + n));
+		x1 = crc_fold_pclmul_step(x1, k512, crc_fold_pclmul_load(buf + n + 16));
+		x2 = crc_fold_pclmul_step(x2, k512, crc_fold_pclmul_load(buf + n + 32));
+		x3 = crc_fold_pclmul_step(x3, k512, crc_fold_pclmul_load(buf + n + 48));
+	}
+	x1 = crc_fold_pclmul_step(x0, k128, x1);
+	x2 = crc_fold_pclmul_step(x1, k128, x2);
+	x3 = crc_fold_pclmul_step(x2, k128, x3);
+	for(; n + 16 <= len; n += 16)
+		x3 = crc_fold_pclmul_step(x3, k128, crc_fold_pclmul_load(buf + n));
+	_mm_storeu_si128((__m128i *)out, _mm_shuffle_epi8(x3, bswap));
+	return n;
+}
+#endif
+
+#if defined(CRC_FOLD_PMULL)
+static inline uint64x2_t crc_fold_pmull_load(const uint8_t * buf)
+{
+	uint8x16_t v = vrev64q_u8(vld1q_u8(buf));
+	return vreinterpretq_u64_u8(vextq_u8(v, v, 8));
+}
+
+CRC_FOLD_PMULL_TARGET
+static inline uint64x2_t crc_fold_pmull_step(uint64x2_t a, const uint64_t * k, uint64x2_t b)
+{
+	uint64x2_t h = vreinterpretq_u64_p128(vmull_p64((poly64_t)vgetq_lane_u64(a, 1), (poly64_t)k[0]));
+	uint64x2_t l = vreinterpretq_u64_p128(vmull_p64((poly64_t)vgetq_lane_u64(a, 0), (poly64_t)k[1]));
+	return veorq_u64(veorq_u64(h, l), b);
+}
+
+CRC_FOLD_PMULL_TARGET
+static int crc_fold_pmull(const struct crc_fold_t * f, uint32_t crc, const uint8_t * buf, int len, uint8_t * out)
+{
+	uint64x2_t x0, x1, x2, x3;
+	uint8x16_t v;
+	int n;
+
+	x0 = veorq_u64(crc_fold_pmull_load(buf), vsetq_lane_u64((uint64_t)(crc << (32 - f->width)) << 32, vdupq_n_u64(0), 1));
+	x1 = crc_fold_pmull_load(buf + 16);
+	x2 = crc_fold_pmull_load(buf + 32);
+	x3 = crc_fold_pmull_load(buf + 48);
+	for(n = 64; n + 64 <= len; n += 64)
+	{
+		x0 = crc_fold_pmull_step(x0, f->k512, crc_fold_pmull_load(buf + n));
+		x1 = crc_fold_pmull_step(x1, f->k512, crc_fold_pmull_load(buf + n + 16));
+		x2 = crc_fold_pmull_step(x2, f->k512, crc_fold_pmull_load(buf + n + 32));
+		x3 = crc_fold_pmull_step(x3, f->k512, crc_fold_pmull_load(buf + n + 48));
+	}
+	x1 = crc_fold_pmull_step(x0, f->k128, x1);
+	x2 = crc_fold_pmull_step(x1, f->k128, x2);
+	x3 = crc_fold_pmull_step(x2, f->k128, x3);
+	for(; n + 16 <= len; n += 16)
+		x3 = crc_fold_pmull_step(x3, f->k128, crc_fold_pmull_load(buf + n));
+	v = vrev64q_u8(vreinterpretq_u8_u64(x3));
+	vst1q_u8(out, vextq_u8(v, v, 8));
+	return n;
+}
+#endif
+
+int crc_fold_init(struct crc_fold_t * f, uint32_t poly, int width)
+{
+	memset(f, 0, sizeof(struct crc_fold_t));
+	f->width = width;
+	f->k128[0] = crc_fold_xpow(poly, width, 128 + 64);
+	f->k128[1] = crc_fold_xpow(poly, width, 128);
+	f->k512[0] = crc_fold_xpow(poly, width, 512 + 64);
+	f->k512[1] = crc_fold_xpow(poly, width, 512);
+#if defined(CRC_FOLD_PCLMUL)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3"))
+		f->fold = crc_fold_pclmul;
+#elif defined(CRC_FOLD_PMULL)
+#if defined(__linux__)
+	if(getauxval(AT_HWCAP) & HWCAP_PMULL)
+		f->fold = crc_fold_pmull;
+#elif defined(__APPLE__)
+	f->fold = crc_fold_pmull;
+#endif
+#endif
+	return f->fold ? 1 : 0;
+}
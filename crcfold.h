@@ -0,0 +1,35 @@
+#ifndef __CRCFOLD_H__
+#define __CRCFOLD_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <x.h>
+
+/*
+ * Carry-less multiply folding for msb first crcs without reflection, used by
+ * crc16 and crc32. The fold consumes whole 16 bytes blocks and leaves a 16
+ * bytes remainder, whose crc from zero continues the original crc.
+ */
+#define CRC_FOLD_MIN_LENGTH		(256)
+
+struct crc_fold_t {
+	int width;
+	uint64_t k128[2];
+	uint64_t k512[2];
+	int (*fold)(const struct crc_fold_t * f, uint32_t crc, const uint8_t * buf, int len, uint8_t * out);
+};
+
+int crc_fold_init(struct crc_fold_t * f, uint32_t poly, int width);
+
+static inline int crc_fold(const struct crc_fold_t * f, uint32_t crc, const uint8_t * buf, int len, uint8_t * out)
+{
+	return f->fold(f, crc, buf, len, out);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CRCFOLD_H__ */
@@ -0,0 +1,238 @@
+#include <delta.h>
+
+static size_t delta_read_block(FILE * f, uint64_t offset, void * buf, size_t size)
+{
+	size_t n;
+
+	memset(buf, 0, size);
+	if(fseeko(f, offset, SEEK_SET) != 0)
+		return 0;
+	n = fread(buf, 1, size, f);
+	return (n + 511) & ~(size_t)511;
+}
+
+static struct merkle_ctx_t * delta_image_merkle(FILE * f, uint64_t length, void * buf)
+{
+	struct merkle_ctx_t * mctx = merkle_alloc(MERKLE_LEAF_SIZE);
+	uint64_t offset = 0;
+
+	if(!mctx)
+		return NULL;
+	while(offset < length)
+	{
+		size_t n = delta_read_block(f, offset, buf, XMIN((uint64_t)MERKLE_LEAF_SIZE, length - offset));
+		if((n == 0) || !merkle_update(mctx, buf, n))
+		{
+			merkle_free(mctx);
+			return NULL;
+		}
+		offset += MERKLE_LEAF_SIZE;
+	}
+	if(!merkle_finish(mctx))
+	{
+		merkle_free(mctx);
+		return NULL;
+	}
+	return mctx;
+}
+
+static struct merkle_ctx_t * delta_installed_merkle(struct xrock_ctx_t * ctx, uint32_t sec, const char * dir, int index, struct delta_report_t * report)
+{
+	struct delta_image_id_t id;
+	char path[4096], hex[SHA256_DIGEST_SIZE * 2 + 1];
+	struct merkle_ctx_t * mctx;
+
+	memset(&id, 0, sizeof(id));
+	if(!rock_vs_read(ctx, 0, index, (uint8_t *)&id, sizeof(id)))
+		return NULL;
+	if((get_unaligned_le32(&id.magic[0]) != DELTA_IMAGE_ID_MAGIC) || (get_unaligned_le32(&id.sector[0]) != sec))
+		return NULL;
+	snprintf(path, sizeof(path), "%s/%s.merkle", dir, sha256_hex(hex, id.root));
+	mctx = merkle_load(path);
+	if(!mctx)
+		return NULL;
+	if((mctx->leaf_size != MERKLE_LEAF_SIZE) || (mctx->length != get_unaligned_le64(&id.length[0])) || (memcmp(mctx->root, id.root, SHA256_DIGEST_SIZE) != 0))
+	{
+		merkle_free(mctx);
+		return NULL;
+	}
+	if(report)
+	{
+		report->installed = 1;
+		memcpy(report->installed_version, id.version, sizeof(report->installed_version) - 1);
+		memcpy(report->installed_root, id.root, SHA256_DIGEST_SIZE);
+	}
+	return mctx;
+}
+
+static inline int delta_leaf_differ(struct merkle_ctx_t * nctx, struct merkle_ctx_t * octx, uint64_t i)
+{
+	if(!octx || (i >= octx->nleaf))
+		return 1;
+	if((i == nctx->nleaf - 1) || (i == octx->nleaf - 1))
+	{
+		if(nctx->length != octx->length)
+			return 1;
+	}
+	return (memcmp(nctx->leaf[i], octx->leaf[i], SHA256_DIGEST_SIZE) != 0) ? 1 : 0;
+}
+
+int rock_flash_update_from_file_progress(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t maxcnt, const char * filename, const char * dir, const char * version, int index, struct delta_report_t * report)
+{
+	struct merkle_ctx_t * nctx, * octx;
+	struct delta_image_id_t id;
+	struct progress_t p;
+	char path[4096], hex[SHA256_DIGEST_SIZE * 2 + 1];
+	uint64_t length, total = 0, nblock = 0;
+	void * buf;
+	FILE * f;
+	off_t size;
+	int ret = 1;
+
+	if(report)
+		memset(report, 0, sizeof(struct delta_report_t));
+	if(!file_mkdir(dir))
+	{
+		ctx->error = XROCK_ERROR_FILE;
+		return 0;
+	}
+	f = fopen(filename, "rb");
+	if(!f)
+	{
+		ctx->error = XROCK_ERROR_FILE;
+		return 0;
+	}
+	fseeko(f, 0, SEEK_END);
+	size = ftello(f);
+	if((size <= 0) || (sec >= maxcnt))
+	{
+		ctx->error = XROCK_ERROR_FILE;
+		fclose(f);
+		return 0;
+	}
+	length = XMIN(((uint64_t)size + 511) & ~(uint64_t)511, (uint64_t)(maxcnt - sec) << 9);
+	buf = malloc(MERKLE_LEAF_SIZE);
+	if(!buf)
+	{
+		ctx->error = XROCK_ERROR_NOMEM;
+		fclose(f);
+		return 0;
+	}
+	nctx = delta_image_merkle(f, length, buf);
+	if(!nctx)
+	{
+		ctx->error = XROCK_ERROR_FILE;
+		free(buf);
+		fclose(f);
+		return 0;
+	}
+	octx = delta_installed_merkle(ctx, sec, dir, index, report);
+
+	for(uint64_t i = 0; i < nctx->nleaf; i++)
+	{
+		if(delta_leaf_differ(nctx, octx, i))
+		{
+			total += XMIN((uint64_t)MERKLE_LEAF_SIZE, length - i * MERKLE_LEAF_SIZE);
+			nblock++;
+		}
+	}
+
+	/*
+	 * Invalidate the installed image id first, an interrupted upgrade must
+	 * never leave a manifest that does not match the flash contents.
+	 */
+	if(total > 0)
+	{
+		memset(&id, 0, sizeof(id));
+		if(!rock_vs_write(ctx, 0, index, (uint8_t *)&id, sizeof(id)))
+			ret = 0;
+	}
+
+	rock_progress_start(ctx, &p, total);
+	for(uint64_t i = 0; (i < nctx->nleaf) && ret; i++)
+	{
+		if(delta_leaf_differ(nctx, octx, i))
+		{
+			uint64_t offset = i * MERKLE_LEAF_SIZE;
+			size_t n = delta_read_block(f, offset, buf, XMIN((uint64_t)MERKLE_LEAF_SIZE, length - offset));
+			if(n == 0)
+			{
+				ctx->error = XROCK_ERROR_FILE;
+				ret = 0;
+			}
+			else if(!rock_flash_write_lba(ctx, sec + (uint32_t)(offset >> 9), n >> 9, buf))
+				ret = 0;
+			else
+				progress_update(&p, n);
+		}
+	}
+	progress_stop(&p);
+
+	if(ret)
+	{
+		snprintf(path, sizeof(path), "%s/%s.merkle", dir, sha256_hex(hex, nctx->root));
+		if(merkle_save(nctx, path))
+		{
+			memset(&id, 0, sizeof(id));
+			put_unaligned_le32(&id.magic[0], DELTA_IMAGE_ID_MAGIC);
+			put_unaligned_le32(&id.sector[0], sec);
+			put_unaligned_le64(&id.length[0], nctx->length);
+			memcpy(id.root, nctx->root, SHA256_DIGEST_SIZE);
+			if(version)
+				strncpy(id.version, version, sizeof(id.version) - 1);
+			if(rock_vs_write(ctx, 0, index, (uint8_t *)&id, sizeof(id)))
+			{
+				if(report)
+				{
+					memcpy(report->version, id.version, sizeof(report->version));
+					memcpy(report->root, nctx->root, SHA256_DIGEST_SIZE);
+					report->nblock = nblock;
+					report->nleaf = nctx->nleaf;
+				}
+			}
+			else
+				ret = 0;
+		}
+		else
+		{
+			ctx->error = XROCK_ERROR_FILE;
+			ret = 0;
+		}
+	}
+
+	if(octx)
+		merkle_free(octx);
+	merkle_free(nctx);
+	free(buf);
+	fclose(f);
+	return ret;
+}
+
+/*
+ * Every other flash write calls this first, the image id at the default index
+ * is dropped when the range overlaps the image it names, so the next upgrade
+ * is a full one instead of trusting a stale manifest. Loaders without vendor
+ * storage, and an id that can't be read, leave nothing to drop.
+ */
+int rock_flash_update_invalidate(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt)
+{
+	struct delta_image_id_t id;
+	enum xrock_error_t error = ctx->error;
+	uint64_t start, end;
+
+	memset(&id, 0, sizeof(id));
+	if((!rock_capability_support(ctx, CAPABILITY_TYPE_VENDOR_STORAGE) && !rock_capability_support(ctx, CAPABILITY_TYPE_NEW_VENDOR_STORAGE))
+		|| !rock_vs_read(ctx, 0, DELTA_IMAGE_ID_VS_INDEX, (uint8_t *)&id, sizeof(id)))
+	{
+		ctx->error = error;
+		return 1;
+	}
+	if(get_unaligned_le32(&id.magic[0]) != DELTA_IMAGE_ID_MAGIC)
+		return 1;
+	start = get_unaligned_le32(&id.sector[0]);
+	end = start + ((get_unaligned_le64(&id.length[0]) + 511) >> 9);
+	if((sec >= end) || ((uint64_t)sec + cnt <= start))
+		return 1;
+	memset(&id, 0, sizeof(id));
+	return rock_vs_write(ctx, 0, DELTA_IMAGE_ID_VS_INDEX, (uint8_t *)&id, sizeof(id));
+}
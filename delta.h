@@ -0,0 +1,47 @@
+#ifndef __DELTA_H__
+#define __DELTA_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <rock.h>
+#include <merkle.h>
+
+/*
+ * The image identifier kept in vendor storage after a successful delta
+ * upgrade, it names the host side merkle manifest of the installed image.
+ */
+#define DELTA_IMAGE_ID_MAGIC		(0x4d495258)	/* "XRIM" */
+#define DELTA_IMAGE_ID_VS_INDEX		(32)
+
+struct delta_image_id_t {
+	uint8_t magic[4];
+	uint8_t sector[4];
+	uint8_t length[8];
+	uint8_t root[SHA256_DIGEST_SIZE];
+	char version[32];
+} __attribute__((packed));
+
+/*
+ * Summary of a finished upgrade, the installed image fields are only valid
+ * when a matching manifest was found for the previous image.
+ */
+struct delta_report_t {
+	int installed;
+	char installed_version[32];
+	uint8_t installed_root[SHA256_DIGEST_SIZE];
+	char version[32];
+	uint8_t root[SHA256_DIGEST_SIZE];
+	uint64_t nblock;
+	uint64_t nleaf;
+};
+
+int rock_flash_update_from_file_progress(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t maxcnt, const char * filename, const char * dir, const char * version, int index, struct delta_report_t * report);
+int rock_flash_update_invalidate(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DELTA_H__ */
@@ -0,0 +1,174 @@
+#include <fanout.h>
+#include <delta.h>
+
+static void * fanout_reader(void * data)
+{
+	struct fanout_t * fo = (struct fanout_t *)data;
+	struct fanout_chunk_t * c;
+	uint32_t n;
+	size_t len;
+
+	for(uint64_t s = 0; s < fo->nchunk; s++)
+	{
+		c = &fo->ring[s % FANOUT_RING];
+		pthread_mutex_lock(&fo->lock);
+		while((c->ref > 0) && !fo->done)
+			pthread_cond_wait(&fo->cond, &fo->lock);
+		pthread_mutex_unlock(&fo->lock);
+		if(fo->done)
+			break;
+
+		n = XMIN(fo->total - (uint32_t)s * FANOUT_CHUNK_SECTORS, (uint32_t)FANOUT_CHUNK_SECTORS);
+		memset(c->buf, 0, n << 9);
+		len = fread(c->buf, 1, n << 9, fo->f);
+
+		pthread_mutex_lock(&fo->lock);
+		if(len == 0)
+			fo->error = 1;
+		else
+		{
+			c->cnt = n;
+			c->ref = fo->nwriter;
+			fo->produced = s + 1;
+		}
+		pthread_cond_broadcast(&fo->cond);
+		pthread_mutex_unlock(&fo->lock);
+		if(fo->error)
+			break;
+	}
+	return NULL;
+}
+
+struct fanout_t * fanout_alloc(const char * filename, int nwriter)
+{
+	struct fanout_t * fo;
+	int64_t len;
+
+	if(nwriter <= 0)
+		return NULL;
+	fo = calloc(1, sizeof(struct fanout_t));
+	if(!fo)
+		return NULL;
+	fo->f = fopen(filename, "rb");
+	if(!fo->f)
+	{
+		free(fo);
+		return NULL;
+	}
+	fseeko(fo->f, 0, SEEK_END);
+	len = ftello(fo->f);
+	fseeko(fo->f, 0, SEEK_SET);
+	if((len <= 0) || ((len + 511) >> 9 > 0xffffffff))
+	{
+		fclose(fo->f);
+		free(fo);
+		return NULL;
+	}
+	fo->total = (uint32_t)((len + 511) >> 9);
+	fo->nchunk = ((uint64_t)fo->total + FANOUT_CHUNK_SECTORS - 1) / FANOUT_CHUNK_SECTORS;
+	fo->nwriter = nwriter;
+	for(int i = 0; i < FANOUT_RING; i++)
+	{
+		fo->ring[i].buf = malloc(FANOUT_CHUNK_SECTORS << 9);
+		if(!fo->ring[i].buf)
+		{
+			while(--i >= 0)
+				free(fo->ring[i].buf);
+			fclose(fo->f);
+			free(fo);
+			return NULL;
+		}
+	}
+	pthread_mutex_init(&fo->lock, NULL);
+	pthread_cond_init(&fo->cond, NULL);
+	if(pthread_create(&fo->thread, NULL, fanout_reader, fo) != 0)
+	{
+		pthread_cond_destroy(&fo->cond);
+		pthread_mutex_destroy(&fo->lock);
+		for(int i = 0; i < FANOUT_RING; i++)
+			free(fo->ring[i].buf);
+		fclose(fo->f);
+		free(fo);
+		return NULL;
+	}
+	return fo;
+}
+
+void fanout_free(struct fanout_t * fo)
+{
+	if(fo)
+	{
+		pthread_mutex_lock(&fo->lock);
+		fo->done = 1;
+		pthread_cond_broadcast(&fo->cond);
+		pthread_mutex_unlock(&fo->lock);
+		pthread_join(fo->thread, NULL);
+		pthread_cond_destroy(&fo->cond);
+		pthread_mutex_destroy(&fo->lock);
+		for(int i = 0; i < FANOUT_RING; i++)
+			free(fo->ring[i].buf);
+		fclose(fo->f);
+		free(fo);
+	}
+}
+
+/*
+ * Every writer must call this exactly once, even when its device is unusable,
+ * the chunks are always released so the other writers can go on.
+ */
+int fanout_write(struct fanout_t * fo, struct xrock_ctx_t * ctx, uint32_t sec, uint32_t maxcnt)
+{
+	struct fanout_chunk_t * c;
+	struct progress_t p;
+	uint32_t cnt, off = 0, n;
+	int ret, error;
+
+	ret = (ctx && (sec < maxcnt)) ? 1 : 0;
+	cnt = ret ? XMIN(fo->total, maxcnt - sec) : 0;
+	if(ret && (!rock_flash_update_invalidate(ctx, sec, cnt) || !rock_flash_erase_ahead(ctx, sec, cnt)))
+		ret = 0;
+	rock_progress_start(ctx, &p, (uint64_t)cnt << 9);
+	for(uint64_t s = 0; s < fo->nchunk; s++)
+	{
+		c = &fo->ring[s % FANOUT_RING];
+		pthread_mutex_lock(&fo->lock);
+		while((fo->produced <= s) && !fo->error)
+			pthread_cond_wait(&fo->cond, &fo->lock);
+		error = (fo->produced <= s) ? 1 : 0;
+		pthread_mutex_unlock(&fo->lock);
+		if(error)
+		{
+			ret = 0;
+			break;
+		}
+		if(ret && (off < cnt))
+		{
+			n = XMIN(c->cnt, cnt - off);
+			if(rock_flash_write_lba(ctx, sec + off, n, c->buf))
+				progress_update(&p, (uint64_t)n << 9);
+			else
+				ret = 0;
+		}
+		off += c->cnt;
+		pthread_mutex_lock(&fo->lock);
+		if(--c->ref == 0)
+			pthread_cond_broadcast(&fo->cond);
+		pthread_mutex_unlock(&fo->lock);
+	}
+	progress_stop(&p);
+	return ret;
+}
+
+/*
+ * Drop a writer that will never call fanout_write, the chunks already read
+ * are released on its behalf and the later ones are not counted for it.
+ */
+void fanout_leave(struct fanout_t * fo)
+{
+	pthread_mutex_lock(&fo->lock);
+	for(uint64_t s = 0; s < fo->produced; s++)
+		fo->ring[s % FANOUT_RING].ref--;
+	fo->nwriter--;
+	pthread_cond_broadcast(&fo->cond);
+	pthread_mutex_unlock(&fo->lock);
+}
@@ -0,0 +1,48 @@
+#ifndef __FANOUT_H__
+#define __FANOUT_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <rock.h>
+#include <pthread.h>
+
+/*
+ * One reader thread fills a ring of refcounted chunks from the image file and
+ * every device writer consumes the same chunks, a slow writer holds the reader
+ * back, but the fast ones never run more than the ring ahead of it.
+ */
+#define FANOUT_CHUNK_SECTORS	(2048)
+#define FANOUT_RING				(16)
+
+struct fanout_chunk_t {
+	void * buf;
+	uint32_t cnt;
+	int ref;
+};
+
+struct fanout_t {
+	FILE * f;
+	uint32_t total;
+	int nwriter;
+	struct fanout_chunk_t ring[FANOUT_RING];
+	uint64_t produced;
+	uint64_t nchunk;
+	int error;
+	int done;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+struct fanout_t * fanout_alloc(const char * filename, int nwriter);
+void fanout_free(struct fanout_t * fo);
+int fanout_write(struct fanout_t * fo, struct xrock_ctx_t * ctx, uint32_t sec, uint32_t maxcnt);
+void fanout_leave(struct fanout_t * fo);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __FANOUT_H__ */
@@ -0,0 +1,253 @@
+#include <flow.h>
+#include <sys/time.h>
+
+static double flow_time(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+/*
+ * The delay of an entry gives the code time to finish before the next upload,
+ * after the last one the loader start is tracked by re-enumeration instead.
+ */
+static int flow_download(struct xrock_ctx_t * ctx, struct rkloader_ctx_t * lctx)
+{
+	struct rkloader_entry_t * e;
+	char str[256];
+	int last = -1;
+
+	for(int i = 0; i < lctx->nentry; i++)
+	{
+		if((lctx->entry[i]->type == RKLOADER_ENTRY_471) || (lctx->entry[i]->type == RKLOADER_ENTRY_472))
+			last = i;
+	}
+	for(int i = 0; i <= last; i++)
+	{
+		e = lctx->entry[i];
+		if((e->type == RKLOADER_ENTRY_471) || (e->type == RKLOADER_ENTRY_472))
+		{
+			void * buf = (char *)lctx->buffer + get_unaligned_le32(&e->data_offset);
+			uint64_t len = get_unaligned_le32(&e->data_size);
+			uint32_t delay = get_unaligned_le32(&e->data_delay);
+
+			printf("Downloading '%s'\r\n", loader_wide2str(str, (uint8_t *)&e->name[0], sizeof(e->name)));
+			if(!rock_maskrom_upload_memory(ctx, (e->type == RKLOADER_ENTRY_471) ? 0x471 : 0x472, buf, len, lctx->is_rc4on))
+				return 0;
+			if(i != last)
+				usleep(delay * 1000);
+		}
+	}
+	return (last >= 0) ? 1 : 0;
+}
+
+static int LIBUSB_CALL flow_hotplug(libusb_context * context, libusb_device * device, libusb_hotplug_event event, void * data)
+{
+	*(int *)data = 1;
+	return 0;
+}
+
+static int flow_open(struct xrock_ctx_t * ctx, const char * path)
+{
+	libusb_device ** list = NULL;
+	char p[32];
+	int count, ok = 0;
+
+	count = libusb_get_device_list(ctx->context, &list);
+	for(int i = 0; i < count; i++)
+	{
+		if(xrock_probe(list[i]) && !strcmp(xrock_path(list[i], p, sizeof(p)), path))
+		{
+			ok = xrock_open(ctx, list[i]) && !ctx->maskrom;
+			if(!ok && ctx->hdl)
+			{
+				libusb_release_interface(ctx->hdl, 0);
+				libusb_close(ctx->hdl);
+				ctx->hdl = NULL;
+			}
+			break;
+		}
+	}
+	if(list)
+		libusb_free_device_list(list, 1);
+	return ok;
+}
+
+/*
+ * Wait for the chip at the port path to come back in loader mode and pass test
+ * unit ready. Hotplug wakes the scan as soon as a device arrives, the maskrom
+ * device may linger for a moment, so it is skipped. Without hotplug the device
+ * list is polled.
+ */
+static int flow_enumerate(struct xrock_ctx_t * ctx, const char * path, double timeout)
+{
+	libusb_hotplug_callback_handle handle;
+	struct timeval tv;
+	double end = flow_time() + timeout, scan = 0;
+	int hotplug = 0, arrived = 1, ok = 0;
+
+	if(ctx->hdl)
+	{
+		libusb_release_interface(ctx->hdl, 0);
+		libusb_close(ctx->hdl);
+		ctx->hdl = NULL;
+	}
+	if(libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG) && (libusb_hotplug_register_callback(ctx->context, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED,
+		LIBUSB_HOTPLUG_NO_FLAGS, 0x2207, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY, flow_hotplug, &arrived, &handle) == LIBUSB_SUCCESS))
+		hotplug = 1;
+	while(!ok && (flow_time() < end))
+	{
+		if(arrived || (flow_time() >= scan))
+		{
+			arrived = 0;
+			scan = flow_time() + (hotplug ? 0.5 : 0.02);
+			ok = flow_open(ctx, path);
+		}
+		if(!ok)
+		{
+			if(hotplug)
+			{
+				tv.tv_sec = 0;
+				tv.tv_usec = 20 * 1000;
+				libusb_handle_events_timeout_completed(ctx->context, &tv, &arrived);
+			}
+			else
+				usleep(20 * 1000);
+		}
+	}
+	if(hotplug)
+		libusb_hotplug_deregister_callback(ctx->context, handle);
+	while(ok && !rock_ready(ctx))
+	{
+		if(flow_time() >= end)
+			ok = 0;
+		else
+			usleep(10 * 1000);
+	}
+	return ok;
+}
+
+/*
+ * Image writes go through a fanout ring with a single writer, its reader thread
+ * starts filling the ring as soon as the image is opened. The first image is
+ * opened before the download, every next one when the previous write starts,
+ * so the data is already in memory by the time the loader answers. With one
+ * writer the ring may be freed without draining it.
+ */
+static int flow_write(struct xrock_ctx_t * ctx, struct fanout_t * fo, uint32_t sec)
+{
+	struct flash_info_t info;
+
+	if(!rock_flash_detect(ctx, &info))
+	{
+		printf("Failed to detect flash\r\n");
+		return 0;
+	}
+	if(sec >= info.sector_total)
+	{
+		printf("The start sector is out of range\r\n");
+		return 0;
+	}
+	if(!fanout_write(fo, ctx, sec, info.sector_total))
+	{
+		printf("Failed to write flash\r\n");
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * The loader was validated once before the download, the upgrade writes its
+ * idb from memory instead of loading and checking the file again.
+ */
+static int flow_upgrade(struct xrock_ctx_t * ctx, struct rkloader_ctx_t * lctx)
+{
+	struct flash_info_t info;
+
+	if(!rock_flash_detect(ctx, &info))
+	{
+		printf("Failed to detect flash\r\n");
+		return 0;
+	}
+	if(!rock_loader_upgrade_progress(ctx, lctx))
+	{
+		printf("Failed to write flash\r\n");
+		return 0;
+	}
+	return 1;
+}
+
+static int flow_phase(const char * name, int ok, double start)
+{
+	printf("Phase %s %s, %.3f ms\r\n", name, ok ? "done" : "failed", (flow_time() - start) * 1000.0);
+	return ok;
+}
+
+int xrock_flow(struct xrock_ctx_t * ctx, const char * loader, int argc, char * argv[])
+{
+	struct rkloader_ctx_t * lctx;
+	struct fanout_t * fo = NULL, * next = NULL;
+	char path[32], name[64];
+	double start = flow_time(), t;
+	int ok = 1;
+
+	for(int i = 0; i + 1 < argc; i += 2)
+	{
+		if(access(argv[i + 1], R_OK) != 0)
+		{
+			printf("ERROR: Can't open image '%s'\r\n", argv[i + 1]);
+			return 0;
+		}
+	}
+	if((argc >= 2) && !(next = fanout_alloc(argv[1], 1)))
+	{
+		printf("ERROR: Can't prefetch image '%s'\r\n", argv[1]);
+		return 0;
+	}
+	lctx = rkloader_ctx_alloc(loader);
+	if(!lctx)
+	{
+		printf("ERROR: Not a valid loader '%s'\r\n", loader);
+		fanout_free(next);
+		return 0;
+	}
+	xrock_path(libusb_get_device(ctx->hdl), path, sizeof(path));
+	if(ctx->maskrom)
+	{
+		t = flow_time();
+		ok = flow_phase("download", flow_download(ctx, lctx), t);
+		if(ok)
+		{
+			t = flow_time();
+			ok = flow_phase("enumerate", flow_enumerate(ctx, path, FLOW_ENUM_TIMEOUT / 1000.0), t);
+			if(!ok)
+				printf("ERROR: The chip at '%s' does not come back in loader mode\r\n", path);
+		}
+	}
+	else
+		printf("The chip '%s' is already in loader mode, download skipped\r\n", ctx->chip->name);
+	if(ok)
+	{
+		t = flow_time();
+		ok = flow_phase("upgrade", flow_upgrade(ctx, lctx), t);
+	}
+	rkloader_ctx_free(lctx);
+	for(int i = 0; ok && (i + 1 < argc); i += 2)
+	{
+		fo = next;
+		next = NULL;
+		if((i + 3 < argc) && !(next = fanout_alloc(argv[i + 3], 1)))
+		{
+			printf("ERROR: Can't prefetch image '%s'\r\n", argv[i + 3]);
+			ok = 0;
+		}
+		snprintf(name, sizeof(name), "write %s", argv[i]);
+		t = flow_time();
+		ok = flow_phase(name, ok && flow_write(ctx, fo, strtoul(argv[i], NULL, 0)), t);
+		fanout_free(fo);
+	}
+	fanout_free(next);
+	printf("Provision flow %s, %.3f ms\r\n", ok ? "done" : "failed", (flow_time() - start) * 1000.0);
+	return ok;
+}
@@ -0,0 +1,23 @@
+#ifndef __FLOW_H__
+#define __FLOW_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <rock.h>
+#include <fanout.h>
+
+/*
+ * Blank board to flashed board in one session: maskrom download, wait for the
+ * loader to enumerate at the same usb port, upgrade and the image writes.
+ */
+#define FLOW_ENUM_TIMEOUT		(10000)
+
+int xrock_flow(struct xrock_ctx_t * ctx, const char * loader, int argc, char * argv[]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __FLOW_H__ */
@@ -80,11 +80,14 @@ static inline uint32_t loader_align_size(uint32_t len)
 
 static void idb_rc4(char * buf, int len)
 {
-	struct rc4_ctx_t ctx;
-	uint8_t key[16] = { 124, 78, 3, 4, 85, 5, 9, 7, 45, 44, 123, 56, 23, 13, 23, 17 };
+	if(!rc4_static_crypt((uint8_t *)buf, 0, len))
+	{
+		struct rc4_ctx_t ctx;
+		uint8_t key[16] = { 124, 78, 3, 4, 85, 5, 9, 7, 45, 44, 123, 56, 23, 13, 23, 17 };
 
-	rc4_setkey(&ctx, key, sizeof(key));
-	rc4_crypt(&ctx, (uint8_t *)buf, len);
+		rc4_setkey(&ctx, key, sizeof(key));
+		rc4_crypt(&ctx, (uint8_t *)buf, len);
+	}
 }
 
 static void rkloader_ctx_mkidb(struct rkloader_ctx_t * ctx)
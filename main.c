@@ -1,4 +1,18 @@
 #include <rock.h>
+#include <stdarg.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <backup.h>
+#include <delta.h>
+#include <scrub.h>
+#include <serve.h>
+#include <fanout.h>
+#include <schedule.h>
+#include <provision.h>
+#include <flow.h>
+#include <uart.h>
+
+#define XROCK_FLEET_MAX		(64)
 
 static const char * manufacturer[] = {
 	"Samsung",
@@ -20,9 +34,17 @@ static void usage(void)
 	printf("    QQ: 8192542\r\n");
 
 	printf("usage:\r\n");
+	printf("    xrock run <script|-> [--keep-going]          - Run commands from script or stdin in one session\r\n");
+	printf("    xrock --all <command> [...]                  - Run command on all chips in parallel\r\n");
+	printf("    xrock --devices <path,...> <command> [...]   - Run command on the chips at usb port paths in parallel\r\n");
+	printf("    xrock schedule <jobfile> [--per-bus <n>]     - Run per port job lists, limit heavy steps per usb bus\r\n");
+	printf("    xrock provision <csv> [path,...]             - Claim one csv row per chip, write and verify sn, mac and vendor storage\r\n");
+	printf("    xrock serve <socket>                         - Serve all chips over a unix domain socket\r\n");
+	printf("    xrock uart-capture <tty> <file> [baud]       - Capture the binary maskrom dump from debug uart\r\n");
 	printf("    xrock maskrom <ddr> <usbplug> [--rc4-off]    - Initial chip using ddr and usbplug in maskrom mode\r\n");
 	printf("    xrock download <loader>                      - Initial chip using loader in maskrom mode\r\n");
 	printf("    xrock upgrade <loader>                       - Upgrade loader to flash in loader mode\r\n");
+	printf("    xrock provision-flow <loader> [sec file ...] - Download, wait for loader, upgrade and write images\r\n");
 	printf("    xrock ready                                  - Show chip ready or not\r\n");
 	printf("    xrock version                                - Show chip version\r\n");
 	printf("    xrock capability                             - Show capability information\r\n");
@@ -43,65 +65,114 @@ static void usage(void)
 	printf("    xrock flash erase <sector> <count>           - Erase flash sector\r\n");
 	printf("    xrock flash read <sector> <count> <file>     - Read flash sector to file\r\n");
 	printf("    xrock flash write <sector> <file>            - Write file to flash sector\r\n");
+	printf("    xrock flash scrub <sector> <count> <map> [file] - Scrub flash, write latency map and skip bad sectors\r\n");
+	printf("    xrock flash update <sector> <file> <dir> [--version <string>] [--vs <index>] - Write only changed blocks to flash sector\r\n");
+	printf("    xrock flash backup <store> <manifest>        - Backup whole flash to content addressed store\r\n");
+	printf("    xrock flash restore <store> <manifest>       - Restore flash from content addressed store\r\n");
 
 	printf("extra:\r\n");
 	printf("    xrock extra maskrom --rc4 <on|off> [--sram <file> --delay <ms>] [--dram <file> --delay <ms>] [...]\r\n");
-	printf("    xrock extra maskrom-dump-arm32 --rc4 <on|off> --uart <register> <address> <length>\r\n");
-	printf("    xrock extra maskrom-dump-arm64 --rc4 <on|off> --uart <register> <address> <length>\r\n");
+	printf("    xrock extra maskrom-dump-arm32 --rc4 <on|off> --uart <register> [--binary] <address> <length>\r\n");
+	printf("    xrock extra maskrom-dump-arm64 --rc4 <on|off> --uart <register> [--binary] <address> <length>\r\n");
 	printf("    xrock extra maskrom-write-arm32 --rc4 <on|off> <address> <file>\r\n");
 	printf("    xrock extra maskrom-write-arm64 --rc4 <on|off> <address> <file>\r\n");
 	printf("    xrock extra maskrom-exec-arm32 --rc4 <on|off> <address>\r\n");
 	printf("    xrock extra maskrom-exec-arm64 --rc4 <on|off> <address>\r\n");
+	printf("    xrock extra crc32-arm32 <scratch> <address> <length> [file]\r\n");
+	printf("    xrock extra crc32-arm64 <scratch> <address> <length> [file]\r\n");
+	printf("    xrock extra memtest-arm32 <scratch> <address> <length>\r\n");
+	printf("    xrock extra memtest-arm64 <scratch> <address> <length>\r\n");
+	printf("    xrock extra memfill-arm32 <scratch> <address> <length> <value>\r\n");
+	printf("    xrock extra memfill-arm64 <scratch> <address> <length> <value>\r\n");
 }
 
-int main(int argc, char * argv[])
+static __thread int xrock_status = 1;
+
+static void hexdump(uint32_t addr, void * buf, size_t len)
 {
-	struct xrock_ctx_t ctx;
+	unsigned char * p = buf;
+	size_t i, j;
 
-	if(argc < 2)
-	{
-		usage();
-		return 0;
-	}
-	for(int i = 1; i < argc; i++)
+	for(j = 0; j < len; j += 16)
 	{
-		if(!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help"))
+		printf("%08x: ", (uint32_t)(addr + j));
+		for(i = 0; i < 16; i++)
 		{
-			usage();
-			return 0;
+			if(j + i < len)
+				printf("%02x ", p[j + i]);
+			else
+				printf("   ");
+		}
+		putchar(' ');
+		for(i = 0; i < 16; i++)
+		{
+			if(j + i >= len)
+				putchar(' ');
+			else
+				putchar(isprint(p[j + i]) ? p[j + i] : '.');
 		}
+		printf("\r\n");
 	}
+}
 
-	libusb_init(&ctx.context);
-	if(!xrock_init(&ctx))
-	{
-		printf("ERROR: Can't found any supported rockchip chips\r\n");
-		if(ctx.hdl)
-			libusb_close(ctx.hdl);
-		libusb_exit(ctx.context);
-		return -1;
-	}
+static void xrock_error(const char * fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vprintf(fmt, ap);
+	va_end(ap);
+	xrock_status = 0;
+}
+
+static void xrock_usage(void)
+{
+	usage();
+	xrock_status = 0;
+}
+
+/*
+ * The -arm32 and -arm64 extra commands only run on chips of that arch
+ */
+static int xrock_arch_match(struct xrock_ctx_t * ctx, const char * cmd)
+{
+	size_t l = strlen(cmd);
+
+	if((l < 6) || (ctx->chip->arch == CHIP_ARCH_UNKNOWN))
+		return 1;
+	if(!strcmp(cmd + l - 6, "-arm32"))
+		return (ctx->chip->arch == CHIP_ARCH_ARM32) ? 1 : 0;
+	if(!strcmp(cmd + l - 6, "-arm64"))
+		return (ctx->chip->arch == CHIP_ARCH_ARM64) ? 1 : 0;
+	return 1;
+}
+
+static int xrock_command(struct xrock_ctx_t * ctx, int argc, char * argv[])
+{
+	xrock_status = 1;
 	if(!strcmp(argv[1], "maskrom"))
 	{
 		argc -= 2;
 		argv += 2;
 		if(argc >= 2)
 		{
-			if(ctx.maskrom)
+			if(ctx->maskrom)
 			{
 				int rc4 = 1;
 				if((argc == 3) && !strcmp(argv[2], "--rc4-off"))
 					rc4 = 0;
-				rock_maskrom_upload_file(&ctx, 0x471, argv[0], rc4);
+				if(!rock_maskrom_upload_file(ctx, 0x471, argv[0], rc4))
+					xrock_error("Failed to upload '%s'\r\n", argv[0]);
 				usleep(10 * 1000);
-				rock_maskrom_upload_file(&ctx, 0x472, argv[1], rc4);
+				if(!rock_maskrom_upload_file(ctx, 0x472, argv[1], rc4))
+					xrock_error("Failed to upload '%s'\r\n", argv[1]);
 				usleep(10 * 1000);
 			}
 			else
-				printf("ERROR: The chip '%s' does not in maskrom mode\r\n", ctx.chip->name);
+				xrock_error("ERROR: The chip '%s' does not in maskrom mode\r\n", ctx->chip->name);
 		}
 		else
-			usage();
+			xrock_usage();
 	}
 	else if(!strcmp(argv[1], "download"))
 	{
@@ -109,7 +180,7 @@ int main(int argc, char * argv[])
 		argv += 2;
 		if(argc == 1)
 		{
-			if(ctx.maskrom)
+			if(ctx->maskrom)
 			{
 				struct rkloader_ctx_t * lctx = rkloader_ctx_alloc(argv[0]);
 				if(lctx)
@@ -125,7 +196,8 @@ int main(int argc, char * argv[])
 							uint32_t delay = get_unaligned_le32(&e->data_delay);
 
 							printf("Downloading '%s'\r\n", loader_wide2str(str, (uint8_t *)&e->name[0], sizeof(e->name)));
-							rock_maskrom_upload_memory(&ctx, 0x471, buf, len, lctx->is_rc4on);
+							if(!rock_maskrom_upload_memory(ctx, 0x471, buf, len, lctx->is_rc4on))
+								xrock_error("Failed to download '%s'\r\n", str);
 							usleep(delay * 1000);
 						}
 						else if(e->type == RKLOADER_ENTRY_472)
@@ -135,20 +207,21 @@ int main(int argc, char * argv[])
 							uint32_t delay = get_unaligned_le32(&e->data_delay);
 
 							printf("Downloading '%s'\r\n", loader_wide2str(str, (uint8_t *)&e->name[0], sizeof(e->name)));
-							rock_maskrom_upload_memory(&ctx, 0x472, buf, len, lctx->is_rc4on);
+							if(!rock_maskrom_upload_memory(ctx, 0x472, buf, len, lctx->is_rc4on))
+								xrock_error("Failed to download '%s'\r\n", str);
 							usleep(delay * 1000);
 						}
 					}
 					rkloader_ctx_free(lctx);
 				}
 				else
-					printf("ERROR: Not a valid loader '%s'\r\n", argv[0]);
+					xrock_error("ERROR: Not a valid loader '%s'\r\n", argv[0]);
 			}
 			else
-				printf("ERROR: The chip '%s' does not in maskrom mode\r\n", ctx.chip->name);
+				xrock_error("ERROR: The chip '%s' does not in maskrom mode\r\n", ctx->chip->name);
 		}
 		else
-			usage();
+			xrock_usage();
 	}
 	else if(!strcmp(argv[1], "upgrade"))
 	{
@@ -159,58 +232,33 @@ int main(int argc, char * argv[])
 			struct rkloader_ctx_t * lctx = rkloader_ctx_alloc(argv[0]);
 			if(lctx)
 			{
-				uint32_t sec = 64;
-				enum storage_type_t type = rock_storage_read(&ctx);
-				switch(type)
-				{
-				case STORAGE_TYPE_FLASH:
-					sec = 64;
-					break;
-				case STORAGE_TYPE_EMMC:
-					sec = 64;
-					break;
-				case STORAGE_TYPE_SD:
-					sec = 64;
-					break;
-				case STORAGE_TYPE_SD1:
-					sec = 64;
-					break;
-				case STORAGE_TYPE_SPINOR:
-					sec = 128;
-					break;
-				case STORAGE_TYPE_SPINAND:
-					sec = 512;
-					break;
-				case STORAGE_TYPE_RAM:
-					sec = 64;
-					break;
-				case STORAGE_TYPE_USB:
-					sec = 64;
-					break;
-				case STORAGE_TYPE_SATA:
-					sec = 64;
-					break;
-				case STORAGE_TYPE_PCIE:
-					sec = 64;
-					break;
-				default:
-					break;
-				}
 				struct flash_info_t info;
-				if(rock_flash_detect(&ctx, &info))
+				if(rock_flash_detect(ctx, &info))
 				{
-					if(!rock_flash_write_lba_progress(&ctx, sec, lctx->idblen / 512, lctx->idbbuf))
-						printf("Failed to write flash\r\n");
+					if(!rock_loader_upgrade_progress(ctx, lctx))
+						xrock_error("Failed to write flash\r\n");
 				}
 				else
-					printf("Failed to detect flash\r\n");
+					xrock_error("Failed to detect flash\r\n");
 				rkloader_ctx_free(lctx);
 			}
 			else
-				printf("ERROR: Not a valid loader '%s'\r\n", argv[0]);
+				xrock_error("ERROR: Not a valid loader '%s'\r\n", argv[0]);
 		}
 		else
-			usage();
+			xrock_usage();
+	}
+	else if(!strcmp(argv[1], "provision-flow"))
+	{
+		argc -= 2;
+		argv += 2;
+		if((argc >= 1) && (argc % 2 == 1))
+		{
+			if(!xrock_flow(ctx, argv[0], argc - 1, argv + 1))
+				xrock_status = 0;
+		}
+		else
+			xrock_usage();
 	}
 	else if(!strcmp(argv[1], "ready"))
 	{
@@ -218,13 +266,13 @@ int main(int argc, char * argv[])
 		argv += 2;
 		if(argc == 0)
 		{
-			if(rock_ready(&ctx))
+			if(rock_ready(ctx))
 				printf("The chip is ready\r\n");
 			else
-				printf("Failed to show chip ready status\r\n");
+				xrock_error("Failed to show chip ready status\r\n");
 		}
 		else
-			usage();
+			xrock_usage();
 	}
 	else if(!strcmp(argv[1], "version"))
 	{
@@ -233,18 +281,18 @@ int main(int argc, char * argv[])
 		if(argc == 0)
 		{
 			uint8_t buf[16];
-			if(rock_version(&ctx, buf))
-				printf("%s(%c%c%c%c): 0x%02x%02x%02x%02x 0x%02x%02x%02x%02x 0x%02x%02x%02x%02x 0x%02x%02x%02x%02x\r\n", ctx.chip->name,
+			if(rock_version(ctx, buf))
+				printf("%s(%c%c%c%c): 0x%02x%02x%02x%02x 0x%02x%02x%02x%02x 0x%02x%02x%02x%02x 0x%02x%02x%02x%02x\r\n", ctx->chip->name,
 					buf[ 3], buf[ 2], buf[ 1], buf[ 0],
 					buf[ 3], buf[ 2], buf[ 1], buf[ 0],
 					buf[ 7], buf[ 6], buf[ 5], buf[ 4],
 					buf[11], buf[10], buf[ 9], buf[ 8],
 					buf[15], buf[14], buf[13], buf[12]);
 			else
-				printf("Failed to get chip version\r\n");
+				xrock_error("Failed to get chip version\r\n");
 		}
 		else
-			usage();
+			xrock_usage();
 	}
 	else if(!strcmp(argv[1], "capability"))
 	{
@@ -253,7 +301,7 @@ int main(int argc, char * argv[])
 		if(argc == 0)
 		{
 			uint8_t buf[8];
-			if(rock_capability(&ctx, buf))
+			if(rock_capability(ctx, buf))
 			{
 				printf("Capability: %02x %02x %02x %02x %02x %02x %02x %02x\r\n",
 					buf[0], buf[1], buf[2], buf[3], buf[4], buf[5], buf[6], buf[7]);
@@ -272,10 +320,10 @@ int main(int argc, char * argv[])
 				printf("    Switch USB3: %s\r\n", (buf[1] & (1 << 4)) ? "enabled" : "disabled");
 			}
 			else
-				printf("Failed to show capability information\r\n");
+				xrock_error("Failed to show capability information\r\n");
 		}
 		else
-			usage();
+			xrock_usage();
 	}
 	else if(!strcmp(argv[1], "reset"))
 	{
@@ -284,12 +332,15 @@ int main(int argc, char * argv[])
 		if(argc > 0)
 		{
 			if(!strcmp(argv[0], "maskrom"))
-				rock_reset(&ctx, 1);
+			{
+				if(!rock_reset(ctx, 1))
+					xrock_error("Failed to reset chip\r\n");
+			}
 			else
-				usage();
+				xrock_usage();
 		}
-		else
-			rock_reset(&ctx, 0);
+		else if(!rock_reset(ctx, 0))
+			xrock_error("Failed to reset chip\r\n");
 	}
 	else if(!strcmp(argv[1], "dump"))
 	{
@@ -302,13 +353,17 @@ int main(int argc, char * argv[])
 			char * buf = malloc(len);
 			if(buf)
 			{
-				rock_read(&ctx, addr, buf, len);
-				hexdump(addr, buf, len);
+				if(rock_read(ctx, addr, buf, len))
+					hexdump(addr, buf, len);
+				else
+					xrock_error("Failed to read memory\r\n");
 				free(buf);
 			}
+			else
+				xrock_error("ERROR: Not enough memory\r\n");
 		}
 		else
-			usage();
+			xrock_usage();
 	}
 	else if(!strcmp(argv[1], "read"))
 	{
@@ -321,13 +376,17 @@ int main(int argc, char * argv[])
 			char * buf = malloc(len);
 			if(buf)
 			{
-				rock_read_progress(&ctx, addr, buf, len);
-				file_save(argv[2], buf, len);
+				if(!rock_read_progress(ctx, addr, buf, len))
+					xrock_error("Failed to read memory\r\n");
+				else if(file_save(argv[2], buf, len) != len)
+					xrock_error("Failed to save '%s'\r\n", argv[2]);
 				free(buf);
 			}
+			else
+				xrock_error("ERROR: Not enough memory\r\n");
 		}
 		else
-			usage();
+			xrock_usage();
 	}
 	else if(!strcmp(argv[1], "write"))
 	{
@@ -340,12 +399,15 @@ int main(int argc, char * argv[])
 			void * buf = file_load(argv[1], &len);
 			if(buf)
 			{
-				rock_write_progress(&ctx, addr, buf, len);
+				if(!rock_write_progress(ctx, addr, buf, len))
+					xrock_error("Failed to write memory\r\n");
 				free(buf);
 			}
+			else
+				xrock_error("Failed to load '%s'\r\n", argv[1]);
 		}
 		else
-			usage();
+			xrock_usage();
 	}
 	else if(!strcmp(argv[1], "exec"))
 	{
@@ -355,14 +417,15 @@ int main(int argc, char * argv[])
 		{
 			uint32_t addr = strtoul(argv[0], NULL, 0);
 			uint32_t dtb = (argc >= 2) ? strtoul(argv[1], NULL, 0) : 0;
-			rock_exec(&ctx, addr, dtb);
+			if(!rock_exec(ctx, addr, dtb))
+				xrock_error("Failed to exec memory\r\n");
 		}
 		else
-			usage();
+			xrock_usage();
 	}
 	else if(!strcmp(argv[1], "otp"))
 	{
-		if(rock_capability_support(&ctx, CAPABILITY_TYPE_READ_OTP_CHIP))
+		if(rock_capability_support(ctx, CAPABILITY_TYPE_READ_OTP_CHIP))
 		{
 			argc -= 2;
 			argv += 2;
@@ -374,28 +437,32 @@ int main(int argc, char * argv[])
 					uint8_t * otp = malloc(len);
 					if(otp)
 					{
-						if(rock_otp_read(&ctx, otp, len))
+						if(rock_otp_read(ctx, otp, len))
 							hexdump(0, otp, len);
+						else
+							xrock_error("Failed to read otp\r\n");
 						free(otp);
 					}
+					else
+						xrock_error("ERROR: Not enough memory\r\n");
 				}
 			}
 			else
-				usage();
+				xrock_usage();
 		}
 		else
-			printf("The loader don't support dump otp\r\n");
+			xrock_error("The loader don't support dump otp\r\n");
 	}
 	else if(!strcmp(argv[1], "sn"))
 	{
-		if(rock_capability_support(&ctx, CAPABILITY_TYPE_VENDOR_STORAGE) || rock_capability_support(&ctx, CAPABILITY_TYPE_NEW_VENDOR_STORAGE))
+		if(rock_capability_support(ctx, CAPABILITY_TYPE_VENDOR_STORAGE) || rock_capability_support(ctx, CAPABILITY_TYPE_NEW_VENDOR_STORAGE))
 		{
 			argc -= 2;
 			argv += 2;
 			if(argc == 0)
 			{
 				char sn[512 - 8 + 1];
-				if(rock_sn_read(&ctx, sn))
+				if(rock_sn_read(ctx, sn))
 					printf("SN: %s\r\n", sn);
 				else
 					printf("No serial number\r\n");
@@ -404,21 +471,21 @@ int main(int argc, char * argv[])
 			{
 				if(argc == 1)
 				{
-					if(rock_sn_write(&ctx, argv[0]))
+					if(rock_sn_write(ctx, argv[0]))
 						printf("Write serial number '%s'\r\n", argv[0]);
 					else
-						printf("Failed to write serial number\r\n");
+						xrock_error("Failed to write serial number\r\n");
 				}
 				else
-					usage();
+					xrock_usage();
 			}
 		}
 		else
-			printf("The loader don't support vendor storage\r\n");
+			xrock_error("The loader don't support vendor storage\r\n");
 	}
 	else if(!strcmp(argv[1], "vs"))
 	{
-		if(rock_capability_support(&ctx, CAPABILITY_TYPE_VENDOR_STORAGE) || rock_capability_support(&ctx, CAPABILITY_TYPE_NEW_VENDOR_STORAGE))
+		if(rock_capability_support(ctx, CAPABILITY_TYPE_VENDOR_STORAGE) || rock_capability_support(ctx, CAPABILITY_TYPE_NEW_VENDOR_STORAGE))
 		{
 			argc -= 2;
 			argv += 2;
@@ -434,10 +501,14 @@ int main(int argc, char * argv[])
 						uint8_t * buf = malloc(len);
 						if(buf)
 						{
-							if(rock_vs_read(&ctx, type, index, buf, len))
+							if(rock_vs_read(ctx, type, index, buf, len))
 								hexdump(0, buf, len);
+							else
+								xrock_error("Failed to read vendor storage\r\n");
 							free(buf);
 						}
+						else
+							xrock_error("ERROR: Not enough memory\r\n");
 					}
 				}
 				else if(!strcmp(argv[0], "read") && (argc >= 4))
@@ -450,10 +521,14 @@ int main(int argc, char * argv[])
 						uint8_t * buf = malloc(len);
 						if(buf)
 						{
-							if(rock_vs_read(&ctx, type, index, buf, len))
-								file_save(argv[3], buf, len);
+							if(!rock_vs_read(ctx, type, index, buf, len))
+								xrock_error("Failed to read vendor storage\r\n");
+							else if(file_save(argv[3], buf, len) != len)
+								xrock_error("Failed to save '%s'\r\n", argv[3]);
 							free(buf);
 						}
+						else
+							xrock_error("ERROR: Not enough memory\r\n");
 					}
 				}
 				else if(!strcmp(argv[0], "write") && (argc >= 3))
@@ -464,19 +539,22 @@ int main(int argc, char * argv[])
 					void * buf = file_load(argv[2], &len);
 					if(buf && (len > 0))
 					{
-						if(!rock_vs_write(&ctx, type, index, buf, (len > 512) ? 512 : len))
-							printf("Failed to write vendor storage\r\n");
-						free(buf);
+						if(!rock_vs_write(ctx, type, index, buf, (len > 512) ? 512 : len))
+							xrock_error("Failed to write vendor storage\r\n");
 					}
+					else
+						xrock_error("Failed to load '%s'\r\n", argv[2]);
+					if(buf)
+						free(buf);
 				}
 				else
-					usage();
+					xrock_usage();
 			}
 			else
-				usage();
+				xrock_usage();
 		}
 		else
-			printf("The loader don't support vendor storage\r\n");
+			xrock_error("The loader don't support vendor storage\r\n");
 	}
 	else if(!strcmp(argv[1], "storage"))
 	{
@@ -484,7 +562,7 @@ int main(int argc, char * argv[])
 		argv += 2;
 		if(argc == 0)
 		{
-			enum storage_type_t type = rock_storage_read(&ctx);
+			enum storage_type_t type = rock_storage_read(ctx);
 			printf("%s 0.UNKNOWN\r\n", (type == STORAGE_TYPE_UNKNOWN) ? "-->" : "   ");
 			printf("%s 1.FLASH\r\n", (type == STORAGE_TYPE_FLASH) ? "-->" : "   ");
 			printf("%s 2.EMMC\r\n", (type == STORAGE_TYPE_EMMC) ? "-->" : "   ");
@@ -499,7 +577,7 @@ int main(int argc, char * argv[])
 		}
 		else
 		{
-			if(rock_capability_support(&ctx, CAPABILITY_TYPE_SWITCH_STORAGE))
+			if(rock_capability_support(ctx, CAPABILITY_TYPE_SWITCH_STORAGE))
 			{
 				if(argc == 1)
 				{
@@ -543,8 +621,9 @@ int main(int argc, char * argv[])
 					default:
 						break;
 					}
-					rock_storage_switch(&ctx, type);
-					type = rock_storage_read(&ctx);
+					if(!rock_storage_switch(ctx, type))
+						xrock_error("Failed to switch storage\r\n");
+					type = rock_storage_read(ctx);
 					printf("%s 0.UNKNOWN\r\n", (type == STORAGE_TYPE_UNKNOWN) ? "-->" : "   ");
 					printf("%s 1.FLASH\r\n", (type == STORAGE_TYPE_FLASH) ? "-->" : "   ");
 					printf("%s 2.EMMC\r\n", (type == STORAGE_TYPE_EMMC) ? "-->" : "   ");
@@ -558,10 +637,10 @@ int main(int argc, char * argv[])
 					printf("%s10.PCIE\r\n", (type == STORAGE_TYPE_PCIE) ? "-->" : "   ");
 				}
 				else
-					usage();
+					xrock_usage();
 			}
 			else
-				printf("The loader don't support switch storage\r\n");
+				xrock_error("The loader don't support switch storage\r\n");
 		}
 	}
 	else if(!strcmp(argv[1], "flash"))
@@ -571,7 +650,7 @@ int main(int argc, char * argv[])
 		if(argc == 0)
 		{
 			struct flash_info_t info;
-			if(rock_flash_detect(&ctx, &info))
+			if(rock_flash_detect(ctx, &info))
 			{
 				printf("Flash info:\r\n");
 				printf("    Manufacturer: %s (%d)\r\n", (info.manufacturer_id < ARRAY_SIZE(manufacturer))
@@ -592,7 +671,7 @@ int main(int argc, char * argv[])
 								info.id[0], info.id[1],	info.id[2],	info.id[3],	info.id[4]);
 			}
 			else
-				printf("Failed to detect flash\r\n");
+				xrock_error("Failed to detect flash\r\n");
 		}
 		else
 		{
@@ -603,7 +682,7 @@ int main(int argc, char * argv[])
 				struct flash_info_t info;
 				uint32_t sec = strtoul(argv[0], NULL, 0);
 				uint32_t cnt = strtoul(argv[1], NULL, 0);
-				if(rock_flash_detect(&ctx, &info))
+				if(rock_flash_detect(ctx, &info))
 				{
 					if(sec < info.sector_total)
 					{
@@ -611,14 +690,14 @@ int main(int argc, char * argv[])
 							cnt = info.sector_total - sec;
 						else if(cnt > info.sector_total - sec)
 							cnt = info.sector_total - sec;
-						if(!rock_flash_erase_lba_progress(&ctx, sec, cnt))
-							printf("Failed to erase flash\r\n");
+						if(!rock_flash_erase_lba_progress(ctx, sec, cnt))
+							xrock_error("Failed to erase flash\r\n");
 					}
 					else
-						printf("The start sector is out of range\r\n");
+						xrock_error("The start sector is out of range\r\n");
 				}
 				else
-					printf("Failed to detect flash\r\n");
+					xrock_error("Failed to detect flash\r\n");
 			}
 			else if(!strcmp(argv[0], "read") && (argc == 4))
 			{
@@ -627,7 +706,7 @@ int main(int argc, char * argv[])
 				struct flash_info_t info;
 				uint32_t sec = strtoul(argv[0], NULL, 0);
 				uint32_t cnt = strtoul(argv[1], NULL, 0);
-				if(rock_flash_detect(&ctx, &info))
+				if(rock_flash_detect(ctx, &info))
 				{
 					if(sec < info.sector_total)
 					{
@@ -635,14 +714,25 @@ int main(int argc, char * argv[])
 							cnt = info.sector_total - sec;
 						else if(cnt > info.sector_total - sec)
 							cnt = info.sector_total - sec;
-						if(!rock_flash_read_lba_to_file_progress(&ctx, sec, cnt, argv[2]))
-							printf("Failed to read flash\r\n");
+						if(rock_flash_read_lba_to_file_progress(ctx, sec, cnt, argv[2]))
+						{
+							char path[4096], hex[SHA256_DIGEST_SIZE * 2 + 1];
+							snprintf(path, sizeof(path), "%s.merkle", argv[2]);
+							struct merkle_ctx_t * mctx = merkle_load(path);
+							if(mctx)
+							{
+								printf("Merkle root: %s\r\n", sha256_hex(hex, mctx->root));
+								merkle_free(mctx);
+							}
+						}
+						else
+							xrock_error("Failed to read flash\r\n");
 					}
 					else
-						printf("The start sector is out of range\r\n");
+						xrock_error("The start sector is out of range\r\n");
 				}
 				else
-					printf("Failed to detect flash\r\n");
+					xrock_error("Failed to detect flash\r\n");
 			}
 			else if(!strcmp(argv[0], "write") && (argc == 3))
 			{
@@ -650,34 +740,152 @@ int main(int argc, char * argv[])
 				argv += 1;
 				struct flash_info_t info;
 				uint32_t sec = strtoul(argv[0], NULL, 0);
-				if(rock_flash_detect(&ctx, &info))
+				if(rock_flash_detect(ctx, &info))
 				{
 					if(sec < info.sector_total)
 					{
-						if(!rock_flash_write_lba_from_file_progress(&ctx, sec, info.sector_total, argv[1]))
-							printf("Failed to write flash\r\n");
+						if(!rock_flash_write_lba_from_file_progress(ctx, sec, info.sector_total, argv[1]))
+							xrock_error("Failed to write flash\r\n");
+					}
+					else
+						xrock_error("The start sector is out of range\r\n");
+				}
+				else
+					xrock_error("Failed to detect flash\r\n");
+			}
+			else if(!strcmp(argv[0], "scrub") && ((argc == 4) || (argc == 5)))
+			{
+				argc -= 1;
+				argv += 1;
+				struct flash_info_t info;
+				uint32_t sec = strtoul(argv[0], NULL, 0);
+				uint32_t cnt = strtoul(argv[1], NULL, 0);
+				struct scrub_report_t report;
+				if(rock_flash_detect(ctx, &info))
+				{
+					if(sec < info.sector_total)
+					{
+						if(cnt <= 0)
+							cnt = info.sector_total - sec;
+						else if(cnt > info.sector_total - sec)
+							cnt = info.sector_total - sec;
+						memset(&report, 0, sizeof(struct scrub_report_t));
+						if(rock_flash_scrub_progress(ctx, sec, cnt, argv[2], (argc == 4) ? argv[3] : NULL, &report))
+						{
+							printf("Scrub %u chunks, %u bad sectors, average latency %.3f ms, slowest %.3f ms at sector %u\r\n",
+								report.nchunk, report.nbad, report.average * 1000.0, report.slowest * 1000.0, report.slowest_sector);
+							for(uint32_t i = 0; i < report.nbad; i++)
+								printf("Bad sector: %u\r\n", report.bad[i]);
+							if(report.bad)
+								free(report.bad);
+						}
+						else
+							xrock_error("Failed to scrub flash\r\n");
 					}
 					else
-						printf("The start sector is out of range\r\n");
+						xrock_error("The start sector is out of range\r\n");
 				}
 				else
-					printf("Failed to detect flash\r\n");
+					xrock_error("Failed to detect flash\r\n");
+			}
+			else if(!strcmp(argv[0], "update") && (argc >= 4))
+			{
+				argc -= 1;
+				argv += 1;
+				struct flash_info_t info;
+				uint32_t sec = strtoul(argv[0], NULL, 0);
+				char * version = NULL;
+				int index = DELTA_IMAGE_ID_VS_INDEX;
+				for(int i = 3; i < argc; i++)
+				{
+					if(!strcmp(argv[i], "--version") && (argc > i + 1))
+					{
+						version = argv[i + 1];
+						i++;
+					}
+					else if(!strcmp(argv[i], "--vs") && (argc > i + 1))
+					{
+						index = strtoul(argv[i + 1], NULL, 0);
+						i++;
+					}
+					else
+					{
+						xrock_usage();
+						return xrock_status;
+					}
+				}
+				if(rock_capability_support(ctx, CAPABILITY_TYPE_VENDOR_STORAGE) || rock_capability_support(ctx, CAPABILITY_TYPE_NEW_VENDOR_STORAGE))
+				{
+					if(rock_flash_detect(ctx, &info))
+					{
+						if(sec < info.sector_total)
+						{
+							struct delta_report_t report;
+							char hex[SHA256_DIGEST_SIZE * 2 + 1];
+							if(rock_flash_update_from_file_progress(ctx, sec, info.sector_total, argv[1], argv[2], version, index, &report))
+							{
+								if(report.installed)
+									printf("Installed image '%s' (%s)\r\n", report.installed_version, sha256_hex(hex, report.installed_root));
+								printf("Delta upgrade %llu of %llu blocks, image '%s' (%s)\r\n", (unsigned long long)report.nblock, (unsigned long long)report.nleaf, report.version, sha256_hex(hex, report.root));
+							}
+							else
+								xrock_error("Failed to update flash\r\n");
+						}
+						else
+							xrock_error("The start sector is out of range\r\n");
+					}
+					else
+						xrock_error("Failed to detect flash\r\n");
+				}
+				else
+					xrock_error("The loader don't support vendor storage\r\n");
+			}
+			else if(!strcmp(argv[0], "backup") && (argc == 3))
+			{
+				argc -= 1;
+				argv += 1;
+				struct flash_info_t info;
+				uint32_t nstored;
+				if(rock_flash_detect(ctx, &info))
+				{
+					if(rock_flash_backup_progress(ctx, 0, info.sector_total, argv[0], argv[1], &nstored))
+						printf("Backup %u chunks, %u new chunks stored\r\n", (info.sector_total + BACKUP_CHUNK_SECTORS - 1) / BACKUP_CHUNK_SECTORS, nstored);
+					else
+						xrock_error("Failed to backup flash\r\n");
+				}
+				else
+					xrock_error("Failed to detect flash\r\n");
+			}
+			else if(!strcmp(argv[0], "restore") && (argc == 3))
+			{
+				argc -= 1;
+				argv += 1;
+				struct flash_info_t info;
+				if(rock_flash_detect(ctx, &info))
+				{
+					if(!rock_flash_restore_progress(ctx, info.sector_total, argv[0], argv[1]))
+						xrock_error("Failed to restore flash\r\n");
+				}
+				else
+					xrock_error("Failed to detect flash\r\n");
 			}
 			else
-				usage();
+				xrock_usage();
 		}
 	}
 	else if(!strcmp(argv[1], "extra"))
 	{
 		argc -= 2;
 		argv += 2;
-		if(!strcmp(argv[0], "maskrom"))
+		if((argc > 0) && !xrock_arch_match(ctx, argv[0]))
+			xrock_error("ERROR: The chip '%s' is %s, '%s' does not run on it\r\n", ctx->chip->name, (ctx->chip->arch == CHIP_ARCH_ARM64) ? "arm64" : "arm32", argv[0]);
+		else if(!strcmp(argv[0], "maskrom"))
 		{
 			argc -= 1;
 			argv += 1;
 			if(argc >= 2)
 			{
-				if(ctx.maskrom)
+				if(ctx->maskrom)
 				{
 					int rc4 = 0;
 					for(int i = 0; i < argc; i++)
@@ -692,12 +900,14 @@ int main(int argc, char * argv[])
 						}
 						else if(!strcmp(argv[i], "--sram") && (argc > i + 1))
 						{
-							rock_maskrom_upload_file(&ctx, 0x471, argv[i + 1], rc4);
+							if(!rock_maskrom_upload_file(ctx, 0x471, argv[i + 1], rc4))
+								xrock_error("Failed to upload '%s'\r\n", argv[i + 1]);
 							i++;
 						}
 						else if(!strcmp(argv[i], "--dram") && (argc > i + 1))
 						{
-							rock_maskrom_upload_file(&ctx, 0x472, argv[i + 1], rc4);
+							if(!rock_maskrom_upload_file(ctx, 0x472, argv[i + 1], rc4))
+								xrock_error("Failed to upload '%s'\r\n", argv[i + 1]);
 							i++;
 						}
 						else if(!strcmp(argv[i], "--delay") && (argc > i + 1))
@@ -708,19 +918,19 @@ int main(int argc, char * argv[])
 						}
 						else if(*argv[i] == '-')
 						{
-							usage();
+							xrock_usage();
 						}
 						else if(*argv[i] != '-' && strcmp(argv[i], "-") != 0)
 						{
-							usage();
+							xrock_usage();
 						}
 					}
 				}
 				else
-					printf("ERROR: The chip '%s' does not in maskrom mode\r\n", ctx.chip->name);
+					xrock_error("ERROR: The chip '%s' does not in maskrom mode\r\n", ctx->chip->name);
 			}
 			else
-				usage();
+				xrock_usage();
 		}
 		else if(!strcmp(argv[0], "maskrom-dump-arm32"))
 		{
@@ -728,9 +938,10 @@ int main(int argc, char * argv[])
 			argv += 1;
 			if(argc >= 2)
 			{
-				if(ctx.maskrom)
+				if(ctx->maskrom)
 				{
 					int rc4 = 0;
+					int binary = 0;
 					uint32_t uart = 0x0;
 					uint32_t addr = 0x0;
 					uint32_t len = 0x0;
@@ -749,9 +960,13 @@ int main(int argc, char * argv[])
 							uart = strtoul(argv[i + 1], NULL, 0);
 							i++;
 						}
+						else if(!strcmp(argv[i], "--binary"))
+						{
+							binary = 1;
+						}
 						else if(*argv[i] == '-')
 						{
-							usage();
+							xrock_usage();
 						}
 						else if(*argv[i] != '-' && strcmp(argv[i], "-") != 0)
 						{
@@ -762,13 +977,14 @@ int main(int argc, char * argv[])
 							idx++;
 						}
 					}
-					rock_maskrom_dump_arm32(&ctx, uart, addr, len, rc4);
+					if(!(binary ? rock_maskrom_bindump_arm32(ctx, uart, addr, len, rc4) : rock_maskrom_dump_arm32(ctx, uart, addr, len, rc4)))
+						xrock_error("Failed to dump memory\r\n");
 				}
 				else
-					printf("ERROR: The chip '%s' does not in maskrom mode\r\n", ctx.chip->name);
+					xrock_error("ERROR: The chip '%s' does not in maskrom mode\r\n", ctx->chip->name);
 			}
 			else
-				usage();
+				xrock_usage();
 		}
 		else if(!strcmp(argv[0], "maskrom-dump-arm64"))
 		{
@@ -776,9 +992,10 @@ int main(int argc, char * argv[])
 			argv += 1;
 			if(argc >= 2)
 			{
-				if(ctx.maskrom)
+				if(ctx->maskrom)
 				{
 					int rc4 = 0;
+					int binary = 0;
 					uint32_t uart = 0x0;
 					uint32_t addr = 0x0;
 					uint32_t len = 0x0;
@@ -797,9 +1014,13 @@ int main(int argc, char * argv[])
 							uart = strtoul(argv[i + 1], NULL, 0);
 							i++;
 						}
+						else if(!strcmp(argv[i], "--binary"))
+						{
+							binary = 1;
+						}
 						else if(*argv[i] == '-')
 						{
-							usage();
+							xrock_usage();
 						}
 						else if(*argv[i] != '-' && strcmp(argv[i], "-") != 0)
 						{
@@ -810,13 +1031,14 @@ int main(int argc, char * argv[])
 							idx++;
 						}
 					}
-					rock_maskrom_dump_arm64(&ctx, uart, addr, len, rc4);
+					if(!(binary ? rock_maskrom_bindump_arm64(ctx, uart, addr, len, rc4) : rock_maskrom_dump_arm64(ctx, uart, addr, len, rc4)))
+						xrock_error("Failed to dump memory\r\n");
 				}
 				else
-					printf("ERROR: The chip '%s' does not in maskrom mode\r\n", ctx.chip->name);
+					xrock_error("ERROR: The chip '%s' does not in maskrom mode\r\n", ctx->chip->name);
 			}
 			else
-				usage();
+				xrock_usage();
 		}
 		else if(!strcmp(argv[0], "maskrom-write-arm32"))
 		{
@@ -824,7 +1046,7 @@ int main(int argc, char * argv[])
 			argv += 1;
 			if(argc >= 2)
 			{
-				if(ctx.maskrom)
+				if(ctx->maskrom)
 				{
 					int rc4 = 0;
 					char * filename = NULL;
@@ -841,7 +1063,7 @@ int main(int argc, char * argv[])
 						}
 						else if(*argv[i] == '-')
 						{
-							usage();
+							xrock_usage();
 						}
 						else if(*argv[i] != '-' && strcmp(argv[i], "-") != 0)
 						{
@@ -856,15 +1078,18 @@ int main(int argc, char * argv[])
 					void * buf = file_load(filename, &len);
 					if(buf)
 					{
-						rock_maskrom_write_arm32_progress(&ctx, addr, buf, len, rc4);
+						if(!rock_maskrom_write_arm32_progress(ctx, addr, buf, len, rc4))
+							xrock_error("Failed to write memory\r\n");
 						free(buf);
 					}
+					else
+						xrock_error("Failed to load '%s'\r\n", filename ? filename : "");
 				}
 				else
-					printf("ERROR: The chip '%s' does not in maskrom mode\r\n", ctx.chip->name);
+					xrock_error("ERROR: The chip '%s' does not in maskrom mode\r\n", ctx->chip->name);
 			}
 			else
-				usage();
+				xrock_usage();
 		}
 		else if(!strcmp(argv[0], "maskrom-write-arm64"))
 		{
@@ -872,7 +1097,7 @@ int main(int argc, char * argv[])
 			argv += 1;
 			if(argc >= 2)
 			{
-				if(ctx.maskrom)
+				if(ctx->maskrom)
 				{
 					int rc4 = 0;
 					char * filename = NULL;
@@ -889,7 +1114,7 @@ int main(int argc, char * argv[])
 						}
 						else if(*argv[i] == '-')
 						{
-							usage();
+							xrock_usage();
 						}
 						else if(*argv[i] != '-' && strcmp(argv[i], "-") != 0)
 						{
@@ -904,15 +1129,18 @@ int main(int argc, char * argv[])
 					void * buf = file_load(filename, &len);
 					if(buf)
 					{
-						rock_maskrom_write_arm64_progress(&ctx, addr, buf, len, rc4);
+						if(!rock_maskrom_write_arm64_progress(ctx, addr, buf, len, rc4))
+							xrock_error("Failed to write memory\r\n");
 						free(buf);
 					}
+					else
+						xrock_error("Failed to load '%s'\r\n", filename ? filename : "");
 				}
 				else
-					printf("ERROR: The chip '%s' does not in maskrom mode\r\n", ctx.chip->name);
+					xrock_error("ERROR: The chip '%s' does not in maskrom mode\r\n", ctx->chip->name);
 			}
 			else
-				usage();
+				xrock_usage();
 		}
 		else if(!strcmp(argv[0], "maskrom-exec-arm32"))
 		{
@@ -920,7 +1148,7 @@ int main(int argc, char * argv[])
 			argv += 1;
 			if(argc >= 2)
 			{
-				if(ctx.maskrom)
+				if(ctx->maskrom)
 				{
 					int rc4 = 0;
 					uint32_t addr = 0x0;
@@ -936,20 +1164,21 @@ int main(int argc, char * argv[])
 						}
 						else if(*argv[i] == '-')
 						{
-							usage();
+							xrock_usage();
 						}
 						else if(*argv[i] != '-' && strcmp(argv[i], "-") != 0)
 						{
 							addr = strtoul(argv[i], NULL, 0);
 						}
 					}
-					rock_maskrom_exec_arm32(&ctx, addr, rc4);
+					if(!rock_maskrom_exec_arm32(ctx, addr, rc4))
+						xrock_error("Failed to exec memory\r\n");
 				}
 				else
-					printf("ERROR: The chip '%s' does not in maskrom mode\r\n", ctx.chip->name);
+					xrock_error("ERROR: The chip '%s' does not in maskrom mode\r\n", ctx->chip->name);
 			}
 			else
-				usage();
+				xrock_usage();
 		}
 		else if(!strcmp(argv[0], "maskrom-exec-arm64"))
 		{
@@ -957,7 +1186,7 @@ int main(int argc, char * argv[])
 			argv += 1;
 			if(argc >= 2)
 			{
-				if(ctx.maskrom)
+				if(ctx->maskrom)
 				{
 					int rc4 = 0;
 					uint32_t addr = 0x0;
@@ -973,29 +1202,633 @@ int main(int argc, char * argv[])
 						}
 						else if(*argv[i] == '-')
 						{
-							usage();
+							xrock_usage();
 						}
 						else if(*argv[i] != '-' && strcmp(argv[i], "-") != 0)
 						{
 							addr = strtoul(argv[i], NULL, 0);
 						}
 					}
-					rock_maskrom_exec_arm64(&ctx, addr, rc4);
+					if(!rock_maskrom_exec_arm64(ctx, addr, rc4))
+						xrock_error("Failed to exec memory\r\n");
+				}
+				else
+					xrock_error("ERROR: The chip '%s' does not in maskrom mode\r\n", ctx->chip->name);
+			}
+			else
+				xrock_usage();
+		}
+		else if(!strcmp(argv[0], "crc32-arm32"))
+		{
+			argc -= 1;
+			argv += 1;
+			if(argc >= 3)
+			{
+				uint32_t scratch = strtoul(argv[0], NULL, 0);
+				uint32_t addr = strtoul(argv[1], NULL, 0);
+				uint32_t len = strtoul(argv[2], NULL, 0);
+				uint32_t crc;
+				if(rock_crc32_arm32(ctx, scratch, addr, len, &crc))
+				{
+					printf("CRC32: 0x%08x\r\n", crc);
+					if(argc >= 4)
+					{
+						uint64_t flen;
+						void * buf = file_load(argv[3], &flen);
+						if(buf)
+						{
+							if(flen >= len)
+							{
+								uint32_t c = crc32_sum_parallel(0, buf, len);
+								if(c != crc)
+									xrock_error("ERROR: CRC32 mismatch with '%s', expect 0x%08x\r\n", argv[3], c);
+							}
+							else
+								xrock_error("ERROR: The file '%s' is shorter than length\r\n", argv[3]);
+							free(buf);
+						}
+						else
+							xrock_error("Failed to load '%s'\r\n", argv[3]);
+					}
+				}
+				else
+					xrock_error("Failed to calculate crc32\r\n");
+			}
+			else
+				xrock_usage();
+		}
+		else if(!strcmp(argv[0], "crc32-arm64"))
+		{
+			argc -= 1;
+			argv += 1;
+			if(argc >= 3)
+			{
+				uint32_t scratch = strtoul(argv[0], NULL, 0);
+				uint32_t addr = strtoul(argv[1], NULL, 0);
+				uint32_t len = strtoul(argv[2], NULL, 0);
+				uint32_t crc;
+				if(rock_crc32_arm64(ctx, scratch, addr, len, &crc))
+				{
+					printf("CRC32: 0x%08x\r\n", crc);
+					if(argc >= 4)
+					{
+						uint64_t flen;
+						void * buf = file_load(argv[3], &flen);
+						if(buf)
+						{
+							if(flen >= len)
+							{
+								uint32_t c = crc32_sum_parallel(0, buf, len);
+								if(c != crc)
+									xrock_error("ERROR: CRC32 mismatch with '%s', expect 0x%08x\r\n", argv[3], c);
+							}
+							else
+								xrock_error("ERROR: The file '%s' is shorter than length\r\n", argv[3]);
+							free(buf);
+						}
+						else
+							xrock_error("Failed to load '%s'\r\n", argv[3]);
+					}
+				}
+				else
+					xrock_error("Failed to calculate crc32\r\n");
+			}
+			else
+				xrock_usage();
+		}
+		else if(!strcmp(argv[0], "memtest-arm32"))
+		{
+			argc -= 1;
+			argv += 1;
+			if(argc >= 3)
+			{
+				uint32_t scratch = strtoul(argv[0], NULL, 0);
+				uint32_t addr = strtoul(argv[1], NULL, 0);
+				uint32_t len = strtoul(argv[2], NULL, 0);
+				struct memtest_result_t r;
+				if(!rock_dram_valid(ctx, addr, len))
+					xrock_error("ERROR: The range 0x%08x - 0x%08x is not in the dram of chip '%s'\r\n", addr, addr + len, ctx->chip->name);
+				else if(rock_memtest_arm32_progress(ctx, scratch, addr, len, MEMTEST_MODE_WALKING_ONES | MEMTEST_MODE_ADDRESS | MEMTEST_MODE_RANDOM, 0, &r))
+				{
+					if(r.status)
+					{
+						const char * name = (r.status == MEMTEST_MODE_WALKING_ONES) ? "walking ones" : (r.status == MEMTEST_MODE_ADDRESS) ? "address" : "random";
+						xrock_error("ERROR: The %s test failed at 0x%08x, expect 0x%08x, actual 0x%08x\r\n", name, r.address, r.expect, r.actual);
+					}
+					else
+						printf("Memory test passed\r\n");
+				}
+				else
+					xrock_error("Failed to test memory\r\n");
+			}
+			else
+				xrock_usage();
+		}
+		else if(!strcmp(argv[0], "memfill-arm32"))
+		{
+			argc -= 1;
+			argv += 1;
+			if(argc >= 4)
+			{
+				uint32_t scratch = strtoul(argv[0], NULL, 0);
+				uint32_t addr = strtoul(argv[1], NULL, 0);
+				uint32_t len = strtoul(argv[2], NULL, 0);
+				uint32_t value = strtoul(argv[3], NULL, 0);
+				struct memtest_result_t r;
+				if(!rock_dram_valid(ctx, addr, len))
+					xrock_error("ERROR: The range 0x%08x - 0x%08x is not in the dram of chip '%s'\r\n", addr, addr + len, ctx->chip->name);
+				else if(!rock_memtest_arm32_progress(ctx, scratch, addr, len, MEMTEST_MODE_FILL, value, &r))
+					xrock_error("Failed to fill memory\r\n");
+			}
+			else
+				xrock_usage();
+		}
+		else if(!strcmp(argv[0], "memtest-arm64"))
+		{
+			argc -= 1;
+			argv += 1;
+			if(argc >= 3)
+			{
+				uint32_t scratch = strtoul(argv[0], NULL, 0);
+				uint32_t addr = strtoul(argv[1], NULL, 0);
+				uint32_t len = strtoul(argv[2], NULL, 0);
+				struct memtest_result_t r;
+				if(!rock_dram_valid(ctx, addr, len))
+					xrock_error("ERROR: The range 0x%08x - 0x%08x is not in the dram of chip '%s'\r\n", addr, addr + len, ctx->chip->name);
+				else if(rock_memtest_arm64_progress(ctx, scratch, addr, len, MEMTEST_MODE_WALKING_ONES | MEMTEST_MODE_ADDRESS | MEMTEST_MODE_RANDOM, 0, &r))
+				{
+					if(r.status)
+					{
+						const char * name = (r.status == MEMTEST_MODE_WALKING_ONES) ? "walking ones" : (r.status == MEMTEST_MODE_ADDRESS) ? "address" : "random";
+						xrock_error("ERROR: The %s test failed at 0x%08x, expect 0x%08x, actual 0x%08x\r\n", name, r.address, r.expect, r.actual);
+					}
+					else
+						printf("Memory test passed\r\n");
 				}
 				else
-					printf("ERROR: The chip '%s' does not in maskrom mode\r\n", ctx.chip->name);
+					xrock_error("Failed to test memory\r\n");
+			}
+			else
+				xrock_usage();
+		}
+		else if(!strcmp(argv[0], "memfill-arm64"))
+		{
+			argc -= 1;
+			argv += 1;
+			if(argc >= 4)
+			{
+				uint32_t scratch = strtoul(argv[0], NULL, 0);
+				uint32_t addr = strtoul(argv[1], NULL, 0);
+				uint32_t len = strtoul(argv[2], NULL, 0);
+				uint32_t value = strtoul(argv[3], NULL, 0);
+				struct memtest_result_t r;
+				if(!rock_dram_valid(ctx, addr, len))
+					xrock_error("ERROR: The range 0x%08x - 0x%08x is not in the dram of chip '%s'\r\n", addr, addr + len, ctx->chip->name);
+				else if(!rock_memtest_arm64_progress(ctx, scratch, addr, len, MEMTEST_MODE_FILL, value, &r))
+					xrock_error("Failed to fill memory\r\n");
 			}
 			else
-				usage();
+				xrock_usage();
 		}
 		else
-			usage();
+			xrock_usage();
+	}
+	else
+		xrock_usage();
+	return xrock_status;
+}
+
+static double xrock_time(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+static int xrock_reconnect(struct xrock_ctx_t * ctx, uint32_t timeout)
+{
+	double end = xrock_time() + timeout / 1000.0;
+	libusb_device ** list;
+	char path[32] = "", p[32];
+	int count, ok = 0;
+
+	if(ctx->hdl)
+	{
+		xrock_path(libusb_get_device(ctx->hdl), path, sizeof(path));
+		libusb_release_interface(ctx->hdl, 0);
+		libusb_close(ctx->hdl);
+		ctx->hdl = NULL;
+	}
+	do {
+		usleep(100 * 1000);
+		list = NULL;
+		count = libusb_get_device_list(ctx->context, &list);
+		for(int i = 0; i < count; i++)
+		{
+			if(xrock_probe(list[i]) && (!path[0] || !strcmp(xrock_path(list[i], p, sizeof(p)), path)))
+			{
+				ok = xrock_open(ctx, list[i]);
+				if(!ok && ctx->hdl)
+				{
+					libusb_close(ctx->hdl);
+					ctx->hdl = NULL;
+				}
+				break;
+			}
+		}
+		if(list)
+			libusb_free_device_list(list, 1);
+	} while(!ok && (xrock_time() < end));
+	return ok;
+}
+
+/*
+ * Split a script line into arguments in place, double and single quotes group
+ * words, '#' starts a comment. A leading '-' marks a step whose failure is ignored.
+ */
+static int xrock_split(char * line, char * argv[], int max, int * ignore)
+{
+	static char name[] = "xrock";
+	char * p = line;
+	char c;
+	int argc = 0;
+
+	*ignore = 0;
+	argv[argc++] = name;
+	while(*p && (argc < max))
+	{
+		while(isspace((unsigned char)*p))
+			p++;
+		if(!*p || (*p == '#'))
+			break;
+		if((argc == 1) && (*p == '-') && !*ignore)
+		{
+			*ignore = 1;
+			p++;
+			continue;
+		}
+		if((*p == '"') || (*p == '\''))
+		{
+			c = *p++;
+			argv[argc++] = p;
+			while(*p && (*p != c))
+				p++;
+		}
+		else
+		{
+			argv[argc++] = p;
+			while(*p && !isspace((unsigned char)*p))
+				p++;
+		}
+		if(*p)
+			*p++ = '\0';
+	}
+	return argc;
+}
+
+static int xrock_blank(const char * line)
+{
+	while(isspace((unsigned char)*line))
+		line++;
+	return (!*line || (*line == '#')) ? 1 : 0;
+}
+
+/*
+ * Execute one script line, the line is split in place. Returns the status of
+ * the step, failures of a line starting with '-' are reported in ignore.
+ */
+static int xrock_step(struct xrock_ctx_t * ctx, char * line, int * ignore)
+{
+	char * args[64];
+	int argc, ok;
+
+	argc = xrock_split(line, args, ARRAY_SIZE(args), ignore);
+	if(argc < 2)
+		return 1;
+	if(!strcmp(args[1], "sleep") && (argc == 3))
+	{
+		usleep(strtoul(args[2], NULL, 0) * 1000);
+		ok = 1;
+	}
+	else if(!strcmp(args[1], "reconnect") && ((argc == 2) || (argc == 3)))
+	{
+		ok = xrock_reconnect(ctx, (argc == 3) ? strtoul(args[2], NULL, 0) : 10000);
+		if(!ok)
+			printf("ERROR: Can't found any supported rockchip chips\r\n");
 	}
 	else
+		ok = xrock_command(ctx, argc, args);
+	return ok;
+}
+
+static int xrock_run(struct xrock_ctx_t * ctx, const char * script, int keep)
+{
+	char line[4096];
+	int ignore, ok, step = 0, nfail = 0, ret = 1;
+	double start = xrock_time(), t;
+	FILE * f;
+
+	f = strcmp(script, "-") ? fopen(script, "r") : stdin;
+	if(!f)
+	{
+		printf("ERROR: Can't open script '%s'\r\n", script);
+		return 0;
+	}
+	while(fgets(line, sizeof(line), f))
+	{
+		line[strcspn(line, "\r\n")] = '\0';
+		if(xrock_blank(line))
+			continue;
+		step++;
+		printf("[%d] %s\r\n", step, line);
+		t = xrock_time();
+		ok = xrock_step(ctx, line, &ignore);
+		printf("[%d] %s, %.3f ms\r\n", step, ok ? "done" : (ignore ? "failed, ignored" : "failed"), (xrock_time() - t) * 1000.0);
+		if(!ok && !ignore)
+		{
+			nfail++;
+			ret = 0;
+			if(!keep || !ctx->hdl)
+				break;
+		}
+	}
+	printf("Run %d steps, %d failed, %.3f ms\r\n", step, nfail, (xrock_time() - start) * 1000.0);
+	if(f != stdin)
+		fclose(f);
+	return ret;
+}
+
+static int xrock_schedule_exec(struct xrock_ctx_t * ctx, const char * line)
+{
+	char buf[4096];
+	int ignore, ok;
+
+	strncpy(buf, line, sizeof(buf) - 1);
+	buf[sizeof(buf) - 1] = '\0';
+	ok = xrock_step(ctx, buf, &ignore);
+	return (ok || ignore) ? 1 : 0;
+}
+
+struct xrock_fleet_t {
+	struct xrock_ctx_t ctx;
+	char path[32];
+	pthread_t thread;
+	int argc;
+	char ** argv;
+	int ret;
+	int started;
+	int finished;
+	double time;
+	uint64_t done;
+	uint64_t total;
+	struct fanout_t * fanout;
+};
+
+static pthread_mutex_t xrock_fleet_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void xrock_fleet_progress(void * data, uint64_t done, uint64_t total, double speed)
+{
+	struct xrock_fleet_t * f = (struct xrock_fleet_t *)data;
+
+	pthread_mutex_lock(&xrock_fleet_lock);
+	f->done = done;
+	f->total = total;
+	pthread_mutex_unlock(&xrock_fleet_lock);
+}
+
+static void * xrock_fleet_worker(void * data)
+{
+	struct xrock_fleet_t * f = (struct xrock_fleet_t *)data;
+	double t = xrock_time();
+	char * args[64];
+	char * p;
+	int ret;
+
+	/*
+	 * Every '{device}' in the arguments becomes the usb port path of the chip,
+	 * so each worker can write its own files.
+	 */
+	if(f->argc > ARRAY_SIZE(args))
+		f->argc = ARRAY_SIZE(args);
+	for(int i = 0; i < f->argc; i++)
+	{
+		args[i] = f->argv[i];
+		if((p = strstr(f->argv[i], "{device}")))
+		{
+			args[i] = malloc(strlen(f->argv[i]) + strlen(f->path) + 1);
+			if(args[i])
+				sprintf(args[i], "%.*s%s%s", (int)(p - f->argv[i]), f->argv[i], f->path, p + 8);
+			else
+				args[i] = f->argv[i];
+		}
+	}
+
+	progress_set_hook(xrock_fleet_progress, f);
+	if(f->fanout)
+	{
+		struct flash_info_t info;
+		uint32_t maxcnt = rock_flash_detect(&f->ctx, &info) ? info.sector_total : 0;
+		ret = fanout_write(f->fanout, &f->ctx, strtoul(args[3], NULL, 0), maxcnt);
+		if(!ret)
+			printf("Failed to write flash at '%s'\r\n", f->path);
+	}
+	else if(!strcmp(args[1], "run") && ((f->argc == 3) || (f->argc == 4)))
+		ret = xrock_run(&f->ctx, args[2], (f->argc == 4) && !strcmp(args[3], "--keep-going"));
+	else
+		ret = xrock_command(&f->ctx, f->argc, args);
+	progress_set_hook(NULL, NULL);
+	for(int i = 0; i < f->argc; i++)
+	{
+		if(args[i] != f->argv[i])
+			free(args[i]);
+	}
+	pthread_mutex_lock(&xrock_fleet_lock);
+	f->ret = ret;
+	f->time = xrock_time() - t;
+	f->finished = 1;
+	pthread_mutex_unlock(&xrock_fleet_lock);
+	return NULL;
+}
+
+/*
+ * Run the same command on every matching chip, one worker thread per chip,
+ * the devices can be limited to a comma separated list of usb port paths.
+ */
+static int xrock_fleet(libusb_context * context, const char * devices, int argc, char * argv[])
+{
+	struct xrock_fleet_t * fleet[XROCK_FLEET_MAX];
+	struct fanout_t * fanout = NULL;
+	libusb_device ** list = NULL;
+	int count, n = 0, running, nfail = 0, i;
+	char path[32];
+
+	count = libusb_get_device_list(context, &list);
+	for(i = 0; (i < count) && (n < XROCK_FLEET_MAX); i++)
+	{
+		if(!xrock_probe(list[i]) || !xrock_path_match(devices, xrock_path(list[i], path, sizeof(path))))
+			continue;
+		struct xrock_fleet_t * f = calloc(1, sizeof(struct xrock_fleet_t));
+		if(!f)
+			break;
+		f->ctx.context = context;
+		if(xrock_open(&f->ctx, list[i]))
+		{
+			strcpy(f->path, path);
+			f->argc = argc;
+			f->argv = argv;
+			fleet[n++] = f;
+		}
+		else
+		{
+			printf("ERROR: Can't open chip at '%s'\r\n", path);
+			if(f->ctx.hdl)
+				libusb_close(f->ctx.hdl);
+			free(f);
+			nfail++;
+		}
+	}
+	if(list)
+		libusb_free_device_list(list, 1);
+	if(n == 0)
+	{
+		printf("ERROR: Can't found any supported rockchip chips\r\n");
+		return 0;
+	}
+
+	/*
+	 * Writing one image to all chips reads the file once and fans it out.
+	 */
+	if((argc == 5) && !strcmp(argv[1], "flash") && !strcmp(argv[2], "write") && !strstr(argv[4], "{device}"))
+	{
+		fanout = fanout_alloc(argv[4], n);
+		for(i = 0; i < n; i++)
+			fleet[i]->fanout = fanout;
+	}
+	for(i = 0; i < n; i++)
+	{
+		if(pthread_create(&fleet[i]->thread, NULL, xrock_fleet_worker, fleet[i]) == 0)
+			fleet[i]->started = 1;
+		else
+		{
+			if(fleet[i]->fanout)
+				fanout_leave(fleet[i]->fanout);
+			fleet[i]->finished = 1;
+		}
+	}
+	do {
+		usleep(500 * 1000);
+		running = 0;
+		printf("\r");
+		pthread_mutex_lock(&xrock_fleet_lock);
+		for(i = 0; i < n; i++)
+		{
+			if(!fleet[i]->finished)
+				running++;
+			if(fleet[i]->finished)
+				printf("[%s %s] ", fleet[i]->path, fleet[i]->ret ? "done" : "failed");
+			else if(fleet[i]->total > 0)
+				printf("[%s %3.0f%%] ", fleet[i]->path, (double)fleet[i]->done * 100.0 / (double)fleet[i]->total);
+			else
+				printf("[%s ...] ", fleet[i]->path);
+		}
+		pthread_mutex_unlock(&xrock_fleet_lock);
+		fflush(stdout);
+	} while(running > 0);
+	printf("\r\n");
+
+	printf("%-16s %-10s %-8s %s\r\n", "Device", "Chip", "Result", "Time");
+	for(i = 0; i < n; i++)
+	{
+		if(fleet[i]->started)
+			pthread_join(fleet[i]->thread, NULL);
+		printf("%-16s %-10s %-8s %.3f s\r\n", fleet[i]->path, fleet[i]->ctx.chip->name, fleet[i]->ret ? "OK" : "FAILED", fleet[i]->time);
+		if(!fleet[i]->ret)
+			nfail++;
+		if(fleet[i]->ctx.hdl)
+		{
+			libusb_release_interface(fleet[i]->ctx.hdl, 0);
+			libusb_close(fleet[i]->ctx.hdl);
+		}
+		free(fleet[i]);
+	}
+	if(fanout)
+		fanout_free(fanout);
+	return (nfail == 0) ? 1 : 0;
+}
+
+int main(int argc, char * argv[])
+{
+	struct xrock_ctx_t ctx;
+	int ret;
+
+	memset(&ctx, 0, sizeof(struct xrock_ctx_t));
+	if(argc < 2)
+	{
 		usage();
+		return 0;
+	}
+	for(int i = 1; i < argc; i++)
+	{
+		if(!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help"))
+		{
+			usage();
+			return 0;
+		}
+	}
+
+	if(!strcmp(argv[1], "uart-capture") && ((argc == 4) || (argc == 5)))
+		return xrock_uart_capture(argv[2], argv[3], (argc == 5) ? strtoul(argv[4], NULL, 0) : 1500000) ? 0 : -1;
+	libusb_init(&ctx.context);
+	if((!strcmp(argv[1], "--all") && (argc >= 3)) || (!strcmp(argv[1], "--devices") && (argc >= 4)))
+	{
+		const char * devices = NULL;
+		if(!strcmp(argv[1], "--devices"))
+		{
+			devices = argv[2];
+			argc -= 1;
+			argv += 1;
+		}
+		ret = xrock_fleet(ctx.context, devices, argc - 1, argv + 1);
+		libusb_exit(ctx.context);
+		return ret ? 0 : -1;
+	}
+	if(!strcmp(argv[1], "schedule") && ((argc == 3) || ((argc == 5) && !strcmp(argv[3], "--per-bus"))))
+	{
+		ret = xrock_schedule(ctx.context, argv[2], (argc == 5) ? strtoul(argv[4], NULL, 0) : 1, xrock_schedule_exec);
+		libusb_exit(ctx.context);
+		return ret ? 0 : -1;
+	}
+	if(!strcmp(argv[1], "provision") && ((argc == 3) || (argc == 4)))
+	{
+		ret = xrock_provision(ctx.context, argv[2], (argc == 4) ? argv[3] : NULL);
+		libusb_exit(ctx.context);
+		return ret ? 0 : -1;
+	}
+	if(!strcmp(argv[1], "serve") && (argc == 3))
+	{
+		ret = xrock_serve(ctx.context, argv[2], xrock_command);
+		if(!ret)
+			printf("ERROR: Can't serve on '%s'\r\n", argv[2]);
+		libusb_exit(ctx.context);
+		return ret ? 0 : -1;
+	}
+	if(!xrock_init(&ctx))
+	{
+		printf("ERROR: Can't found any supported rockchip chips\r\n");
+		if(ctx.hdl)
+			libusb_close(ctx.hdl);
+		libusb_exit(ctx.context);
+		return -1;
+	}
+	if(!strcmp(argv[1], "run") && ((argc == 3) || (argc == 4)))
+		ret = xrock_run(&ctx, argv[2], (argc == 4) && !strcmp(argv[3], "--keep-going"));
+	else
+		ret = xrock_command(&ctx, argc, argv);
+	if(!ret && (ctx.error != XROCK_ERROR_NONE))
+		printf("ERROR: %s\r\n", xrock_ctx_strerror(&ctx));
 	if(ctx.hdl)
 		libusb_close(ctx.hdl);
 	libusb_exit(ctx.context);
 
-	return 0;
+	return ret ? 0 : -1;
 }
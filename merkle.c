@@ -0,0 +1,281 @@
+#include <merkle.h>
+
+static int merkle_push_leaf(struct merkle_ctx_t * ctx, const uint8_t * digest)
+{
+	if(ctx->nleaf >= ctx->maxleaf)
+	{
+		uint64_t max = ctx->maxleaf ? ctx->maxleaf * 2 : 1024;
+		void * leaf = realloc(ctx->leaf, max * SHA256_DIGEST_SIZE);
+		if(!leaf)
+			return 0;
+		ctx->leaf = leaf;
+		ctx->maxleaf = max;
+	}
+	memcpy(ctx->leaf[ctx->nleaf++], digest, SHA256_DIGEST_SIZE);
+	return 1;
+}
+
+static int merkle_hash_data(struct merkle_ctx_t * ctx, const uint8_t * p, size_t len)
+{
+	ctx->length += len;
+	while(len > 0)
+	{
+		size_t n = XMIN((size_t)(ctx->leaf_size - ctx->fill), len);
+		sha256_update(&ctx->sha, p, n);
+		ctx->fill += n;
+		p += n;
+		len -= n;
+		if(ctx->fill == ctx->leaf_size)
+		{
+			if(!merkle_push_leaf(ctx, sha256_final(&ctx->sha)))
+				return 0;
+			sha256_init(&ctx->sha);
+			ctx->fill = 0;
+		}
+	}
+	return 1;
+}
+
+static void * merkle_worker(void * data)
+{
+	struct merkle_ctx_t * ctx = (struct merkle_ctx_t *)data;
+	struct merkle_slot_t * s;
+	int error;
+
+	while(1)
+	{
+		s = &ctx->slot[ctx->tail];
+		pthread_mutex_lock(&ctx->lock);
+		while(!s->filled && !ctx->done)
+			pthread_cond_wait(&ctx->cond, &ctx->lock);
+		if(!s->filled)
+		{
+			pthread_mutex_unlock(&ctx->lock);
+			break;
+		}
+		error = ctx->error;
+		pthread_mutex_unlock(&ctx->lock);
+
+		if(!error && !merkle_hash_data(ctx, s->buf, s->len))
+			error = 1;
+
+		pthread_mutex_lock(&ctx->lock);
+		if(error)
+			ctx->error = 1;
+		s->filled = 0;
+		ctx->tail = (ctx->tail + 1) % MERKLE_SLOTS;
+		pthread_cond_broadcast(&ctx->cond);
+		pthread_mutex_unlock(&ctx->lock);
+	}
+	return NULL;
+}
+
+static void merkle_root(struct merkle_ctx_t * ctx)
+{
+	struct sha256_ctx_t sha;
+	uint8_t (* node)[SHA256_DIGEST_SIZE];
+	uint64_t n = ctx->nleaf, i;
+
+	if(n == 0)
+	{
+		sha256_hash(NULL, 0, ctx->root);
+		return;
+	}
+	node = malloc(n * SHA256_DIGEST_SIZE);
+	if(!node)
+	{
+		ctx->error = 1;
+		return;
+	}
+	memcpy(node, ctx->leaf, n * SHA256_DIGEST_SIZE);
+	while(n > 1)
+	{
+		for(i = 0; i < n / 2; i++)
+		{
+			sha256_init(&sha);
+			sha256_update(&sha, node[i * 2 + 0], SHA256_DIGEST_SIZE);
+			sha256_update(&sha, node[i * 2 + 1], SHA256_DIGEST_SIZE);
+			memcpy(node[i], sha256_final(&sha), SHA256_DIGEST_SIZE);
+		}
+		if(n & 1)
+			memcpy(node[i++], node[n - 1], SHA256_DIGEST_SIZE);
+		n = i;
+	}
+	memcpy(ctx->root, node[0], SHA256_DIGEST_SIZE);
+	free(node);
+}
+
+struct merkle_ctx_t * merkle_alloc(uint32_t leaf_size)
+{
+	struct merkle_ctx_t * ctx = calloc(1, sizeof(struct merkle_ctx_t));
+	if(!ctx)
+		return NULL;
+
+	ctx->leaf_size = leaf_size ? leaf_size : MERKLE_LEAF_SIZE;
+	sha256_init(&ctx->sha);
+	pthread_mutex_init(&ctx->lock, NULL);
+	pthread_cond_init(&ctx->cond, NULL);
+	if(pthread_create(&ctx->thread, NULL, merkle_worker, ctx) != 0)
+	{
+		merkle_free(ctx);
+		return NULL;
+	}
+	ctx->running = 1;
+	return ctx;
+}
+
+void merkle_free(struct merkle_ctx_t * ctx)
+{
+	if(ctx)
+	{
+		if(ctx->running)
+		{
+			pthread_mutex_lock(&ctx->lock);
+			ctx->done = 1;
+			pthread_cond_broadcast(&ctx->cond);
+			pthread_mutex_unlock(&ctx->lock);
+			pthread_join(ctx->thread, NULL);
+		}
+		pthread_cond_destroy(&ctx->cond);
+		pthread_mutex_destroy(&ctx->lock);
+		for(int i = 0; i < MERKLE_SLOTS; i++)
+		{
+			if(ctx->slot[i].buf)
+				free(ctx->slot[i].buf);
+		}
+		if(ctx->leaf)
+			free(ctx->leaf);
+		free(ctx);
+	}
+}
+
+int merkle_update(struct merkle_ctx_t * ctx, const void * buf, size_t len)
+{
+	struct merkle_slot_t * s;
+	int error;
+
+	if(!ctx || !ctx->running)
+		return 0;
+	s = &ctx->slot[ctx->head];
+	pthread_mutex_lock(&ctx->lock);
+	while(s->filled)
+		pthread_cond_wait(&ctx->cond, &ctx->lock);
+	error = ctx->error;
+	pthread_mutex_unlock(&ctx->lock);
+	if(error)
+		return 0;
+	if(s->size < len)
+	{
+		void * p = realloc(s->buf, len);
+		if(!p)
+		{
+			pthread_mutex_lock(&ctx->lock);
+			ctx->error = 1;
+			pthread_mutex_unlock(&ctx->lock);
+			return 0;
+		}
+		s->buf = p;
+		s->size = len;
+	}
+	memcpy(s->buf, buf, len);
+	s->len = len;
+	pthread_mutex_lock(&ctx->lock);
+	s->filled = 1;
+	ctx->head = (ctx->head + 1) % MERKLE_SLOTS;
+	pthread_cond_broadcast(&ctx->cond);
+	pthread_mutex_unlock(&ctx->lock);
+	return 1;
+}
+
+int merkle_finish(struct merkle_ctx_t * ctx)
+{
+	if(!ctx || !ctx->running)
+		return 0;
+	pthread_mutex_lock(&ctx->lock);
+	ctx->done = 1;
+	pthread_cond_broadcast(&ctx->cond);
+	pthread_mutex_unlock(&ctx->lock);
+	pthread_join(ctx->thread, NULL);
+	ctx->running = 0;
+	if((ctx->fill > 0) && !merkle_push_leaf(ctx, sha256_final(&ctx->sha)))
+		ctx->error = 1;
+	ctx->fill = 0;
+	if(!ctx->error)
+		merkle_root(ctx);
+	return ctx->error ? 0 : 1;
+}
+
+int merkle_save(struct merkle_ctx_t * ctx, const char * filename)
+{
+	char hex[SHA256_DIGEST_SIZE * 2 + 1];
+	FILE * f;
+
+	if(!ctx || ctx->running || ctx->error)
+		return 0;
+	f = fopen(filename, "w");
+	if(!f)
+		return 0;
+	fprintf(f, "xrock-merkle 1\n");
+	fprintf(f, "leaf %u\n", ctx->leaf_size);
+	fprintf(f, "length %llu\n", (unsigned long long)ctx->length);
+	fprintf(f, "root %s\n", sha256_hex(hex, ctx->root));
+	for(uint64_t i = 0; i < ctx->nleaf; i++)
+		fprintf(f, "%s\n", sha256_hex(hex, ctx->leaf[i]));
+	if(fclose(f) != 0)
+		return 0;
+	return 1;
+}
+
+struct merkle_ctx_t * merkle_load(const char * filename)
+{
+	struct merkle_ctx_t * ctx;
+	char line[256], hex[SHA256_DIGEST_SIZE * 2 + 1];
+	uint8_t digest[SHA256_DIGEST_SIZE];
+	unsigned long long length = 0;
+	unsigned int leaf = 0;
+	FILE * f;
+
+	f = fopen(filename, "r");
+	if(!f)
+		return NULL;
+	if(!fgets(line, sizeof(line), f) || (strncmp(line, "xrock-merkle 1", 14) != 0)
+		|| !fgets(line, sizeof(line), f) || (sscanf(line, "leaf %u", &leaf) != 1) || (leaf == 0)
+		|| !fgets(line, sizeof(line), f) || (sscanf(line, "length %llu", &length) != 1)
+		|| !fgets(line, sizeof(line), f) || (sscanf(line, "root %64s", hex) != 1) || (strlen(hex) != SHA256_DIGEST_SIZE * 2))
+	{
+		fclose(f);
+		return NULL;
+	}
+	ctx = calloc(1, sizeof(struct merkle_ctx_t));
+	if(!ctx)
+	{
+		fclose(f);
+		return NULL;
+	}
+	pthread_mutex_init(&ctx->lock, NULL);
+	pthread_cond_init(&ctx->cond, NULL);
+	ctx->leaf_size = leaf;
+	ctx->length = length;
+	for(int i = 0; i < SHA256_DIGEST_SIZE; i++)
+		ctx->root[i] = hex_string(hex, i * 2);
+	while(fgets(line, sizeof(line), f))
+	{
+		if((sscanf(line, "%64s", hex) != 1) || (strlen(hex) != SHA256_DIGEST_SIZE * 2))
+			continue;
+		for(int i = 0; i < SHA256_DIGEST_SIZE; i++)
+			digest[i] = hex_string(hex, i * 2);
+		if(!merkle_push_leaf(ctx, digest))
+		{
+			fclose(f);
+			merkle_free(ctx);
+			return NULL;
+		}
+	}
+	fclose(f);
+	if(ctx->nleaf != (ctx->length + ctx->leaf_size - 1) / ctx->leaf_size)
+	{
+		merkle_free(ctx);
+		return NULL;
+	}
+	return ctx;
+}
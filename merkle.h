@@ -0,0 +1,54 @@
+#ifndef __MERKLE_H__
+#define __MERKLE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <x.h>
+#include <misc.h>
+#include <sha256.h>
+#include <pthread.h>
+
+#define MERKLE_LEAF_SIZE		(1024 * 1024)
+#define MERKLE_SLOTS			(4)
+
+struct merkle_slot_t {
+	void * buf;
+	size_t size;
+	size_t len;
+	int filled;
+};
+
+struct merkle_ctx_t {
+	uint32_t leaf_size;
+	uint64_t length;
+	uint8_t (* leaf)[SHA256_DIGEST_SIZE];
+	uint64_t nleaf;
+	uint64_t maxleaf;
+	uint8_t root[SHA256_DIGEST_SIZE];
+
+	struct sha256_ctx_t sha;
+	uint64_t fill;
+	struct merkle_slot_t slot[MERKLE_SLOTS];
+	int head, tail;
+	int running;
+	int done;
+	int error;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+struct merkle_ctx_t * merkle_alloc(uint32_t leaf_size);
+void merkle_free(struct merkle_ctx_t * ctx);
+int merkle_update(struct merkle_ctx_t * ctx, const void * buf, size_t len);
+int merkle_finish(struct merkle_ctx_t * ctx);
+int merkle_save(struct merkle_ctx_t * ctx, const char * filename);
+struct merkle_ctx_t * merkle_load(const char * filename);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MERKLE_H__ */
@@ -1,4 +1,5 @@
 #include <misc.h>
+#include <sys/stat.h>
 
 uint64_t file_save(const char * filename, void * buf, uint64_t len)
 {
@@ -56,6 +57,19 @@ void * file_load(const char * filename, uint64_t * len)
 	return buf;
 }
 
+int file_mkdir(const char * path)
+{
+	struct stat st;
+
+	if((stat(path, &st) == 0) && S_ISDIR(st.st_mode))
+		return 1;
+#if defined(_WIN32)
+	return (mkdir(path) == 0) ? 1 : 0;
+#else
+	return (mkdir(path, 0755) == 0) ? 1 : 0;
+#endif
+}
+
 static inline unsigned char hex_to_bin(char c)
 {
 	if((c >= 'a') && (c <= 'f'))
@@ -71,30 +85,3 @@ unsigned char hex_string(const char * s, int o)
 {
 	return (hex_to_bin(s[o]) << 4) | hex_to_bin(s[o + 1]);
 }
-
-void hexdump(uint32_t addr, void * buf, size_t len)
-{
-	unsigned char * p = buf;
-	size_t i, j;
-
-	for(j = 0; j < len; j += 16)
-	{
-		printf("%08x: ", (uint32_t)(addr + j));
-		for(i = 0; i < 16; i++)
-		{
-			if(j + i < len)
-				printf("%02x ", p[j + i]);
-			else
-				printf("   ");
-		}
-		putchar(' ');
-		for(i = 0; i < 16; i++)
-		{
-			if(j + i >= len)
-				putchar(' ');
-			else
-				putchar(isprint(p[j + i]) ? p[j + i] : '.');
-		}
-		printf("\r\n");
-	}
-}
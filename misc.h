@@ -9,8 +9,8 @@ extern "C" {
 
 uint64_t file_save(const char * filename, void * buf, uint64_t len);
 void * file_load(const char * filename, uint64_t * len);
+int file_mkdir(const char * path);
 unsigned char hex_string(const char * s, int o);
-void hexdump(uint32_t addr, void * buf, size_t len);
 
 #ifdef __cplusplus
 }
@@ -7,14 +7,13 @@ static double gettime(void)
 	return tv.tv_sec + (double)tv.tv_usec / 1000000.0;
 }
 
-static const char * format_eta(double remaining)
+static const char * format_eta(char * buf, size_t len, double remaining)
 {
-	static char result[6] = "";
 	int seconds = remaining + 0.5;
 	if(seconds >= 0 && seconds < 6000)
 	{
-		snprintf(result, sizeof(result), "%02d:%02d", seconds / 60, seconds % 60);
-		return result;
+		snprintf(buf, len, "%02d:%02d", seconds / 60, seconds % 60);
+		return buf;
 	}
 	return "--:--";
 }
@@ -33,8 +32,26 @@ static char * ssize(char * buf, double size)
 	return buf;
 }
 
+/*
+ * The hook replaces the terminal progress bar, it is per thread so every
+ * worker can report its own device.
+ */
+static __thread progress_hook_t progress_hook = NULL;
+static __thread void * progress_hook_data = NULL;
+
+void progress_set_hook(progress_hook_t hook, void * data)
+{
+	progress_hook = hook;
+	progress_hook_data = data;
+}
+
 void progress_start(struct progress_t * p, uint64_t total)
 {
+	if(p)
+	{
+		p->hook = progress_hook;
+		p->data = progress_hook_data;
+	}
 	if(p && (total > 0))
 	{
 		p->total = total;
@@ -45,7 +62,7 @@ void progress_start(struct progress_t * p, uint64_t total)
 
 void progress_update(struct progress_t * p, uint64_t bytes)
 {
-	char buf1[32], buf2[32];
+	char buf1[32], buf2[32], buf3[8];
 
 	if(p)
 	{
@@ -54,13 +71,18 @@ void progress_update(struct progress_t * p, uint64_t bytes)
 		double speed = (double)p->done / (gettime() - p->start);
 		double eta = speed > 0 ? (p->total - p->done) / speed : 0;
 		int i, pos = 48 * ratio;
+		if(p->hook)
+		{
+			p->hook(p->data, p->done, p->total, speed);
+			return;
+		}
 		printf("\r%3.0f%% [", ratio * 100);
 		for(i = 0; i < pos; i++)
 			putchar('=');
 		for(i = pos; i < 48; i++)
 			putchar(' ');
 		if(p->done < p->total)
-			printf("] %s/s, ETA %s        \r", ssize(buf1, speed), format_eta(eta));
+			printf("] %s/s, ETA %s        \r", ssize(buf1, speed), format_eta(buf3, sizeof(buf3), eta));
 		else
 			printf("] %s, %s/s        \r", ssize(buf1, p->done), ssize(buf2, speed));
 		fflush(stdout);
@@ -69,6 +91,6 @@ void progress_update(struct progress_t * p, uint64_t bytes)
 
 void progress_stop(struct progress_t * p)
 {
-	if(p)
+	if(p && !p->hook)
 		printf("\r\n");
 }
@@ -7,12 +7,17 @@ extern "C" {
 
 #include <x.h>
 
+typedef void (*progress_hook_t)(void * data, uint64_t done, uint64_t total, double speed);
+
 struct progress_t {
 	uint64_t total;
 	uint64_t done;
 	double start;
+	progress_hook_t hook;
+	void * data;
 };
 
+void progress_set_hook(progress_hook_t hook, void * data);
 void progress_start(struct progress_t * p, uint64_t total);
 void progress_update(struct progress_t * p, uint64_t bytes);
 void progress_stop(struct progress_t * p);
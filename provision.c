@@ -0,0 +1,561 @@
+#include <provision.h>
+#include <fcntl.h>
+#if defined(_WIN32)
+#include <io.h>
+#include <windows.h>
+#endif
+#include <strings.h>
+#include <time.h>
+
+struct csv_t {
+	char *** row;
+	int nrow;
+	int ncol;
+};
+
+struct provision_t {
+	const char * filename;
+	char lockname[4096];
+	int lockfd;
+	pthread_mutex_t lock;
+};
+
+struct provision_dev_t {
+	struct xrock_ctx_t ctx;
+	struct provision_t * pv;
+	char path[32];
+	pthread_t thread;
+	int started;
+	int row;
+	int ret;
+	char sn[512 - 8 + 1];
+};
+
+static void csv_free(struct csv_t * csv)
+{
+	if(csv)
+	{
+		for(int i = 0; i < csv->nrow; i++)
+		{
+			for(int j = 0; j < csv->ncol; j++)
+				free(csv->row[i][j]);
+			free(csv->row[i]);
+		}
+		free(csv->row);
+		free(csv);
+	}
+}
+
+static int csv_add_row(struct csv_t * csv)
+{
+	char ** r = calloc(csv->ncol, sizeof(char *));
+	char *** rows;
+
+	if(!r)
+		return 0;
+	rows = realloc(csv->row, (csv->nrow + 1) * sizeof(char **));
+	if(!rows)
+	{
+		free(r);
+		return 0;
+	}
+	csv->row = rows;
+	csv->row[csv->nrow++] = r;
+	return 1;
+}
+
+static int csv_set(struct csv_t * csv, int row, int col, const char * value)
+{
+	char * v = strdup(value ? value : "");
+
+	if(!v)
+		return 0;
+	free(csv->row[row][col]);
+	csv->row[row][col] = v;
+	return 1;
+}
+
+static int csv_col(struct csv_t * csv, const char * name, int create)
+{
+	for(int i = 0; i < csv->ncol; i++)
+	{
+		if(csv->row[0][i] && !strcasecmp(csv->row[0][i], name))
+			return i;
+	}
+	if(!create)
+		return -1;
+	for(int i = 0; i < csv->nrow; i++)
+	{
+		char ** r = realloc(csv->row[i], (csv->ncol + 1) * sizeof(char *));
+		if(!r)
+			return -1;
+		r[csv->ncol] = NULL;
+		csv->row[i] = r;
+	}
+	csv->ncol++;
+	if(!csv_set(csv, 0, csv->ncol - 1, name))
+		return -1;
+	for(int i = 1; i < csv->nrow; i++)
+	{
+		if(!csv_set(csv, i, csv->ncol - 1, ""))
+			return -1;
+	}
+	return csv->ncol - 1;
+}
+
+static const char * csv_get(struct csv_t * csv, int row, int col)
+{
+	if((row < csv->nrow) && (col >= 0) && (col < csv->ncol) && csv->row[row][col])
+		return csv->row[row][col];
+	return "";
+}
+
+/*
+ * Comma separated, double quoted fields may hold commas and doubled quotes,
+ * short rows are padded to the header width.
+ */
+static struct csv_t * csv_load(const char * filename)
+{
+	struct csv_t * csv;
+	char line[4096], field[4096];
+	char * cell[256];
+	int n, o, q;
+	FILE * f;
+
+	f = fopen(filename, "r");
+	if(!f)
+		return NULL;
+	csv = calloc(1, sizeof(struct csv_t));
+	if(!csv)
+	{
+		fclose(f);
+		return NULL;
+	}
+	while(fgets(line, sizeof(line), f))
+	{
+		line[strcspn(line, "\r\n")] = '\0';
+		if((csv->nrow > 0) && !line[0])
+			continue;
+		n = 0;
+		for(char * p = line; n < ARRAY_SIZE(cell);)
+		{
+			o = 0;
+			q = 0;
+			while(*p && (q || (*p != ',')) && (o < sizeof(field) - 1))
+			{
+				if(*p == '"')
+				{
+					if(q && (p[1] == '"'))
+					{
+						field[o++] = '"';
+						p++;
+					}
+					else
+						q = !q;
+				}
+				else
+					field[o++] = *p;
+				p++;
+			}
+			field[o] = '\0';
+			cell[n++] = strdup(field);
+			if(*p != ',')
+				break;
+			p++;
+		}
+		if(csv->nrow == 0)
+			csv->ncol = n;
+		if(!csv_add_row(csv))
+			n = -n;
+		for(int i = 0; i < ((n < 0) ? -n : n); i++)
+		{
+			if((n > 0) && (i < csv->ncol))
+				csv->row[csv->nrow - 1][i] = cell[i];
+			else
+				free(cell[i]);
+		}
+		if(n < 0)
+		{
+			fclose(f);
+			csv_free(csv);
+			return NULL;
+		}
+	}
+	fclose(f);
+	if(csv->nrow == 0)
+	{
+		csv_free(csv);
+		return NULL;
+	}
+	return csv;
+}
+
+static void csv_write_field(FILE * f, const char * s)
+{
+	if(strpbrk(s, ",\"\r\n") || (s[0] == ' ') || (s[0] && (s[strlen(s) - 1] == ' ')))
+	{
+		fputc('"', f);
+		for(; *s; s++)
+		{
+			if(*s == '"')
+				fputc('"', f);
+			fputc(*s, f);
+		}
+		fputc('"', f);
+	}
+	else
+		fputs(s, f);
+}
+
+static int csv_save(struct csv_t * csv, const char * filename)
+{
+	char tmp[4096 + 8];
+	FILE * f;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", filename);
+	f = fopen(tmp, "w");
+	if(!f)
+		return 0;
+	for(int i = 0; i < csv->nrow; i++)
+	{
+		for(int j = 0; j < csv->ncol; j++)
+		{
+			if(j > 0)
+				fputc(',', f);
+			csv_write_field(f, csv_get(csv, i, j));
+		}
+		fputc('\n', f);
+	}
+	if((fflush(f) != 0) || (fsync(fileno(f)) != 0))
+	{
+		fclose(f);
+		remove(tmp);
+		return 0;
+	}
+	if(fclose(f) != 0)
+	{
+		remove(tmp);
+		return 0;
+	}
+#ifdef _WIN32
+	remove(filename);
+#endif
+	if(rename(tmp, filename) != 0)
+	{
+		remove(tmp);
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * The in process mutex orders our own threads, a lock on the lock file keeps
+ * other stations sharing the csv out while it is rewritten. The kernel drops
+ * the lock when its holder exits, so a crashed station can't leave it behind.
+ */
+static int provision_lock(struct provision_t * pv)
+{
+	pthread_mutex_lock(&pv->lock);
+	pv->lockfd = open(pv->lockname, O_CREAT | O_RDWR, 0644);
+	if(pv->lockfd >= 0)
+	{
+#if defined(_WIN32)
+		OVERLAPPED ov;
+		memset(&ov, 0, sizeof(OVERLAPPED));
+		if(LockFileEx((HANDLE)_get_osfhandle(pv->lockfd), LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &ov))
+			return 1;
+#else
+		struct flock fl;
+		int r;
+		memset(&fl, 0, sizeof(struct flock));
+		fl.l_type = F_WRLCK;
+		fl.l_whence = SEEK_SET;
+		do
+			r = fcntl(pv->lockfd, F_SETLKW, &fl);
+		while((r != 0) && (errno == EINTR));
+		if(r == 0)
+			return 1;
+#endif
+		close(pv->lockfd);
+		pv->lockfd = -1;
+	}
+	printf("ERROR: Can't take lock file '%s'\r\n", pv->lockname);
+	pthread_mutex_unlock(&pv->lock);
+	return 0;
+}
+
+static void provision_unlock(struct provision_t * pv)
+{
+	close(pv->lockfd);
+	pv->lockfd = -1;
+	pthread_mutex_unlock(&pv->lock);
+}
+
+static char * provision_now(char * buf, size_t len)
+{
+	time_t t = time(NULL);
+	struct tm * tm = localtime(&t);
+
+	if(!tm || !strftime(buf, len, "%Y-%m-%d %H:%M:%S", tm))
+		buf[0] = '\0';
+	return buf;
+}
+
+/*
+ * Take the first row without status and mark it claimed by this chip, the
+ * claimed row is returned as a private copy.
+ */
+static struct csv_t * provision_claim(struct provision_dev_t * d)
+{
+	struct provision_t * pv = d->pv;
+	struct csv_t * csv, * row = NULL;
+	char now[32];
+	int status, device, stamp;
+
+	if(!provision_lock(pv))
+		return NULL;
+	csv = csv_load(pv->filename);
+	if(csv)
+	{
+		status = csv_col(csv, "status", 1);
+		device = csv_col(csv, "device", 1);
+		stamp = csv_col(csv, "time", 1);
+		for(int i = 1; (i < csv->nrow) && (status >= 0) && (device >= 0) && (stamp >= 0); i++)
+		{
+			if(csv_get(csv, i, status)[0] == '\0')
+			{
+				csv_set(csv, i, status, "claimed");
+				csv_set(csv, i, device, d->path);
+				csv_set(csv, i, stamp, provision_now(now, sizeof(now)));
+				if(csv_save(csv, pv->filename))
+				{
+					d->row = i;
+					row = csv;
+					csv = NULL;
+				}
+				break;
+			}
+		}
+		csv_free(csv);
+	}
+	provision_unlock(pv);
+	return row;
+}
+
+static int provision_finish(struct provision_dev_t * d, int ok)
+{
+	struct provision_t * pv = d->pv;
+	struct csv_t * csv;
+	char now[32];
+	int status, device, stamp, ret = 0;
+
+	if(!provision_lock(pv))
+		return 0;
+	csv = csv_load(pv->filename);
+	if(csv)
+	{
+		status = csv_col(csv, "status", 0);
+		device = csv_col(csv, "device", 0);
+		stamp = csv_col(csv, "time", 0);
+		if((status >= 0) && (device >= 0) && (stamp >= 0) && (d->row < csv->nrow)
+			&& !strcmp(csv_get(csv, d->row, status), "claimed") && !strcmp(csv_get(csv, d->row, device), d->path))
+		{
+			csv_set(csv, d->row, status, ok ? "done" : "failed");
+			csv_set(csv, d->row, stamp, provision_now(now, sizeof(now)));
+			ret = csv_save(csv, pv->filename);
+		}
+		csv_free(csv);
+	}
+	provision_unlock(pv);
+	return ret;
+}
+
+static int provision_mac(const char * s, uint8_t * mac)
+{
+	for(int i = 0; i < 6; i++)
+	{
+		if((i > 0) && ((*s == ':') || (*s == '-')))
+			s++;
+		if(!isxdigit((unsigned char)s[0]) || !isxdigit((unsigned char)s[1]))
+			return 0;
+		mac[i] = hex_string(s, 0);
+		s += 2;
+	}
+	return (*s == '\0') ? 1 : 0;
+}
+
+/*
+ * Whole hex strings only, an odd length or a stray character fails the row
+ * instead of writing a truncated or garbage value.
+ */
+static int provision_hex(const char * s, uint8_t * buf, int size)
+{
+	int len = strlen(s);
+
+	if((len == 0) || (len & 1) || (len / 2 > size))
+		return 0;
+	for(int i = 0; i < len; i++)
+	{
+		if(!isxdigit((unsigned char)s[i]))
+			return 0;
+	}
+	for(int i = 0; i < len / 2; i++)
+		buf[i] = hex_string(s, i * 2);
+	return len / 2;
+}
+
+static int provision_vs(struct xrock_ctx_t * ctx, int index, uint8_t * buf, int len)
+{
+	uint8_t check[512];
+
+	if((len <= 0) || (len > 512))
+		return 0;
+	if(!rock_vs_write(ctx, 0, index, buf, len))
+		return 0;
+	memset(check, 0, sizeof(check));
+	if(!rock_vs_read(ctx, 0, index, check, len))
+		return 0;
+	return (memcmp(check, buf, len) == 0) ? 1 : 0;
+}
+
+/*
+ * Write every field of the claimed row and read it back in the same session.
+ */
+static int provision_write(struct provision_dev_t * d, struct csv_t * csv)
+{
+	struct xrock_ctx_t * ctx = &d->ctx;
+	uint8_t buf[512];
+	char sn[512 - 8 + 1];
+	const char * name, * value;
+	int len, ok;
+
+	for(int i = 0; i < csv->ncol; i++)
+	{
+		name = csv_get(csv, 0, i);
+		value = csv_get(csv, d->row, i);
+		if(!value[0] || !strcasecmp(name, "status") || !strcasecmp(name, "device") || !strcasecmp(name, "time"))
+			continue;
+		if(!strcasecmp(name, "sn"))
+		{
+			strncpy(d->sn, value, sizeof(d->sn) - 1);
+			ok = rock_sn_write(ctx, d->sn) && rock_sn_read(ctx, sn) && !strcmp(sn, d->sn);
+		}
+		else if(!strcasecmp(name, "wifi") || !strcasecmp(name, "lan") || !strcasecmp(name, "bt"))
+		{
+			int index = !strcasecmp(name, "wifi") ? PROVISION_VS_WIFI_MAC_ID : (!strcasecmp(name, "lan") ? PROVISION_VS_LAN_MAC_ID : PROVISION_VS_BT_MAC_ID);
+			ok = provision_mac(value, buf) && provision_vs(ctx, index, buf, 6);
+		}
+		else if(!strncasecmp(name, "vs:", 3))
+		{
+			len = XMIN((int)strlen(value), 512);
+			memcpy(buf, value, len);
+			ok = provision_vs(ctx, strtoul(name + 3, NULL, 0), buf, len);
+		}
+		else if(!strncasecmp(name, "vshex:", 6))
+		{
+			len = provision_hex(value, buf, sizeof(buf));
+			ok = (len > 0) && provision_vs(ctx, strtoul(name + 6, NULL, 0), buf, len);
+		}
+		else
+			continue;
+		printf("[%s] %s '%s' %s\r\n", d->path, name, value, ok ? "written" : "failed");
+		if(!ok)
+			return 0;
+	}
+	return 1;
+}
+
+static void * provision_worker(void * data)
+{
+	struct provision_dev_t * d = (struct provision_dev_t *)data;
+	struct csv_t * csv;
+
+	d->ret = 0;
+	if(!rock_capability_support(&d->ctx, CAPABILITY_TYPE_VENDOR_STORAGE) && !rock_capability_support(&d->ctx, CAPABILITY_TYPE_NEW_VENDOR_STORAGE))
+	{
+		printf("[%s] The loader don't support vendor storage\r\n", d->path);
+		return NULL;
+	}
+	csv = provision_claim(d);
+	if(!csv)
+	{
+		printf("[%s] No free row left in '%s'\r\n", d->path, d->pv->filename);
+		return NULL;
+	}
+	d->ret = provision_write(d, csv);
+	if(!provision_finish(d, d->ret))
+		d->ret = 0;
+	csv_free(csv);
+	return NULL;
+}
+
+int xrock_provision(libusb_context * context, const char * filename, const char * devices)
+{
+	struct provision_dev_t * dev[PROVISION_MAX_DEVICES];
+	struct provision_t pv;
+	libusb_device ** list = NULL;
+	char path[32];
+	int count, n = 0, nfail = 0, i;
+
+	memset(&pv, 0, sizeof(struct provision_t));
+	pv.filename = filename;
+	snprintf(pv.lockname, sizeof(pv.lockname), "%s.lock", filename);
+	pthread_mutex_init(&pv.lock, NULL);
+
+	count = libusb_get_device_list(context, &list);
+	for(i = 0; (i < count) && (n < PROVISION_MAX_DEVICES); i++)
+	{
+		if(!xrock_probe(list[i]) || !xrock_path_match(devices, xrock_path(list[i], path, sizeof(path))))
+			continue;
+		struct provision_dev_t * d = calloc(1, sizeof(struct provision_dev_t));
+		if(!d)
+			break;
+		d->ctx.context = context;
+		if(xrock_open(&d->ctx, list[i]))
+		{
+			strcpy(d->path, path);
+			d->pv = &pv;
+			dev[n++] = d;
+		}
+		else
+		{
+			printf("ERROR: Can't open chip at '%s'\r\n", path);
+			if(d->ctx.hdl)
+				libusb_close(d->ctx.hdl);
+			free(d);
+			nfail++;
+		}
+	}
+	if(list)
+		libusb_free_device_list(list, 1);
+	if(n == 0)
+		printf("ERROR: Can't found any supported rockchip chips\r\n");
+
+	for(i = 0; i < n; i++)
+	{
+		if(pthread_create(&dev[i]->thread, NULL, provision_worker, dev[i]) == 0)
+			dev[i]->started = 1;
+	}
+	for(i = 0; i < n; i++)
+	{
+		if(dev[i]->started)
+			pthread_join(dev[i]->thread, NULL);
+	}
+
+	printf("%-16s %-10s %-6s %-8s %s\r\n", "Device", "Chip", "Row", "Result", "SN");
+	for(i = 0; i < n; i++)
+	{
+		struct provision_dev_t * d = dev[i];
+		printf("%-16s %-10s %-6d %-8s %s\r\n", d->path, d->ctx.chip->name, d->row, (d->started && d->ret) ? "OK" : "FAILED", d->sn);
+		if(!d->started || !d->ret)
+			nfail++;
+		if(d->ctx.hdl)
+		{
+			libusb_release_interface(d->ctx.hdl, 0);
+			libusb_close(d->ctx.hdl);
+		}
+		free(d);
+	}
+	pthread_mutex_destroy(&pv.lock);
+	return ((n > 0) && (nfail == 0)) ? 1 : 0;
+}
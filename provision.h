@@ -0,0 +1,28 @@
+#ifndef __PROVISION_H__
+#define __PROVISION_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <rock.h>
+#include <pthread.h>
+
+/*
+ * Factory provisioning from a csv file, the header names the fields: 'sn',
+ * 'wifi', 'lan', 'bt' for the mac addresses, 'vs:<index>' for a string and
+ * 'vshex:<index>' for hex data in vendor storage. Every chip claims the next
+ * row with an empty 'status', the file is rewritten atomically under a lock.
+ */
+#define PROVISION_VS_WIFI_MAC_ID	(2)
+#define PROVISION_VS_LAN_MAC_ID		(3)
+#define PROVISION_VS_BT_MAC_ID		(4)
+#define PROVISION_MAX_DEVICES		(64)
+
+int xrock_provision(libusb_context * context, const char * filename, const char * devices);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __PROVISION_H__ */
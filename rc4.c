@@ -1,4 +1,10 @@
 #include <rc4.h>
+#include <pthread.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 void rc4_setkey(struct rc4_ctx_t * ctx, uint8_t * key, int len)
 {
@@ -40,3 +46,91 @@ void rc4_crypt(struct rc4_ctx_t * ctx, uint8_t * buf, int len)
 	ctx->i = i;
 	ctx->j = j;
 }
+
+void rc4_xor(uint8_t * buf, const uint8_t * ks, int len)
+{
+	int o = 0;
+
+#if defined(__SSE2__)
+	for(; o + 16 <= len; o += 16)
+		_mm_storeu_si128((__m128i *)(buf + o), _mm_xor_si128(_mm_loadu_si128((const __m128i *)(buf + o)), _mm_loadu_si128((const __m128i *)(ks + o))));
+#elif defined(__ARM_NEON)
+	for(; o + 16 <= len; o += 16)
+		vst1q_u8(buf + o, veorq_u8(vld1q_u8(buf + o), vld1q_u8(ks + o)));
+#endif
+	for(; o + 8 <= len; o += 8)
+	{
+		uint64_t a, b;
+		memcpy(&a, buf + o, 8);
+		memcpy(&b, ks + o, 8);
+		a ^= b;
+		memcpy(buf + o, &a, 8);
+	}
+	for(; o < len; o++)
+		buf[o] ^= ks[o];
+}
+
+/*
+ * Keystream of the fixed rockchip key, generated once and kept in pages that
+ * never move, so callers can xor outside of the lock.
+ */
+#define RC4_STATIC_PAGE_SIZE	(4096)
+
+static struct {
+	pthread_mutex_t lock;
+	struct rc4_ctx_t ctx;
+	uint8_t ** page;
+	int npage;
+	int init;
+} rc4_static = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static const uint8_t * rc4_static_page(int index)
+{
+	const uint8_t * ks = NULL;
+
+	pthread_mutex_lock(&rc4_static.lock);
+	if(!rc4_static.init)
+	{
+		uint8_t key[16] = { 124, 78, 3, 4, 85, 5, 9, 7, 45, 44, 123, 56, 23, 13, 23, 17 };
+		rc4_setkey(&rc4_static.ctx, key, sizeof(key));
+		rc4_static.init = 1;
+	}
+	while(rc4_static.npage <= index)
+	{
+		uint8_t ** page = realloc(rc4_static.page, sizeof(uint8_t *) * (rc4_static.npage + 1));
+		if(!page)
+			break;
+		rc4_static.page = page;
+		page[rc4_static.npage] = calloc(1, RC4_STATIC_PAGE_SIZE);
+		if(!page[rc4_static.npage])
+			break;
+		rc4_crypt(&rc4_static.ctx, page[rc4_static.npage], RC4_STATIC_PAGE_SIZE);
+		rc4_static.npage++;
+	}
+	if(index < rc4_static.npage)
+		ks = rc4_static.page[index];
+	pthread_mutex_unlock(&rc4_static.lock);
+	return ks;
+}
+
+int rc4_static_crypt(uint8_t * buf, uint64_t off, int len)
+{
+	const uint8_t * ks;
+	int o, n;
+
+	while(len > 0)
+	{
+		ks = rc4_static_page(off / RC4_STATIC_PAGE_SIZE);
+		if(!ks)
+			return 0;
+		o = off % RC4_STATIC_PAGE_SIZE;
+		n = XMIN(len, RC4_STATIC_PAGE_SIZE - o);
+		rc4_xor(buf, ks + o, n);
+		buf += n;
+		off += n;
+		len -= n;
+	}
+	return 1;
+}
@@ -14,6 +14,8 @@ struct rc4_ctx_t {
 
 void rc4_setkey(struct rc4_ctx_t * ctx, uint8_t * key, int len);
 void rc4_crypt(struct rc4_ctx_t * ctx, uint8_t * buf, int len);
+void rc4_xor(uint8_t * buf, const uint8_t * ks, int len);
+int rc4_static_crypt(uint8_t * buf, uint64_t off, int len);
 
 #ifdef __cplusplus
 }
@@ -1,197 +1,462 @@
 #include <rock.h>
+#include <merkle.h>
+#include <delta.h>
+#include <time.h>
+
+/*
+ * Chip profiles: pid, name, arch, sram base, dram base and size, usb3 otg,
+ * lba chunk and idb sectors. Zero bases and sizes are not known.
+ */
+static const struct chip_idb_t idb_default = {
+	64, 128, 512,
+};
 
 static struct chip_t chips[] = {
-	{ 0x110c, "RK1106" },
-	{ 0x180a, "RK1808" },
-	{ 0x281a, "RK2818" },
-	{ 0x290a, "RK2918" },
-	{ 0x292a, "RK2928" },
-	{ 0x292c, "RK3026" },
-	{ 0x300a, "RK3066" },
-	{ 0x300b, "RK3168" },
-	{ 0x301a, "RK3036" },
-	{ 0x310a, "RK3066" },
-	{ 0x310b, "RK3188" },
-	{ 0x310c, "RK3128" },
-	{ 0x320a, "RK3288" },
-	{ 0x320b, "RK3228" },
-	{ 0x320c, "RK3328" },
-	{ 0x330a, "RK3368" },
-	{ 0x330c, "RK3399" },
-	{ 0x330d, "PX30" },
-	{ 0x330e, "RK3308" },
-	{ 0x350a, "RK3568" },
-	{ 0x350b, "RK3588" },
-	{ 0x350d, "RK3562" },
-	{ 0x350e, "RK3576" },
-	{ 0x350f, "RK3506" },
+	{ 0x110c, "RK1106", CHIP_ARCH_ARM32, 0, 0x00000000, 0, 0, 16384, &idb_default },
+	{ 0x180a, "RK1808", CHIP_ARCH_ARM64, 0, 0x00000000, 0, 1, 16384, &idb_default },
+	{ 0x281a, "RK2818", CHIP_ARCH_ARM32, 0, 0x60000000, 0, 0, 16384, &idb_default },
+	{ 0x290a, "RK2918", CHIP_ARCH_ARM32, 0, 0x60000000, 0, 0, 16384, &idb_default },
+	{ 0x292a, "RK2928", CHIP_ARCH_ARM32, 0x10080000, 0x60000000, 0, 0, 16384, &idb_default },
+	{ 0x292c, "RK3026", CHIP_ARCH_ARM32, 0x10080000, 0x60000000, 0, 0, 16384, &idb_default },
+	{ 0x300a, "RK3066", CHIP_ARCH_ARM32, 0x10080000, 0x60000000, 0x80000000, 0, 16384, &idb_default },
+	{ 0x300b, "RK3168", CHIP_ARCH_ARM32, 0x10080000, 0x60000000, 0x80000000, 0, 16384, &idb_default },
+	{ 0x301a, "RK3036", CHIP_ARCH_ARM32, 0x10080000, 0x60000000, 0x80000000, 0, 16384, &idb_default },
+	{ 0x310a, "RK3066", CHIP_ARCH_ARM32, 0x10080000, 0x60000000, 0x80000000, 0, 16384, &idb_default },
+	{ 0x310b, "RK3188", CHIP_ARCH_ARM32, 0x10080000, 0x60000000, 0x80000000, 0, 16384, &idb_default },
+	{ 0x310c, "RK3128", CHIP_ARCH_ARM32, 0x10080000, 0x60000000, 0x80000000, 0, 16384, &idb_default },
+	{ 0x320a, "RK3288", CHIP_ARCH_ARM32, 0xff700000, 0x00000000, 0xfe000000, 0, 16384, &idb_default },
+	{ 0x320b, "RK3228", CHIP_ARCH_ARM32, 0x10080000, 0x60000000, 0, 0, 16384, &idb_default },
+	{ 0x320c, "RK3328", CHIP_ARCH_ARM64, 0xff090000, 0x00000000, 0xff000000, 0, 16384, &idb_default },
+	{ 0x330a, "RK3368", CHIP_ARCH_ARM64, 0xff8c0000, 0x00000000, 0, 0, 16384, &idb_default },
+	{ 0x330c, "RK3399", CHIP_ARCH_ARM64, 0xff8c0000, 0x00000000, 0xf8000000, 1, 16384, &idb_default },
+	{ 0x330d, "PX30", CHIP_ARCH_ARM64, 0xff0e0000, 0x00000000, 0xff000000, 0, 16384, &idb_default },
+	{ 0x330e, "RK3308", CHIP_ARCH_ARM64, 0xfff80000, 0x00000000, 0xff000000, 0, 16384, &idb_default },
+	{ 0x350a, "RK3568", CHIP_ARCH_ARM64, 0xfdcc0000, 0x00000000, 0xf0000000, 1, 16384, &idb_default },
+	{ 0x350b, "RK3588", CHIP_ARCH_ARM64, 0xff000000, 0x00000000, 0xf0000000, 1, 16384, &idb_default },
+	{ 0x350d, "RK3562", CHIP_ARCH_ARM64, 0, 0x00000000, 0, 1, 16384, &idb_default },
+	{ 0x350e, "RK3576", CHIP_ARCH_ARM64, 0x3ff80000, 0x40000000, 0, 1, 16384, &idb_default },
+	{ 0x350f, "RK3506", CHIP_ARCH_ARM32, 0, 0x00000000, 0, 0, 16384, &idb_default },
 };
 
 static struct chip_t chip_unknown = {
-	0x0000, "UNKNOWN"
+	0x0000, "UNKNOWN", CHIP_ARCH_UNKNOWN, 0, 0x00000000, 0, 0, 16384, &idb_default
 };
 
-int xrock_init(struct xrock_ctx_t * ctx)
+static struct chip_t * xrock_chip(libusb_device * device)
 {
-	if(ctx)
+	struct libusb_device_descriptor desc;
+
+	if(libusb_get_device_descriptor(device, &desc) == 0)
 	{
-		libusb_device ** list = NULL;
-		int found = 0;
+		if(desc.idVendor == 0x2207)
+		{
+			for(int i = 0; i < ARRAY_SIZE(chips); i++)
+			{
+				if(desc.idProduct == chips[i].pid)
+					return &chips[i];
+			}
+			return &chip_unknown;
+		}
+	}
+	return NULL;
+}
+
+int xrock_probe(libusb_device * device)
+{
+	return xrock_chip(device) ? 1 : 0;
+}
+
+char * xrock_path(libusb_device * device, char * buf, size_t len)
+{
+	uint8_t port[8];
+	int n = libusb_get_port_numbers(device, port, ARRAY_SIZE(port));
+	int o = snprintf(buf, len, "%d", libusb_get_bus_number(device));
 
+	for(int i = 0; (i < n) && (o < len); i++)
+		o += snprintf(buf + o, len - o, "%c%d", i ? '.' : '-', port[i]);
+	return buf;
+}
+
+/*
+ * Match a port path against a comma separated list, no list matches all.
+ */
+int xrock_path_match(const char * list, const char * path)
+{
+	size_t len = strlen(path);
+	const char * p = list;
+
+	if(!list)
+		return 1;
+	while(p && *p)
+	{
+		if(!strncmp(p, path, len) && ((p[len] == ',') || (p[len] == '\0')))
+			return 1;
+		p = strchr(p, ',');
+		if(p)
+			p++;
+	}
+	return 0;
+}
+
+int xrock_open(struct xrock_ctx_t * ctx, libusb_device * device)
+{
+	libusb_device_handle * hdl;
+	struct chip_t * chip;
+
+	if(ctx && device)
+	{
 		ctx->hdl = NULL;
 		ctx->chip = NULL;
-		for(int count = 0; (count < libusb_get_device_list(ctx->context, &list)) && !found; count++)
+		ctx->error = XROCK_ERROR_NONE;
+		ctx->usb_error = 0;
+		ctx->erase_block = 0;
+		chip = xrock_chip(device);
+		if(!chip || (libusb_open(device, &hdl) != 0))
+			return 0;
+		ctx->hdl = hdl;
+		ctx->chip = chip;
+		ctx->usb3 = (chip->usb3 && (libusb_get_device_speed(device) >= LIBUSB_SPEED_SUPER)) ? 1 : 0;
+		ctx->tag = (uint32_t)time(NULL) ^ (uint32_t)(uintptr_t)ctx ^ (libusb_get_bus_number(device) << 24) ^ (libusb_get_device_address(device) << 16);
+		if(ctx->tag == 0)
+			ctx->tag = 0x2207;
+
+		if(libusb_kernel_driver_active(ctx->hdl, 0))
+			libusb_detach_kernel_driver(ctx->hdl, 0);
+
+		if(libusb_claim_interface(ctx->hdl, 0) == 0)
 		{
 			struct libusb_device_descriptor desc;
-			libusb_device * device = list[count];
-			libusb_device_handle * hdl;
-			if(libusb_get_device_descriptor(device, &desc) == 0)
+			if(libusb_get_device_descriptor(libusb_get_device(ctx->hdl), &desc) == 0)
 			{
-				if(desc.idVendor == 0x2207)
+				if((desc.bcdUSB & 0x0001) == 0x0000)
+					ctx->maskrom = 1;
+				else
+					ctx->maskrom = 0;
+
+				struct libusb_config_descriptor * config;
+				if(libusb_get_active_config_descriptor(libusb_get_device(ctx->hdl), &config) == 0)
 				{
-					for(int i = 0; i < ARRAY_SIZE(chips); i++)
+					for(int if_idx = 0; if_idx < config->bNumInterfaces; if_idx++)
 					{
-						if(desc.idProduct == chips[i].pid)
+						const struct libusb_interface * iface = config->interface + if_idx;
+						for(int set_idx = 0; set_idx < iface->num_altsetting; set_idx++)
 						{
-							if(libusb_open(device, &hdl) == 0)
+							const struct libusb_interface_descriptor * setting = iface->altsetting + set_idx;
+							for(int ep_idx = 0; ep_idx < setting->bNumEndpoints; ep_idx++)
 							{
-								ctx->hdl = hdl;
-								ctx->chip = &chips[i];
-								found = 1;
-								break;
+								const struct libusb_endpoint_descriptor * ep = setting->endpoint + ep_idx;
+								if((ep->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) != LIBUSB_TRANSFER_TYPE_BULK)
+									continue;
+								if((ep->bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN)
+									ctx->epin = ep->bEndpointAddress;
+								else
+									ctx->epout = ep->bEndpointAddress;
 							}
 						}
 					}
-					if(!found)
-					{
-						if(libusb_open(device, &hdl) == 0)
-						{
-							ctx->hdl = hdl;
-							ctx->chip = &chip_unknown;
-							found = 1;
-							break;
-						}
-					}
+					libusb_free_config_descriptor(config);
+					return 1;
 				}
 			}
 		}
+	}
+	return 0;
+}
+
+int xrock_init(struct xrock_ctx_t * ctx)
+{
+	libusb_device ** list = NULL;
+	int ret = 0;
 
-		if(ctx->hdl && ctx->chip && found)
+	if(ctx)
+	{
+		ctx->hdl = NULL;
+		ctx->chip = NULL;
+		int count = libusb_get_device_list(ctx->context, &list);
+		for(int i = 0; i < count; i++)
 		{
-			if(libusb_kernel_driver_active(ctx->hdl, 0))
-				libusb_detach_kernel_driver(ctx->hdl, 0);
+			if(xrock_probe(list[i]))
+			{
+				ret = xrock_open(ctx, list[i]);
+				if(ctx->hdl)
+					break;
+			}
+		}
+		if(list)
+			libusb_free_device_list(list, 1);
+	}
+	return ret;
+}
 
-			if(libusb_claim_interface(ctx->hdl, 0) == 0)
+/*
+ * Heap allocated context for library users, opens the first supported chip
+ * at the given port path, or the first one found when path is NULL.
+ */
+struct xrock_ctx_t * xrock_ctx_alloc(libusb_context * context, const char * path)
+{
+	struct xrock_ctx_t * ctx;
+	libusb_device ** list = NULL;
+	char buf[32];
+	int count;
+
+	ctx = calloc(1, sizeof(struct xrock_ctx_t));
+	if(!ctx)
+		return NULL;
+	ctx->context = context;
+	count = libusb_get_device_list(context, &list);
+	for(int i = 0; i < count; i++)
+	{
+		if(xrock_probe(list[i]) && (!path || !strcmp(xrock_path(list[i], buf, sizeof(buf)), path)))
+		{
+			if(xrock_open(ctx, list[i]))
+				break;
+			if(ctx->hdl)
 			{
-				struct libusb_device_descriptor desc;
-				if(libusb_get_device_descriptor(libusb_get_device(ctx->hdl), &desc) == 0)
-				{
-					if((desc.bcdUSB & 0x0001) == 0x0000)
-						ctx->maskrom = 1;
-					else
-						ctx->maskrom = 0;
+				libusb_close(ctx->hdl);
+				ctx->hdl = NULL;
+			}
+		}
+	}
+	if(list)
+		libusb_free_device_list(list, 1);
+	if(!ctx->hdl)
+	{
+		free(ctx);
+		return NULL;
+	}
+	return ctx;
+}
 
-					struct libusb_config_descriptor * config;
-					if(libusb_get_active_config_descriptor(libusb_get_device(ctx->hdl), &config) == 0)
-					{
-						for(int if_idx = 0; if_idx < config->bNumInterfaces; if_idx++)
-						{
-							const struct libusb_interface * iface = config->interface + if_idx;
-							for(int set_idx = 0; set_idx < iface->num_altsetting; set_idx++)
-							{
-								const struct libusb_interface_descriptor * setting = iface->altsetting + set_idx;
-								for(int ep_idx = 0; ep_idx < setting->bNumEndpoints; ep_idx++)
-								{
-									const struct libusb_endpoint_descriptor * ep = setting->endpoint + ep_idx;
-									if((ep->bmAttributes & LIBUSB_TRANSFER_TYPE_MASK) != LIBUSB_TRANSFER_TYPE_BULK)
-										continue;
-									if((ep->bEndpointAddress & LIBUSB_ENDPOINT_DIR_MASK) == LIBUSB_ENDPOINT_IN)
-										ctx->epin = ep->bEndpointAddress;
-									else
-										ctx->epout = ep->bEndpointAddress;
-								}
-							}
-						}
-						libusb_free_config_descriptor(config);
-						return 1;
-					}
-		    	}
-		    }
+void xrock_ctx_free(struct xrock_ctx_t * ctx)
+{
+	if(ctx)
+	{
+		if(ctx->hdl)
+		{
+			libusb_release_interface(ctx->hdl, 0);
+			libusb_close(ctx->hdl);
 		}
+		free(ctx);
+	}
+}
+
+void xrock_ctx_set_progress(struct xrock_ctx_t * ctx, progress_hook_t hook, void * data)
+{
+	if(ctx)
+	{
+		ctx->progress = hook;
+		ctx->progress_data = data;
 	}
-	return 0;
 }
 
-void rock_maskrom_upload_memory(struct xrock_ctx_t * ctx, uint32_t code, void * buf, uint64_t len, int rc4)
+int xrock_ctx_error(struct xrock_ctx_t * ctx)
 {
-	struct rc4_ctx_t rctx;
-	uint8_t key[16] = { 124, 78, 3, 4, 85, 5, 9, 7, 45, 44, 123, 56, 23, 13, 23, 17 };
-	uint64_t total = 0;
-	uint16_t crc16 = 0xffff;
-	int pend = 0;
-	unsigned char * buffer;
+	return ctx ? ctx->error : XROCK_ERROR_NODEV;
+}
 
-	buffer = malloc(len + 5);
-	if(buffer)
+const char * xrock_ctx_strerror(struct xrock_ctx_t * ctx)
+{
+	switch(xrock_ctx_error(ctx))
+	{
+	case XROCK_ERROR_NONE:
+		return "Success";
+	case XROCK_ERROR_USB:
+		return libusb_error_name(ctx->usb_error);
+	case XROCK_ERROR_PROTOCOL:
+		return "Invalid response from device";
+	case XROCK_ERROR_NOMEM:
+		return "Out of memory";
+	case XROCK_ERROR_FILE:
+		return "File access error";
+	case XROCK_ERROR_NODEV:
+		return "No such device";
+	case XROCK_ERROR_THREAD:
+		return "Can't create thread";
+	case XROCK_ERROR_FORMAT:
+		return "Invalid file format";
+	case XROCK_ERROR_VERIFY:
+		return "Data verification failed";
+	default:
+		break;
+	}
+	return "Unknown error";
+}
+
+/*
+ * A progress callback set on the context wins over the per thread hook.
+ */
+void rock_progress_start(struct xrock_ctx_t * ctx, struct progress_t * p, uint64_t total)
+{
+	progress_start(p, total);
+	if(ctx && ctx->progress)
 	{
-		memset(buffer, 0, len + 5);
-		memcpy(buffer, buf, len);
-		if(rc4)
+		p->hook = ctx->progress;
+		p->data = ctx->progress_data;
+	}
+}
+
+/*
+ * Streaming maskrom upload. The image is a list of segments sent as one
+ * stream, RC4 and CRC16 run on each 4KB block while the previous one is
+ * still on the wire, so only two staging blocks are needed. A stream of
+ * 4095 bytes modulo 4096 gets one zero byte of padding before the CRC, one
+ * of 4094 bytes gets a trailing one byte transfer after it.
+ */
+struct rock_upload_seg_t {
+	const void * buf;
+	uint64_t len;
+};
+
+struct rock_upload_t {
+	const struct rock_upload_seg_t * seg;
+	int nseg;
+	int idx;
+	uint64_t off;
+	uint64_t len;
+	uint64_t total;
+	uint64_t pos;
+	int pad;
+	uint16_t crc;
+	int rc4;
+};
+
+static int rock_upload_fill(struct rock_upload_t * u, uint8_t * buf)
+{
+	uint64_t c;
+	int n = 0;
+
+	while((n < 4096) && (u->pos < u->total))
+	{
+		if(u->pos < u->len)
 		{
-			rc4_setkey(&rctx, key, sizeof(key));
-			rc4_crypt(&rctx, buffer, len);
+			while(u->off >= u->seg[u->idx].len)
+			{
+				u->idx++;
+				u->off = 0;
+			}
+			c = XMIN((uint64_t)(4096 - n), u->seg[u->idx].len - u->off);
+			memcpy(buf + n, (const uint8_t *)u->seg[u->idx].buf + u->off, c);
+			if(u->rc4 && !rc4_static_crypt(buf + n, u->pos, c))
+				return -1;
+			u->crc = crc16_sum(u->crc, buf + n, c);
+			u->off += c;
 		}
-		switch(len % 4096)
+		else if(u->pos < u->len + u->pad)
 		{
-		case 4095:
-			len++;
-			break;
-		case 4094:
-			pend = 1;
-			break;
-		case 0:
-		default:
-			break;
+			c = 1;
+			buf[n] = 0;
+			u->crc = crc16_sum(u->crc, buf + n, 1);
 		}
+		else
+		{
+			c = 1;
+			buf[n] = (u->pos == u->len + u->pad) ? (u->crc >> 8) : (u->crc & 0xff);
+		}
+		n += c;
+		u->pos += c;
+	}
+	return n;
+}
 
-		crc16 = crc16_sum(crc16, buffer, len);
-		buffer[len++] = crc16 >> 8;
-		buffer[len++] = crc16 & 0xff;
-		while(total < len)
+static void LIBUSB_CALL rock_upload_callback(struct libusb_transfer * transfer)
+{
+	*(int *)transfer->user_data = 1;
+}
+
+static int rock_maskrom_upload_segs(struct xrock_ctx_t * ctx, uint32_t code, const struct rock_upload_seg_t * seg, int nseg, int rc4)
+{
+	uint8_t stage[2][LIBUSB_CONTROL_SETUP_SIZE + 4096];
+	struct libusb_transfer * transfer;
+	struct rock_upload_t u;
+	int cur = 0, n, r, done, ret = 1;
+
+	memset(&u, 0, sizeof(struct rock_upload_t));
+	u.seg = seg;
+	u.nseg = nseg;
+	for(int i = 0; i < nseg; i++)
+		u.len += seg[i].len;
+	u.pad = ((u.len % 4096) == 4095) ? 1 : 0;
+	u.total = u.len + u.pad + 2;
+	u.crc = 0xffff;
+	u.rc4 = rc4;
+
+	transfer = libusb_alloc_transfer(0);
+	if(!transfer)
+	{
+		ctx->error = XROCK_ERROR_NOMEM;
+		return 0;
+	}
+	n = rock_upload_fill(&u, &stage[cur][LIBUSB_CONTROL_SETUP_SIZE]);
+	while(n > 0)
+	{
+		libusb_fill_control_setup(stage[cur], LIBUSB_REQUEST_TYPE_VENDOR, 0xc, 0, code, n);
+		libusb_fill_control_transfer(transfer, ctx->hdl, stage[cur], rock_upload_callback, &done, 0);
+		done = 0;
+		r = libusb_submit_transfer(transfer);
+		if(r != 0)
 		{
-			int n = ((len - total) > 4096) ? 4096 : (len - total);
-			if(libusb_control_transfer(ctx->hdl, LIBUSB_REQUEST_TYPE_VENDOR, 0xc, 0, code, buffer + total, n, 0) != n)
-			{
-				free(buffer);
-				return;
-			}
-			total += n;
+			ctx->error = XROCK_ERROR_USB;
+			ctx->usb_error = r;
+			ret = 0;
+			break;
 		}
-		if(pend)
+		cur ^= 1;
+		n = rock_upload_fill(&u, &stage[cur][LIBUSB_CONTROL_SETUP_SIZE]);
+		while(!done)
 		{
-			unsigned char zero = 0;
-			libusb_control_transfer(ctx->hdl, LIBUSB_REQUEST_TYPE_VENDOR, 0xc, 0, code, &zero, 1, 0);
+			r = libusb_handle_events_completed(ctx->context, &done);
+			if((r < 0) && (r != LIBUSB_ERROR_INTERRUPTED))
+				libusb_cancel_transfer(transfer);
+		}
+		if((transfer->status != LIBUSB_TRANSFER_COMPLETED) || (transfer->actual_length != transfer->length - LIBUSB_CONTROL_SETUP_SIZE))
+		{
+			ctx->error = XROCK_ERROR_USB;
+			ctx->usb_error = (transfer->status == LIBUSB_TRANSFER_NO_DEVICE) ? LIBUSB_ERROR_NO_DEVICE : LIBUSB_ERROR_IO;
+			ret = 0;
+			break;
 		}
-		free(buffer);
 	}
+	libusb_free_transfer(transfer);
+	if(ret && (n < 0))
+	{
+		ctx->error = XROCK_ERROR_NOMEM;
+		ret = 0;
+	}
+	if(ret && ((u.len % 4096) == 4094))
+	{
+		unsigned char zero = 0;
+		libusb_control_transfer(ctx->hdl, LIBUSB_REQUEST_TYPE_VENDOR, 0xc, 0, code, &zero, 1, 0);
+	}
+	return ret;
+}
+
+int rock_maskrom_upload_memory(struct xrock_ctx_t * ctx, uint32_t code, void * buf, uint64_t len, int rc4)
+{
+	struct rock_upload_seg_t seg = { buf, len };
+
+	return rock_maskrom_upload_segs(ctx, code, &seg, 1, rc4);
 }
 
-void rock_maskrom_upload_file(struct xrock_ctx_t * ctx, uint32_t code, const char * filename, int rc4)
+int rock_maskrom_upload_file(struct xrock_ctx_t * ctx, uint32_t code, const char * filename, int rc4)
 {
 	uint64_t len;
 	void * buf;
+	int ret;
 
 	buf = file_load(filename, &len);
-	if(buf)
+	if(!buf)
 	{
-		rock_maskrom_upload_memory(ctx, code, buf, len, rc4);
-		free(buf);
+		ctx->error = XROCK_ERROR_FILE;
+		return 0;
 	}
+	ret = rock_maskrom_upload_memory(ctx, code, buf, len, rc4);
+	free(buf);
+	return ret;
 }
 
-void rock_maskrom_dump_arm32(struct xrock_ctx_t * ctx, uint32_t uart, uint32_t addr, uint32_t len, int rc4)
+int rock_maskrom_dump_arm32(struct xrock_ctx_t * ctx, uint32_t uart, uint32_t addr, uint32_t len, int rc4)
 {
-	static uint8_t payload[] = {
+	static const uint8_t payload[] = {
 		0x00, 0x00, 0xa0, 0xe3, 0x17, 0x0f, 0x08, 0xee, 0x15, 0x0f, 0x07, 0xee,
 		0xd5, 0x0f, 0x07, 0xee, 0x9a, 0x0f, 0x07, 0xee, 0x95, 0x0f, 0x07, 0xee,
 		0x08, 0x00, 0x00, 0xea, 0x00, 0x00, 0x4c, 0xff, 0x00, 0x00, 0x00, 0x00,
@@ -260,16 +525,18 @@ void rock_maskrom_dump_arm32(struct xrock_ctx_t * ctx, uint32_t uart, uint32_t a
 		0x12, 0x04, 0x14, 0x01, 0x15, 0x01, 0x17, 0x03, 0x18, 0x01, 0x19, 0x01,
 		0x1a, 0x01, 0x1e, 0x02,
 	};
+	uint8_t buf[sizeof(payload)];
 
-	put_unaligned_le32(&payload[0x1c], uart);
-	put_unaligned_le32(&payload[0x20], addr);
-	put_unaligned_le32(&payload[0x24], len);
-	rock_maskrom_upload_memory(ctx, 0x471, payload, sizeof(payload), rc4);
+	memcpy(buf, payload, sizeof(payload));
+	put_unaligned_le32(&buf[0x1c], uart);
+	put_unaligned_le32(&buf[0x20], addr);
+	put_unaligned_le32(&buf[0x24], len);
+	return rock_maskrom_upload_memory(ctx, 0x471, buf, sizeof(buf), rc4);
 }
 
-void rock_maskrom_dump_arm64(struct xrock_ctx_t * ctx, uint32_t uart, uint32_t addr, uint32_t len, int rc4)
+int rock_maskrom_dump_arm64(struct xrock_ctx_t * ctx, uint32_t uart, uint32_t addr, uint32_t len, int rc4)
 {
-	static uint8_t payload[] = {
+	static const uint8_t payload[] = {
 		0xdf, 0x3f, 0x03, 0xd5, 0x9f, 0x3f, 0x03, 0xd5, 0x0c, 0x00, 0x00, 0x14,
 		0x00, 0x00, 0xd4, 0x2a, 0x00, 0x00, 0xff, 0xff, 0x10, 0x00, 0x00, 0x00,
 		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
@@ -341,14 +608,142 @@ void rock_maskrom_dump_arm64(struct xrock_ctx_t * ctx, uint32_t uart, uint32_t a
 		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
 		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
 	};
+	uint8_t buf[sizeof(payload)];
 
-	put_unaligned_le32(&payload[0x0c], uart);
-	put_unaligned_le32(&payload[0x10], addr);
-	put_unaligned_le32(&payload[0x14], len);
-	rock_maskrom_upload_memory(ctx, 0x471, payload, sizeof(payload), rc4);
+	memcpy(buf, payload, sizeof(payload));
+	put_unaligned_le32(&buf[0x0c], uart);
+	put_unaligned_le32(&buf[0x10], addr);
+	put_unaligned_le32(&buf[0x14], len);
+	return rock_maskrom_upload_memory(ctx, 0x471, buf, sizeof(buf), rc4);
 }
 
-static inline void rock_maskrom_write_arm32(struct xrock_ctx_t * ctx, uint32_t addr, void * buf, size_t len, int rc4)
+int rock_maskrom_bindump_arm32(struct xrock_ctx_t * ctx, uint32_t uart, uint32_t addr, uint32_t len, int rc4)
+{
+	static const uint8_t payload[] = {
+		0x00, 0x00, 0xa0, 0xe3, 0x17, 0x0f, 0x08, 0xee, 0x15, 0x0f, 0x07, 0xee,
+		0xd5, 0x0f, 0x07, 0xee, 0x9a, 0x0f, 0x07, 0xee, 0x95, 0x0f, 0x07, 0xee,
+		0x02, 0x00, 0x00, 0xea, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0xf0, 0x4f, 0x2d, 0xe9, 0x18, 0x90, 0x1f, 0xe5,
+		0x18, 0xa0, 0x1f, 0xe5, 0x18, 0xb0, 0x1f, 0xe5, 0x00, 0x80, 0xa0, 0xe3,
+		0x00, 0x00, 0x5b, 0xe3, 0x0a, 0x00, 0x00, 0x0a, 0x01, 0x0b, 0x5b, 0xe3,
+		0x0b, 0x00, 0xa0, 0x31, 0x01, 0x0b, 0xa0, 0x23, 0x00, 0x40, 0x8a, 0xe0,
+		0xff, 0x80, 0xc8, 0xe3, 0x0a, 0x00, 0x00, 0xeb, 0x0a, 0x00, 0x44, 0xe0,
+		0x00, 0xb0, 0x4b, 0xe0, 0x04, 0xa0, 0xa0, 0xe1, 0x01, 0x88, 0x88, 0xe2,
+		0xf2, 0xff, 0xff, 0xea, 0x0a, 0x40, 0xa0, 0xe1, 0xff, 0x80, 0xc8, 0xe3,
+		0x02, 0x80, 0x88, 0xe3, 0x01, 0x00, 0x00, 0xeb, 0x00, 0x00, 0xa0, 0xe3,
+		0xf0, 0x8f, 0xbd, 0xe8, 0x00, 0x40, 0x2d, 0xe9, 0x0a, 0x70, 0x54, 0xe0,
+		0x14, 0x00, 0x00, 0x0a, 0x0a, 0x30, 0xa0, 0xe1, 0x00, 0x70, 0xa0, 0xe3,
+		0x01, 0x50, 0xd3, 0xe4, 0x01, 0x60, 0xa0, 0xe3, 0x04, 0x00, 0x53, 0xe1,
+		0x07, 0x00, 0x00, 0x0a, 0x01, 0x0c, 0x56, 0xe3, 0x05, 0x00, 0x00, 0x0a,
+		0x00, 0x00, 0xd3, 0xe5, 0x05, 0x00, 0x50, 0xe1, 0x02, 0x00, 0x00, 0x1a,
+		0x01, 0x30, 0x83, 0xe2, 0x01, 0x60, 0x86, 0xe2, 0xf5, 0xff, 0xff, 0xea,
+		0x02, 0x70, 0x87, 0xe2, 0x04, 0x00, 0x53, 0xe1, 0xf0, 0xff, 0xff, 0x1a,
+		0x0a, 0x00, 0x44, 0xe0, 0x00, 0x00, 0x57, 0xe1, 0x01, 0x80, 0x88, 0x33,
+		0x00, 0x70, 0xa0, 0x21, 0xa5, 0x00, 0xa0, 0xe3, 0x4d, 0x00, 0x00, 0xeb,
+		0x5a, 0x00, 0xa0, 0xe3, 0x4b, 0x00, 0x00, 0xeb, 0x00, 0xc0, 0xe0, 0xe3,
+		0x2c, 0xc8, 0xa0, 0xe1, 0x28, 0x08, 0xa0, 0xe1, 0x3b, 0x00, 0x00, 0xeb,
+		0x28, 0x0c, 0xa0, 0xe1, 0x39, 0x00, 0x00, 0xeb, 0x07, 0x00, 0xa0, 0xe1,
+		0x37, 0x00, 0x00, 0xeb, 0x27, 0x04, 0xa0, 0xe1, 0x35, 0x00, 0x00, 0xeb,
+		0x08, 0x00, 0xa0, 0xe1, 0x33, 0x00, 0x00, 0xeb, 0x00, 0x00, 0xa0, 0xe3,
+		0x31, 0x00, 0x00, 0xeb, 0x00, 0x00, 0x57, 0xe3, 0x19, 0x00, 0x00, 0x0a,
+		0x0a, 0x30, 0xa0, 0xe1, 0x01, 0x00, 0x18, 0xe3, 0x04, 0x00, 0x00, 0x1a,
+		0x01, 0x00, 0xd3, 0xe4, 0x2a, 0x00, 0x00, 0xeb, 0x04, 0x00, 0x53, 0xe1,
+		0xfb, 0xff, 0xff, 0x1a, 0x11, 0x00, 0x00, 0xea, 0x01, 0x50, 0xd3, 0xe4,
+		0x01, 0x60, 0xa0, 0xe3, 0x04, 0x00, 0x53, 0xe1, 0x07, 0x00, 0x00, 0x0a,
+		0x01, 0x0c, 0x56, 0xe3, 0x05, 0x00, 0x00, 0x0a, 0x00, 0x00, 0xd3, 0xe5,
+		0x05, 0x00, 0x50, 0xe1, 0x02, 0x00, 0x00, 0x1a, 0x01, 0x30, 0x83, 0xe2,
+		0x01, 0x60, 0x86, 0xe2, 0xf5, 0xff, 0xff, 0xea, 0x01, 0x00, 0x46, 0xe2,
+		0x19, 0x00, 0x00, 0xeb, 0x05, 0x00, 0xa0, 0xe1, 0x17, 0x00, 0x00, 0xeb,
+		0x04, 0x00, 0x53, 0xe1, 0xed, 0xff, 0xff, 0x1a, 0x0c, 0x60, 0xa0, 0xe1,
+		0xff, 0x00, 0x06, 0xe2, 0x1e, 0x00, 0x00, 0xeb, 0x26, 0x04, 0xa0, 0xe1,
+		0x1c, 0x00, 0x00, 0xeb, 0x20, 0x00, 0x00, 0xeb, 0x00, 0x00, 0x50, 0xe3,
+		0xc9, 0xff, 0xff, 0xba, 0x06, 0x00, 0x50, 0xe3, 0x15, 0x00, 0x50, 0x13,
+		0xf9, 0xff, 0xff, 0x1a, 0x00, 0x50, 0xa0, 0xe1, 0x19, 0x00, 0x00, 0xeb,
+		0x00, 0x00, 0x50, 0xe3, 0xc2, 0xff, 0xff, 0xba, 0x28, 0x68, 0xa0, 0xe1,
+		0xff, 0x60, 0x06, 0xe2, 0x06, 0x00, 0x50, 0xe1, 0xf1, 0xff, 0xff, 0x1a,
+		0x15, 0x00, 0x55, 0xe3, 0xbc, 0xff, 0xff, 0x0a, 0x00, 0x80, 0xbd, 0xe8,
+		0xff, 0x00, 0x00, 0xe2, 0x00, 0xc4, 0x2c, 0xe0, 0x08, 0x10, 0xa0, 0xe3,
+		0x01, 0x2a, 0xa0, 0xe3, 0x21, 0x20, 0x82, 0xe3, 0x02, 0x09, 0x1c, 0xe3,
+		0x8c, 0xc0, 0xa0, 0xe1, 0x02, 0xc0, 0x2c, 0x10, 0x01, 0x10, 0x51, 0xe2,
+		0xfa, 0xff, 0xff, 0x1a, 0x0c, 0xc8, 0xa0, 0xe1, 0x2c, 0xc8, 0xa0, 0xe1,
+		0x7c, 0x10, 0x99, 0xe5, 0x02, 0x00, 0x11, 0xe3, 0xfc, 0xff, 0xff, 0x0a,
+		0x00, 0x00, 0x89, 0xe5, 0x1e, 0xff, 0x2f, 0xe1, 0x01, 0x25, 0xa0, 0xe3,
+		0x14, 0x10, 0x99, 0xe5, 0x01, 0x00, 0x11, 0xe3, 0x03, 0x00, 0x00, 0x1a,
+		0x01, 0x20, 0x52, 0xe2, 0xfa, 0xff, 0xff, 0x1a, 0x00, 0x00, 0xe0, 0xe3,
+		0x1e, 0xff, 0x2f, 0xe1, 0x00, 0x00, 0x99, 0xe5, 0xff, 0x00, 0x00, 0xe2,
+		0x1e, 0xff, 0x2f, 0xe1,
+	};
+	uint8_t buf[sizeof(payload)];
+
+	memcpy(buf, payload, sizeof(payload));
+	put_unaligned_le32(&buf[0x1c], uart);
+	put_unaligned_le32(&buf[0x20], addr);
+	put_unaligned_le32(&buf[0x24], len);
+	return rock_maskrom_upload_memory(ctx, 0x471, buf, sizeof(buf), rc4);
+}
+
+int rock_maskrom_bindump_arm64(struct xrock_ctx_t * ctx, uint32_t uart, uint32_t addr, uint32_t len, int rc4)
+{
+	static const uint8_t payload[] = {
+		0xdf, 0x3f, 0x03, 0xd5, 0x9f, 0x3f, 0x03, 0xd5, 0x04, 0x00, 0x00, 0x14,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0xf0, 0x03, 0x1e, 0xaa, 0x89, 0xff, 0xff, 0x18, 0x8a, 0xff, 0xff, 0x18,
+		0x8b, 0xff, 0xff, 0x18, 0x0c, 0x00, 0x80, 0x52, 0x6b, 0x01, 0x00, 0x34,
+		0xed, 0x03, 0x0a, 0xaa, 0x0e, 0x80, 0x80, 0x52, 0x7f, 0x01, 0x0e, 0x6b,
+		0x6e, 0x31, 0x8e, 0x1a, 0x08, 0x00, 0x80, 0x52, 0x0b, 0x00, 0x00, 0x94,
+		0x4a, 0x01, 0x0e, 0x8b, 0x6b, 0x01, 0x0e, 0x4b, 0x8c, 0x05, 0x00, 0x11,
+		0xf6, 0xff, 0xff, 0x17, 0x0e, 0x00, 0x80, 0x52, 0x48, 0x00, 0x80, 0x52,
+		0x04, 0x00, 0x00, 0x94, 0xfe, 0x03, 0x10, 0xaa, 0x00, 0x00, 0x80, 0xd2,
+		0xc0, 0x03, 0x5f, 0xd6, 0xf1, 0x03, 0x1e, 0xaa, 0xa4, 0x01, 0x0e, 0x8b,
+		0xe7, 0x03, 0x0e, 0x2a, 0xee, 0x02, 0x00, 0x34, 0xe3, 0x03, 0x0d, 0xaa,
+		0x07, 0x00, 0x80, 0x52, 0x65, 0x14, 0x40, 0x38, 0x26, 0x00, 0x80, 0x52,
+		0x7f, 0x00, 0x04, 0xeb, 0x20, 0x01, 0x00, 0x54, 0xdf, 0x00, 0x04, 0x71,
+		0xe0, 0x00, 0x00, 0x54, 0x60, 0x00, 0x40, 0x39, 0x1f, 0x00, 0x05, 0x6b,
+		0x81, 0x00, 0x00, 0x54, 0x63, 0x04, 0x00, 0x91, 0xc6, 0x04, 0x00, 0x11,
+		0xf7, 0xff, 0xff, 0x17, 0xe7, 0x08, 0x00, 0x11, 0x7f, 0x00, 0x04, 0xeb,
+		0x41, 0xfe, 0xff, 0x54, 0xff, 0x00, 0x0e, 0x6b, 0x62, 0x00, 0x00, 0x54,
+		0x08, 0x01, 0x00, 0x32, 0x02, 0x00, 0x00, 0x14, 0xe7, 0x03, 0x0e, 0x2a,
+		0xa0, 0x14, 0x80, 0x52, 0x4a, 0x00, 0x00, 0x94, 0x40, 0x0b, 0x80, 0x52,
+		0x48, 0x00, 0x00, 0x94, 0xef, 0xff, 0x9f, 0x52, 0xe0, 0x03, 0x0c, 0x2a,
+		0x3a, 0x00, 0x00, 0x94, 0x80, 0x7d, 0x08, 0x53, 0x38, 0x00, 0x00, 0x94,
+		0xe0, 0x03, 0x07, 0x2a, 0x36, 0x00, 0x00, 0x94, 0xe0, 0x7c, 0x08, 0x53,
+		0x34, 0x00, 0x00, 0x94, 0xe0, 0x03, 0x08, 0x2a, 0x32, 0x00, 0x00, 0x94,
+		0x00, 0x00, 0x80, 0x52, 0x30, 0x00, 0x00, 0x94, 0x47, 0x03, 0x00, 0x34,
+		0xe3, 0x03, 0x0d, 0xaa, 0xc8, 0x00, 0x00, 0x37, 0x60, 0x14, 0x40, 0x38,
+		0x2b, 0x00, 0x00, 0x94, 0x7f, 0x00, 0x04, 0xeb, 0xa1, 0xff, 0xff, 0x54,
+		0x13, 0x00, 0x00, 0x14, 0x65, 0x14, 0x40, 0x38, 0x26, 0x00, 0x80, 0x52,
+		0x7f, 0x00, 0x04, 0xeb, 0x20, 0x01, 0x00, 0x54, 0xdf, 0x00, 0x04, 0x71,
+		0xe0, 0x00, 0x00, 0x54, 0x60, 0x00, 0x40, 0x39, 0x1f, 0x00, 0x05, 0x6b,
+		0x81, 0x00, 0x00, 0x54, 0x63, 0x04, 0x00, 0x91, 0xc6, 0x04, 0x00, 0x11,
+		0xf7, 0xff, 0xff, 0x17, 0xc0, 0x04, 0x00, 0x51, 0x1a, 0x00, 0x00, 0x94,
+		0xe0, 0x03, 0x05, 0x2a, 0x18, 0x00, 0x00, 0x94, 0x7f, 0x00, 0x04, 0xeb,
+		0xe1, 0xfd, 0xff, 0x54, 0xe6, 0x03, 0x0f, 0x2a, 0xc0, 0x1c, 0x00, 0x12,
+		0x1e, 0x00, 0x00, 0x94, 0xc0, 0x7c, 0x08, 0x53, 0x1c, 0x00, 0x00, 0x94,
+		0x1f, 0x00, 0x00, 0x94, 0xe0, 0xf9, 0xff, 0x37, 0x1f, 0x18, 0x00, 0x71,
+		0x60, 0x00, 0x00, 0x54, 0x1f, 0x54, 0x00, 0x71, 0x61, 0xff, 0xff, 0x54,
+		0xe5, 0x03, 0x00, 0x2a, 0x18, 0x00, 0x00, 0x94, 0x00, 0xf9, 0xff, 0x37,
+		0x86, 0x1d, 0x00, 0x12, 0x1f, 0x00, 0x06, 0x6b, 0xa1, 0xfe, 0xff, 0x54,
+		0xbf, 0x54, 0x00, 0x71, 0x60, 0xf8, 0xff, 0x54, 0xfe, 0x03, 0x11, 0xaa,
+		0xc0, 0x03, 0x5f, 0xd6, 0x00, 0x1c, 0x00, 0x12, 0xef, 0x21, 0x00, 0x4a,
+		0x01, 0x01, 0x80, 0x52, 0x22, 0x04, 0x82, 0x52, 0xff, 0x01, 0x11, 0x72,
+		0xef, 0x79, 0x1f, 0x53, 0x40, 0x00, 0x00, 0x54, 0xef, 0x01, 0x02, 0x4a,
+		0x21, 0x04, 0x00, 0x71, 0x61, 0xff, 0xff, 0x54, 0xef, 0x3d, 0x00, 0x12,
+		0x21, 0x7d, 0x40, 0xb9, 0xe1, 0xff, 0x0f, 0x36, 0x20, 0x01, 0x00, 0xb9,
+		0xc0, 0x03, 0x5f, 0xd6, 0x02, 0x08, 0xa0, 0x52, 0x21, 0x15, 0x40, 0xb9,
+		0xa1, 0x00, 0x00, 0x37, 0x42, 0x04, 0x00, 0x71, 0xa1, 0xff, 0xff, 0x54,
+		0x00, 0x00, 0x80, 0x12, 0xc0, 0x03, 0x5f, 0xd6, 0x20, 0x01, 0x40, 0xb9,
+		0x00, 0x1c, 0x00, 0x12, 0xc0, 0x03, 0x5f, 0xd6,
+	};
+	uint8_t buf[sizeof(payload)];
+
+	memcpy(buf, payload, sizeof(payload));
+	put_unaligned_le32(&buf[0x0c], uart);
+	put_unaligned_le32(&buf[0x10], addr);
+	put_unaligned_le32(&buf[0x14], len);
+	return rock_maskrom_upload_memory(ctx, 0x471, buf, sizeof(buf), rc4);
+}
+
+static inline int rock_maskrom_write_arm32(struct xrock_ctx_t * ctx, uint32_t addr, void * buf, size_t len, int rc4)
 {
 	static const uint8_t payload[] = {
 		0x00, 0x00, 0xa0, 0xe3, 0x17, 0x0f, 0x08, 0xee, 0x15, 0x0f, 0x07, 0xee,
@@ -465,111 +860,115 @@ static inline void rock_maskrom_write_arm32(struct xrock_ctx_t * ctx, uint32_t a
 		0x08, 0x10, 0x90, 0xe5, 0x01, 0xf0, 0x29, 0xe1, 0x1e, 0xff, 0x2f, 0xe1,
 	};
 
-	uint8_t * tmp = malloc(sizeof(payload) + 8 + len);
-	if(tmp)
-	{
-		memcpy(&tmp[0], &payload[0], sizeof(payload));
-		put_unaligned_le32(tmp + sizeof(payload) + 0, addr);
-		put_unaligned_le32(tmp + sizeof(payload) + 4, (uint32_t)len);
-		memcpy(tmp + sizeof(payload) + 8, buf, len);
-		rock_maskrom_upload_memory(ctx, 0x471, tmp, sizeof(payload) + 8 + len, rc4);
-		free(tmp);
-	}
+	uint8_t hdr[8];
+	struct rock_upload_seg_t seg[3] = {
+		{ payload, sizeof(payload) },
+		{ hdr, sizeof(hdr) },
+		{ buf, len },
+	};
+
+	put_unaligned_le32(&hdr[0], addr);
+	put_unaligned_le32(&hdr[4], (uint32_t)len);
+	return rock_maskrom_upload_segs(ctx, 0x471, seg, 3, rc4);
 }
 
-static inline void rock_maskrom_write_arm64(struct xrock_ctx_t * ctx, uint32_t addr, void * buf, size_t len, int rc4)
+static inline int rock_maskrom_write_arm64(struct xrock_ctx_t * ctx, uint32_t addr, void * buf, size_t len, int rc4)
 {
 	static const uint8_t payload[] = {
-		0xdf, 0x3f, 0x03, 0xd5, 0x9f, 0x3f, 0x03, 0xd5, 0x44, 0x00, 0x00, 0x14,
-		0xff, 0xc3, 0x00, 0xd1, 0xe0, 0x0f, 0x00, 0xf9, 0xe1, 0x0b, 0x00, 0xf9,
-		0xe2, 0x07, 0x00, 0xf9, 0xe1, 0x0f, 0x40, 0xf9, 0xe0, 0x0b, 0x40, 0xf9,
-		0x3f, 0x00, 0x00, 0xeb, 0x88, 0x02, 0x00, 0x54, 0xe0, 0x0f, 0x40, 0xf9,
-		0xe0, 0x13, 0x00, 0xf9, 0xe0, 0x0b, 0x40, 0xf9, 0xe0, 0x17, 0x00, 0xf9,
-		0x09, 0x00, 0x00, 0x14, 0xe1, 0x17, 0x40, 0xf9, 0x20, 0x04, 0x00, 0x91,
-		0xe0, 0x17, 0x00, 0xf9, 0xe0, 0x13, 0x40, 0xf9, 0x02, 0x04, 0x00, 0x91,
-		0xe2, 0x13, 0x00, 0xf9, 0x21, 0x00, 0x40, 0x39, 0x01, 0x00, 0x00, 0x39,
-		0xe0, 0x07, 0x40, 0xf9, 0x01, 0x04, 0x00, 0xd1, 0xe1, 0x07, 0x00, 0xf9,
-		0x1f, 0x00, 0x00, 0xf1, 0x81, 0xfe, 0xff, 0x54, 0x1d, 0x00, 0x00, 0x14,
-		0xe0, 0x0f, 0x40, 0xf9, 0xe0, 0x13, 0x00, 0xf9, 0xe1, 0x13, 0x40, 0xf9,
-		0xe0, 0x07, 0x40, 0xf9, 0x20, 0x00, 0x00, 0x8b, 0xe0, 0x13, 0x00, 0xf9,
-		0xe0, 0x0b, 0x40, 0xf9, 0xe0, 0x17, 0x00, 0xf9, 0xe1, 0x17, 0x40, 0xf9,
-		0xe0, 0x07, 0x40, 0xf9, 0x20, 0x00, 0x00, 0x8b, 0xe0, 0x17, 0x00, 0xf9,
-		0x0b, 0x00, 0x00, 0x14, 0xe0, 0x17, 0x40, 0xf9, 0x00, 0x04, 0x00, 0xd1,
-		0xe0, 0x17, 0x00, 0xf9, 0xe0, 0x13, 0x40, 0xf9, 0x00, 0x04, 0x00, 0xd1,
-		0xe0, 0x13, 0x00, 0xf9, 0xe0, 0x17, 0x40, 0xf9, 0x01, 0x00, 0x40, 0x39,
-		0xe0, 0x13, 0x40, 0xf9, 0x01, 0x00, 0x00, 0x39, 0xe0, 0x07, 0x40, 0xf9,
-		0x01, 0x04, 0x00, 0xd1, 0xe1, 0x07, 0x00, 0xf9, 0x1f, 0x00, 0x00, 0xf1,
-		0x41, 0xfe, 0xff, 0x54, 0xe0, 0x0f, 0x40, 0xf9, 0xff, 0xc3, 0x00, 0x91,
-		0xc0, 0x03, 0x5f, 0xd6, 0x1f, 0x20, 0x03, 0xd5, 0x00, 0x00, 0x00, 0x00,
+		0xdf, 0x3f, 0x03, 0xd5, 0x9f, 0x3f, 0x03, 0xd5, 0x46, 0x00, 0x00, 0x14,
+		0xe3, 0x03, 0x00, 0xaa, 0x04, 0x00, 0x01, 0xca, 0x1f, 0x00, 0x01, 0xeb,
+		0x88, 0x03, 0x00, 0x54, 0x9f, 0x08, 0x40, 0xf2, 0xa1, 0x02, 0x00, 0x54,
+		0x7f, 0x0c, 0x40, 0xf2, 0xc0, 0x00, 0x00, 0x54, 0x82, 0x06, 0x00, 0xb4,
+		0x24, 0x14, 0x40, 0x38, 0x64, 0x14, 0x00, 0x38, 0x42, 0x04, 0x00, 0xd1,
+		0xfa, 0xff, 0xff, 0x17, 0x5f, 0x80, 0x00, 0xf1, 0xe3, 0x00, 0x00, 0x54,
+		0x24, 0x14, 0xc1, 0xa8, 0x26, 0x1c, 0xc1, 0xa8, 0x64, 0x14, 0x81, 0xa8,
+		0x66, 0x1c, 0x81, 0xa8, 0x42, 0x80, 0x00, 0xd1, 0xf9, 0xff, 0xff, 0x17,
+		0x5f, 0x40, 0x00, 0xf1, 0x83, 0x00, 0x00, 0x54, 0x24, 0x14, 0xc1, 0xa8,
+		0x64, 0x14, 0x81, 0xa8, 0x42, 0x40, 0x00, 0xd1, 0x42, 0x04, 0x00, 0xb4,
+		0x24, 0x14, 0x40, 0x38, 0x64, 0x14, 0x00, 0x38, 0x42, 0x04, 0x00, 0xd1,
+		0xfc, 0xff, 0xff, 0x17, 0x21, 0x00, 0x02, 0x8b, 0x63, 0x00, 0x02, 0x8b,
+		0x9f, 0x08, 0x40, 0xf2, 0xa1, 0x02, 0x00, 0x54, 0x7f, 0x0c, 0x40, 0xf2,
+		0xc0, 0x00, 0x00, 0x54, 0xe2, 0x02, 0x00, 0xb4, 0x24, 0xfc, 0x5f, 0x38,
+		0x64, 0xfc, 0x1f, 0x38, 0x42, 0x04, 0x00, 0xd1, 0xfa, 0xff, 0xff, 0x17,
+		0x5f, 0x80, 0x00, 0xf1, 0xe3, 0x00, 0x00, 0x54, 0x24, 0x14, 0xff, 0xa9,
+		0x26, 0x1c, 0xff, 0xa9, 0x64, 0x14, 0xbf, 0xa9, 0x66, 0x1c, 0xbf, 0xa9,
+		0x42, 0x80, 0x00, 0xd1, 0xf9, 0xff, 0xff, 0x17, 0x5f, 0x40, 0x00, 0xf1,
+		0x83, 0x00, 0x00, 0x54, 0x24, 0x14, 0xff, 0xa9, 0x64, 0x14, 0xbf, 0xa9,
+		0x42, 0x40, 0x00, 0xd1, 0xa2, 0x00, 0x00, 0xb4, 0x24, 0xfc, 0x5f, 0x38,
+		0x64, 0xfc, 0x1f, 0x38, 0x42, 0x04, 0x00, 0xd1, 0xfc, 0xff, 0xff, 0x17,
+		0xc0, 0x03, 0x5f, 0xd6, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
 		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
 		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-		0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0xff, 0x10, 0xe1, 0x03, 0x1e, 0xaa,
-		0x01, 0x00, 0x00, 0xb9, 0xe1, 0x03, 0x1d, 0xaa, 0x01, 0x04, 0x00, 0xb9,
-		0xe1, 0x03, 0x1c, 0xaa, 0x01, 0x08, 0x00, 0xb9, 0xe1, 0x03, 0x00, 0x91,
-		0x01, 0x0c, 0x00, 0xb9, 0xe0, 0x02, 0x00, 0x10, 0x81, 0x02, 0x00, 0x18,
-		0x1f, 0x00, 0x01, 0xeb, 0xa0, 0x00, 0x00, 0x54, 0x20, 0x02, 0x00, 0x18,
-		0x41, 0x02, 0x00, 0x10, 0x02, 0x02, 0x00, 0x18, 0xad, 0xff, 0xff, 0x97,
-		0x1f, 0x20, 0x03, 0xd5, 0xe1, 0x03, 0x1f, 0xaa, 0xa0, 0xfc, 0xff, 0x10,
-		0x01, 0x00, 0x40, 0xb9, 0xfe, 0x03, 0x01, 0xaa, 0x01, 0x04, 0x40, 0xb9,
-		0xfd, 0x03, 0x01, 0xaa, 0x01, 0x08, 0x40, 0xb9, 0xfc, 0x03, 0x01, 0xaa,
-		0x01, 0x0c, 0x40, 0xb9, 0x3f, 0x00, 0x00, 0x91, 0x00, 0x00, 0x80, 0xd2,
-		0xc0, 0x03, 0x5f, 0xd6,
+		0x00, 0xff, 0xff, 0x10, 0xe1, 0x03, 0x1e, 0xaa, 0x01, 0x00, 0x00, 0xb9,
+		0xe1, 0x03, 0x1d, 0xaa, 0x01, 0x04, 0x00, 0xb9, 0xe1, 0x03, 0x1c, 0xaa,
+		0x01, 0x08, 0x00, 0xb9, 0xe1, 0x03, 0x00, 0x91, 0x01, 0x0c, 0x00, 0xb9,
+		0xe0, 0x02, 0x00, 0x10, 0x81, 0x02, 0x00, 0x18, 0x1f, 0x00, 0x01, 0xeb,
+		0xa0, 0x00, 0x00, 0x54, 0x20, 0x02, 0x00, 0x18, 0x41, 0x02, 0x00, 0x10,
+		0x02, 0x02, 0x00, 0x18, 0xab, 0xff, 0xff, 0x97, 0x1f, 0x20, 0x03, 0xd5,
+		0xe1, 0x03, 0x1f, 0xaa, 0xa0, 0xfc, 0xff, 0x10, 0x01, 0x00, 0x40, 0xb9,
+		0xfe, 0x03, 0x01, 0xaa, 0x01, 0x04, 0x40, 0xb9, 0xfd, 0x03, 0x01, 0xaa,
+		0x01, 0x08, 0x40, 0xb9, 0xfc, 0x03, 0x01, 0xaa, 0x01, 0x0c, 0x40, 0xb9,
+		0x3f, 0x00, 0x00, 0x91, 0x00, 0x00, 0x80, 0xd2, 0xc0, 0x03, 0x5f, 0xd6,
 	};
 
-	uint8_t * tmp = malloc(sizeof(payload) + 8 + len);
-	if(tmp)
-	{
-		memcpy(&tmp[0], &payload[0], sizeof(payload));
-		put_unaligned_le32(tmp + sizeof(payload) + 0, addr);
-		put_unaligned_le32(tmp + sizeof(payload) + 4, (uint32_t)len);
-		memcpy(tmp + sizeof(payload) + 8, buf, len);
-		rock_maskrom_upload_memory(ctx, 0x471, tmp, sizeof(payload) + 8 + len, rc4);
-		free(tmp);
-	}
+	uint8_t hdr[8];
+	struct rock_upload_seg_t seg[3] = {
+		{ payload, sizeof(payload) },
+		{ hdr, sizeof(hdr) },
+		{ buf, len },
+	};
+
+	put_unaligned_le32(&hdr[0], addr);
+	put_unaligned_le32(&hdr[4], (uint32_t)len);
+	return rock_maskrom_upload_segs(ctx, 0x471, seg, 3, rc4);
 }
 
-void rock_maskrom_write_arm32_progress(struct xrock_ctx_t * ctx, uint32_t addr, void * buf, size_t len, int rc4)
+int rock_maskrom_write_arm32_progress(struct xrock_ctx_t * ctx, uint32_t addr, void * buf, size_t len, int rc4)
 {
 	struct progress_t p;
 	size_t n;
 
-	progress_start(&p, len);
+	rock_progress_start(ctx, &p, len);
 	while(len > 0)
 	{
 		n = len > 16384 ? 16384 : len;
-		rock_maskrom_write_arm32(ctx, addr, buf, n, rc4);
+		if(!rock_maskrom_write_arm32(ctx, addr, buf, n, rc4))
+			return 0;
 		addr += n;
 		buf += n;
 		len -= n;
 		progress_update(&p, n);
 	}
 	progress_stop(&p);
+	return 1;
 }
 
-void rock_maskrom_write_arm64_progress(struct xrock_ctx_t * ctx, uint32_t addr, void * buf, size_t len, int rc4)
+int rock_maskrom_write_arm64_progress(struct xrock_ctx_t * ctx, uint32_t addr, void * buf, size_t len, int rc4)
 {
 	struct progress_t p;
 	size_t n;
 
-	progress_start(&p, len);
+	rock_progress_start(ctx, &p, len);
 	while(len > 0)
 	{
 		n = len > 16384 ? 16384 : len;
-		rock_maskrom_write_arm64(ctx, addr, buf, n, rc4);
+		if(!rock_maskrom_write_arm64(ctx, addr, buf, n, rc4))
+			return 0;
 		addr += n;
 		buf += n;
 		len -= n;
 		progress_update(&p, n);
 	}
 	progress_stop(&p);
+	return 1;
 }
 
-void rock_maskrom_exec_arm32(struct xrock_ctx_t * ctx, uint32_t addr, int rc4)
+int rock_maskrom_exec_arm32(struct xrock_ctx_t * ctx, uint32_t addr, int rc4)
 {
-	static uint8_t payload[] = {
+	static const uint8_t payload[] = {
 		0x00, 0x00, 0xa0, 0xe3, 0x17, 0x0f, 0x08, 0xee, 0x15, 0x0f, 0x07, 0xee,
 		0xd5, 0x0f, 0x07, 0xee, 0x9a, 0x0f, 0x07, 0xee, 0x95, 0x0f, 0x07, 0xee,
-		0x06, 0x00, 0x00, 0xea, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x06, 0x00, 0x00, 0xea, 0x44, 0x33, 0x22, 0x11, 0x00, 0x00, 0x00, 0x00,
 		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
 		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x20, 0x00, 0x4f, 0xe2,
 		0x00, 0xd0, 0x80, 0xe5, 0x04, 0xe0, 0x80, 0xe5, 0x00, 0xe0, 0x0f, 0xe1,
@@ -582,14 +981,16 @@ void rock_maskrom_exec_arm32(struct xrock_ctx_t * ctx, uint32_t addr, int rc4)
 		0x0c, 0x10, 0x90, 0xe5, 0x10, 0x1f, 0x01, 0xee, 0x08, 0x10, 0x90, 0xe5,
 		0x01, 0xf0, 0x29, 0xe1, 0x1e, 0xff, 0x2f, 0xe1,
 	};
+	uint8_t buf[sizeof(payload)];
 
-	put_unaligned_le32(&payload[0x1c], addr);
-	rock_maskrom_upload_memory(ctx, 0x471, payload, sizeof(payload), rc4);
+	memcpy(buf, payload, sizeof(payload));
+	put_unaligned_le32(&buf[0x1c], addr);
+	return rock_maskrom_upload_memory(ctx, 0x471, buf, sizeof(buf), rc4);
 }
 
-void rock_maskrom_exec_arm64(struct xrock_ctx_t * ctx, uint32_t addr, int rc4)
+int rock_maskrom_exec_arm64(struct xrock_ctx_t * ctx, uint32_t addr, int rc4)
 {
-	static uint8_t payload[] = {
+	static const uint8_t payload[] = {
 		0xdf, 0x3f, 0x03, 0xd5, 0x9f, 0x3f, 0x03, 0xd5, 0x0a, 0x00, 0x00, 0x14,
 		0x44, 0x33, 0x22, 0x11, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
 		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
@@ -604,9 +1005,11 @@ void rock_maskrom_exec_arm64(struct xrock_ctx_t * ctx, uint32_t addr, int rc4)
 		0x01, 0x0c, 0x40, 0xb9, 0x3f, 0x00, 0x00, 0x91, 0x00, 0x00, 0x80, 0xd2,
 		0xc0, 0x03, 0x5f, 0xd6,
 	};
+	uint8_t buf[sizeof(payload)];
 
-	put_unaligned_le32(&payload[0x0c], addr);
-	rock_maskrom_upload_memory(ctx, 0x471, payload, sizeof(payload), rc4);
+	memcpy(buf, payload, sizeof(payload));
+	put_unaligned_le32(&buf[0x0c], addr);
+	return rock_maskrom_upload_memory(ctx, 0x471, buf, sizeof(buf), rc4);
 }
 
 enum {
@@ -689,9 +1092,8 @@ struct usb_response_t {
 	uint8_t status;				/* Response status */
 } __attribute__((packed));
 
-static inline void usb_bulk_send(libusb_device_handle * hdl, int ep, void * buf, size_t len)
+static inline int usb_bulk_send_status(libusb_device_handle * hdl, int ep, void * buf, size_t len, size_t max_chunk)
 {
-	size_t max_chunk = 128 * 1024;
 	size_t chunk;
 	int r, bytes;
 
@@ -701,15 +1103,17 @@ static inline void usb_bulk_send(libusb_device_handle * hdl, int ep, void * buf,
 		r = libusb_bulk_transfer(hdl, ep, (void *)buf, chunk, &bytes, 2000);
 		if(r != 0)
 		{
-			printf("usb bulk send error\r\n");
-			exit(-1);
+			if(r == LIBUSB_ERROR_PIPE)
+				libusb_clear_halt(hdl, ep);
+			return r;
 		}
 		len -= bytes;
 		buf += bytes;
 	}
+	return 0;
 }
 
-static inline void usb_bulk_recv(libusb_device_handle * hdl, int ep, void * buf, size_t len)
+static inline int usb_bulk_recv_status(libusb_device_handle * hdl, int ep, void * buf, size_t len)
 {
 	int r, bytes;
 
@@ -718,22 +1122,65 @@ static inline void usb_bulk_recv(libusb_device_handle * hdl, int ep, void * buf,
 		r = libusb_bulk_transfer(hdl, ep, (void *)buf, len, &bytes, 2000);
 		if(r != 0)
 		{
-			printf("usb bulk recv error\r\n");
-			exit(-1);
+			if(r == LIBUSB_ERROR_PIPE)
+				libusb_clear_halt(hdl, ep);
+			return r;
 		}
 		len -= bytes;
 		buf += bytes;
 	}
+	return 0;
 }
 
-static inline uint32_t make_tag(void)
+static inline int usb_bulk_send(struct xrock_ctx_t * ctx, int ep, void * buf, size_t len)
 {
-	uint32_t tag = 0;
-	int i;
+	int r = usb_bulk_send_status(ctx->hdl, ep, buf, len, ctx->usb3 ? (1024 * 1024) : (128 * 1024));
 
-	for(i = 0; i < 4; i++)
-		tag = (tag << 8) | (rand() & 0xff);
-	return tag;
+	if(r != 0)
+	{
+		ctx->error = XROCK_ERROR_USB;
+		ctx->usb_error = r;
+		return 0;
+	}
+	return 1;
+}
+
+static inline int usb_bulk_recv(struct xrock_ctx_t * ctx, int ep, void * buf, size_t len)
+{
+	int r = usb_bulk_recv_status(ctx->hdl, ep, buf, len);
+
+	if(r != 0)
+	{
+		ctx->error = XROCK_ERROR_USB;
+		ctx->usb_error = r;
+		return 0;
+	}
+	return 1;
+}
+
+static inline int usb_response_check(struct xrock_ctx_t * ctx, struct usb_request_t * req, struct usb_response_t * res)
+{
+	if((get_unaligned_be32(&res->signature[0]) != USB_RESPONSE_SIGN) || (memcmp(&res->tag[0], &req->tag[0], 4) != 0))
+	{
+		ctx->error = XROCK_ERROR_PROTOCOL;
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Per context xorshift32 tag source, every device thread owns its context so
+ * no locking is needed.
+ */
+static inline uint32_t make_tag(struct xrock_ctx_t * ctx)
+{
+	uint32_t x = ctx->tag;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	ctx->tag = x;
+	return x;
 }
 
 int rock_ready(struct xrock_ctx_t * ctx)
@@ -743,16 +1190,16 @@ int rock_ready(struct xrock_ctx_t * ctx)
 
 	memset(&req, 0, sizeof(struct usb_request_t));
 	put_unaligned_be32(&req.signature[0], USB_REQUEST_SIGN);
-	put_unaligned_be32(&req.tag[0], make_tag());
+	put_unaligned_be32(&req.tag[0], make_tag(ctx));
 	put_unaligned_le32(&req.length[0], 0);
 	req.flag = USB_DIRECTION_IN;
 	req.cmdlen = 6;
 	req.cmd.opcode = OPCODE_TEST_UNIT_READY;
 	req.cmd.subcode = 0;
 
-	usb_bulk_send(ctx->hdl, ctx->epout, &req, sizeof(struct usb_request_t));
-	usb_bulk_recv(ctx->hdl, ctx->epin, &res, sizeof(struct usb_response_t));
-	if((get_unaligned_be32(&res.signature[0]) != USB_RESPONSE_SIGN) || (memcmp(&res.tag[0], &req.tag[0], 4) != 0))
+	if(!usb_bulk_send(ctx, ctx->epout, &req, sizeof(struct usb_request_t))
+		|| !usb_bulk_recv(ctx, ctx->epin, &res, sizeof(struct usb_response_t))
+		|| !usb_response_check(ctx, &req, &res))
 		return 0;
 	return 1;
 }
@@ -764,16 +1211,16 @@ int rock_version(struct xrock_ctx_t * ctx, uint8_t * buf)
 
 	memset(&req, 0, sizeof(struct usb_request_t));
 	put_unaligned_be32(&req.signature[0], USB_REQUEST_SIGN);
-	put_unaligned_be32(&req.tag[0], make_tag());
+	put_unaligned_be32(&req.tag[0], make_tag(ctx));
 	put_unaligned_le32(&req.length[0], 16);
 	req.flag = USB_DIRECTION_IN;
 	req.cmdlen = 6;
 	req.cmd.opcode = OPCODE_READ_CHIP_INFO;
 
-	usb_bulk_send(ctx->hdl, ctx->epout, &req, sizeof(struct usb_request_t));
-	usb_bulk_recv(ctx->hdl, ctx->epin, buf, 16);
-	usb_bulk_recv(ctx->hdl, ctx->epin, &res, sizeof(struct usb_response_t));
-	if((get_unaligned_be32(&res.signature[0]) != USB_RESPONSE_SIGN) || (memcmp(&res.tag[0], &req.tag[0], 4) != 0))
+	if(!usb_bulk_send(ctx, ctx->epout, &req, sizeof(struct usb_request_t))
+		|| !usb_bulk_recv(ctx, ctx->epin, buf, 16)
+		|| !usb_bulk_recv(ctx, ctx->epin, &res, sizeof(struct usb_response_t))
+		|| !usb_response_check(ctx, &req, &res))
 		return 0;
 	return 1;
 }
@@ -785,15 +1232,15 @@ int rock_capability(struct xrock_ctx_t * ctx, uint8_t * buf)
 
 	memset(&req, 0, sizeof(struct usb_request_t));
 	put_unaligned_be32(&req.signature[0], USB_REQUEST_SIGN);
-	put_unaligned_be32(&req.tag[0], make_tag());
+	put_unaligned_be32(&req.tag[0], make_tag(ctx));
 	put_unaligned_le32(&req.length[0], 8);
 	req.flag = USB_DIRECTION_IN;
 	req.cmdlen = 6;
 	req.cmd.opcode = OPCODE_READ_CAPABILITY;
-	usb_bulk_send(ctx->hdl, ctx->epout, &req, sizeof(struct usb_request_t));
-	usb_bulk_recv(ctx->hdl, ctx->epin, buf, 8);
-	usb_bulk_recv(ctx->hdl, ctx->epin, &res, sizeof(struct usb_response_t));
-	if((get_unaligned_be32(&res.signature[0]) != USB_RESPONSE_SIGN) || (memcmp(&res.tag[0], &req.tag[0], 4) != 0))
+	if(!usb_bulk_send(ctx, ctx->epout, &req, sizeof(struct usb_request_t))
+		|| !usb_bulk_recv(ctx, ctx->epin, buf, 8)
+		|| !usb_bulk_recv(ctx, ctx->epin, &res, sizeof(struct usb_response_t))
+		|| !usb_response_check(ctx, &req, &res))
 		return 0;
 	return 1;
 }
@@ -846,16 +1293,16 @@ int rock_reset(struct xrock_ctx_t * ctx, int maskrom)
 
 	memset(&req, 0, sizeof(struct usb_request_t));
 	put_unaligned_be32(&req.signature[0], USB_REQUEST_SIGN);
-	put_unaligned_be32(&req.tag[0], make_tag());
+	put_unaligned_be32(&req.tag[0], make_tag(ctx));
 	put_unaligned_le32(&req.length[0], 0);
 	req.flag = USB_DIRECTION_OUT;
 	req.cmdlen = 6;
 	req.cmd.opcode = OPCODE_RESET_DEVICE;
 	req.cmd.subcode = maskrom ? 0x03 : 0x00;
 
-	usb_bulk_send(ctx->hdl, ctx->epout, &req, sizeof(struct usb_request_t));
-	usb_bulk_recv(ctx->hdl, ctx->epin, &res, sizeof(struct usb_response_t));
-	if((get_unaligned_be32(&res.signature[0]) != USB_RESPONSE_SIGN) || (memcmp(&res.tag[0], &req.tag[0], 4) != 0))
+	if(!usb_bulk_send(ctx, ctx->epout, &req, sizeof(struct usb_request_t))
+		|| !usb_bulk_recv(ctx, ctx->epin, &res, sizeof(struct usb_response_t))
+		|| !usb_response_check(ctx, &req, &res))
 		return 0;
 	return 1;
 }
@@ -867,7 +1314,7 @@ int rock_exec(struct xrock_ctx_t * ctx, uint32_t addr, uint32_t dtb)
 
 	memset(&req, 0, sizeof(struct usb_request_t));
 	put_unaligned_be32(&req.signature[0], USB_REQUEST_SIGN);
-	put_unaligned_be32(&req.tag[0], make_tag());
+	put_unaligned_be32(&req.tag[0], make_tag(ctx));
 	put_unaligned_le32(&req.length[0], 0);
 	req.flag = USB_DIRECTION_OUT;
 	req.cmdlen = 10;
@@ -876,9 +1323,9 @@ int rock_exec(struct xrock_ctx_t * ctx, uint32_t addr, uint32_t dtb)
 	put_unaligned_be32(&req.cmd.address[0], (uint32_t)addr);
 	put_unaligned_be32(&req.cmd.size[0], (uint32_t)dtb);
 
-	usb_bulk_send(ctx->hdl, ctx->epout, &req, sizeof(struct usb_request_t));
-	usb_bulk_recv(ctx->hdl, ctx->epin, &res, sizeof(struct usb_response_t));
-	if((get_unaligned_be32(&res.signature[0]) != USB_RESPONSE_SIGN) || (memcmp(&res.tag[0], &req.tag[0], 4) != 0))
+	if(!usb_bulk_send(ctx, ctx->epout, &req, sizeof(struct usb_request_t))
+		|| !usb_bulk_recv(ctx, ctx->epin, &res, sizeof(struct usb_response_t))
+		|| !usb_response_check(ctx, &req, &res))
 		return 0;
 	return 1;
 }
@@ -890,7 +1337,7 @@ static inline int rock_read_raw(struct xrock_ctx_t * ctx, uint32_t addr, void *
 
 	memset(&req, 0, sizeof(struct usb_request_t));
 	put_unaligned_be32(&req.signature[0], USB_REQUEST_SIGN);
-	put_unaligned_be32(&req.tag[0], make_tag());
+	put_unaligned_be32(&req.tag[0], make_tag(ctx));
 	put_unaligned_le32(&req.length[0], 0);
 	req.flag = USB_DIRECTION_IN;
 	req.cmdlen = 10;
@@ -898,10 +1345,10 @@ static inline int rock_read_raw(struct xrock_ctx_t * ctx, uint32_t addr, void *
 	put_unaligned_be32(&req.cmd.address[0], addr);
 	put_unaligned_be16(&req.cmd.size[0], (uint16_t)len);
 
-	usb_bulk_send(ctx->hdl, ctx->epout, &req, sizeof(struct usb_request_t));
-	usb_bulk_recv(ctx->hdl, ctx->epin, buf, len);
-	usb_bulk_recv(ctx->hdl, ctx->epin, &res, sizeof(struct usb_response_t));
-	if((get_unaligned_be32(&res.signature[0]) != USB_RESPONSE_SIGN) || (memcmp(&res.tag[0], &req.tag[0], 4) != 0))
+	if(!usb_bulk_send(ctx, ctx->epout, &req, sizeof(struct usb_request_t))
+		|| !usb_bulk_recv(ctx, ctx->epin, buf, len)
+		|| !usb_bulk_recv(ctx, ctx->epin, &res, sizeof(struct usb_response_t))
+		|| !usb_response_check(ctx, &req, &res))
 		return 0;
 	return 1;
 }
@@ -913,7 +1360,7 @@ static inline int rock_write_raw(struct xrock_ctx_t * ctx, uint32_t addr, void *
 
 	memset(&req, 0, sizeof(struct usb_request_t));
 	put_unaligned_be32(&req.signature[0], USB_REQUEST_SIGN);
-	put_unaligned_be32(&req.tag[0], make_tag());
+	put_unaligned_be32(&req.tag[0], make_tag(ctx));
 	put_unaligned_le32(&req.length[0], 0);
 	req.flag = USB_DIRECTION_OUT;
 	req.cmdlen = 10;
@@ -921,10 +1368,10 @@ static inline int rock_write_raw(struct xrock_ctx_t * ctx, uint32_t addr, void *
 	put_unaligned_be32(&req.cmd.address[0], addr);
 	put_unaligned_be16(&req.cmd.size[0], (uint16_t)len);
 
-	usb_bulk_send(ctx->hdl, ctx->epout, &req, sizeof(struct usb_request_t));
-	usb_bulk_send(ctx->hdl, ctx->epout, buf, len);
-	usb_bulk_recv(ctx->hdl, ctx->epin, &res, sizeof(struct usb_response_t));
-	if((get_unaligned_be32(&res.signature[0]) != USB_RESPONSE_SIGN) || (memcmp(&res.tag[0], &req.tag[0], 4) != 0))
+	if(!usb_bulk_send(ctx, ctx->epout, &req, sizeof(struct usb_request_t))
+		|| !usb_bulk_send(ctx, ctx->epout, buf, len)
+		|| !usb_bulk_recv(ctx, ctx->epin, &res, sizeof(struct usb_response_t))
+		|| !usb_response_check(ctx, &req, &res))
 		return 0;
 	return 1;
 }
@@ -966,7 +1413,7 @@ int rock_read_progress(struct xrock_ctx_t * ctx, uint32_t addr, void * buf, size
 	struct progress_t p;
 	size_t n;
 
-	progress_start(&p, len);
+	rock_progress_start(ctx, &p, len);
 	while(len > 0)
 	{
 		n = len > 16384 ? 16384 : len;
@@ -986,7 +1433,7 @@ int rock_write_progress(struct xrock_ctx_t * ctx, uint32_t addr, void * buf, siz
 	struct progress_t p;
 	size_t n;
 
-	progress_start(&p, len);
+	rock_progress_start(ctx, &p, len);
 	while(len > 0)
 	{
 		n = len > 16384 ? 16384 : len;
@@ -1001,6 +1448,212 @@ int rock_write_progress(struct xrock_ctx_t * ctx, uint32_t addr, void * buf, siz
 	return 1;
 }
 
+/*
+ * Call a payload in loader mode, it is written to the scratch address and
+ * leaves its result in memory, which is read back after the call returns
+ */
+static int rock_payload_call(struct xrock_ctx_t * ctx, uint32_t scratch, void * buf, size_t len, uint32_t offset, void * res, size_t rlen)
+{
+	if(!rock_write(ctx, scratch, buf, len) || !rock_exec(ctx, scratch, 0))
+		return 0;
+	return rock_read(ctx, scratch + offset, res, rlen);
+}
+
+int rock_crc32_arm32(struct xrock_ctx_t * ctx, uint32_t scratch, uint32_t addr, uint32_t len, uint32_t * crc)
+{
+	static const uint8_t payload[] = {
+		0x00, 0x00, 0xa0, 0xe3, 0x17, 0x0f, 0x08, 0xee, 0x15, 0x0f, 0x07, 0xee,
+		0xd5, 0x0f, 0x07, 0xee, 0x9a, 0x0f, 0x07, 0xee, 0x95, 0x0f, 0x07, 0xee,
+		0x02, 0x00, 0x00, 0xea, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x70, 0x40, 0x2d, 0xe9, 0x68, 0xc0, 0x9f, 0xe5,
+		0x68, 0x40, 0x8f, 0xe2, 0x00, 0x50, 0xa0, 0xe3, 0x05, 0x0c, 0xa0, 0xe1,
+		0x08, 0x60, 0xa0, 0xe3, 0x80, 0x00, 0xb0, 0xe1, 0x0c, 0x00, 0x20, 0x20,
+		0x01, 0x60, 0x56, 0xe2, 0xfb, 0xff, 0xff, 0x1a, 0x05, 0x01, 0x84, 0xe7,
+		0x01, 0x50, 0x85, 0xe2, 0x01, 0x0c, 0x55, 0xe3, 0xf5, 0xff, 0xff, 0x1a,
+		0x4c, 0x10, 0x1f, 0xe5, 0x4c, 0x20, 0x1f, 0xe5, 0x00, 0x00, 0xa0, 0xe3,
+		0x00, 0x00, 0x52, 0xe3, 0x05, 0x00, 0x00, 0x0a, 0x01, 0x30, 0xd1, 0xe4,
+		0x20, 0x3c, 0x23, 0xe0, 0x03, 0x31, 0x94, 0xe7, 0x00, 0x04, 0x23, 0xe0,
+		0x01, 0x20, 0x52, 0xe2, 0xf9, 0xff, 0xff, 0x1a, 0x70, 0x10, 0x4f, 0xe2,
+		0x00, 0x00, 0x81, 0xe5, 0x00, 0x00, 0xa0, 0xe3, 0x70, 0x80, 0xbd, 0xe8,
+		0xb7, 0x0d, 0xc1, 0x04,
+	};
+	uint8_t buf[sizeof(payload)];
+	uint8_t res[4];
+
+	memcpy(buf, payload, sizeof(payload));
+	put_unaligned_le32(&buf[0x1c], addr);
+	put_unaligned_le32(&buf[0x20], len);
+	if(!rock_payload_call(ctx, scratch, buf, sizeof(buf), 0x24, res, sizeof(res)))
+		return 0;
+	*crc = get_unaligned_le32(res);
+	return 1;
+}
+
+int rock_crc32_arm64(struct xrock_ctx_t * ctx, uint32_t scratch, uint32_t addr, uint32_t len, uint32_t * crc)
+{
+	static const uint8_t payload[] = {
+		0xdf, 0x3f, 0x03, 0xd5, 0x9f, 0x3f, 0x03, 0xd5, 0x04, 0x00, 0x00, 0x14,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0xe4, 0xb6, 0x81, 0x52, 0x24, 0x98, 0xa0, 0x72, 0x88, 0x03, 0x00, 0x10,
+		0x06, 0x00, 0x80, 0x52, 0xc0, 0x1c, 0x08, 0x53, 0x05, 0x01, 0x80, 0x52,
+		0x1f, 0x00, 0x01, 0x72, 0x00, 0x78, 0x1f, 0x53, 0x40, 0x00, 0x00, 0x54,
+		0x00, 0x00, 0x04, 0x4a, 0xa5, 0x04, 0x00, 0x71, 0x61, 0xff, 0xff, 0x54,
+		0x00, 0x59, 0x26, 0xb8, 0xc6, 0x04, 0x00, 0x11, 0xdf, 0x00, 0x04, 0x71,
+		0xa1, 0xfe, 0xff, 0x54, 0xa1, 0xfd, 0xff, 0x18, 0xa2, 0xfd, 0xff, 0x18,
+		0x00, 0x00, 0x80, 0x52, 0xe2, 0x00, 0x00, 0x34, 0x23, 0x14, 0x40, 0x38,
+		0x63, 0x60, 0x40, 0x4a, 0x03, 0x59, 0x63, 0xb8, 0x60, 0x20, 0x00, 0x4a,
+		0x42, 0x04, 0x00, 0x71, 0x61, 0xff, 0xff, 0x54, 0xa1, 0xfc, 0xff, 0x10,
+		0x20, 0x00, 0x00, 0xb9, 0x00, 0x00, 0x80, 0xd2, 0xc0, 0x03, 0x5f, 0xd6,
+	};
+	uint8_t buf[sizeof(payload)];
+	uint8_t res[4];
+
+	memcpy(buf, payload, sizeof(payload));
+	put_unaligned_le32(&buf[0x0c], addr);
+	put_unaligned_le32(&buf[0x10], len);
+	if(!rock_payload_call(ctx, scratch, buf, sizeof(buf), 0x14, res, sizeof(res)))
+		return 0;
+	*crc = get_unaligned_le32(res);
+	return 1;
+}
+
+/*
+ * Run the memtest payload block by block, so every call returns well within the
+ * usb timeout. The random pattern is seeded from the block address.
+ */
+static int rock_memtest_progress(struct xrock_ctx_t * ctx, const uint8_t * payload, size_t plen, uint32_t offset, uint32_t scratch, uint32_t addr, uint32_t len, uint32_t mode, uint32_t value, struct memtest_result_t * r)
+{
+	struct progress_t p;
+	uint8_t param[20];
+	uint8_t res[16];
+	uint32_t n;
+
+	memset(r, 0, sizeof(struct memtest_result_t));
+	if(!rock_write(ctx, scratch, (void *)payload, plen))
+		return 0;
+	len &= ~0x3;
+	rock_progress_start(ctx, &p, len);
+	while(len > 0)
+	{
+		n = len > (16 << 20) ? (16 << 20) : len;
+		put_unaligned_le32(&param[0], addr);
+		put_unaligned_le32(&param[4], n);
+		put_unaligned_le32(&param[8], mode);
+		put_unaligned_le32(&param[12], addr ^ 0x2545f491);
+		put_unaligned_le32(&param[16], value);
+		if(!rock_write(ctx, scratch + offset, param, sizeof(param))
+			|| !rock_exec(ctx, scratch, 0)
+			|| !rock_read(ctx, scratch + offset + sizeof(param), res, sizeof(res)))
+			return 0;
+		r->status = get_unaligned_le32(&res[0]);
+		r->address = get_unaligned_le32(&res[4]);
+		r->expect = get_unaligned_le32(&res[8]);
+		r->actual = get_unaligned_le32(&res[12]);
+		if(r->status)
+			break;
+		addr += n;
+		len -= n;
+		progress_update(&p, n);
+	}
+	progress_stop(&p);
+	return 1;
+}
+
+int rock_memtest_arm32_progress(struct xrock_ctx_t * ctx, uint32_t scratch, uint32_t addr, uint32_t len, uint32_t mode, uint32_t value, struct memtest_result_t * r)
+{
+	static const uint8_t payload[] = {
+		0x00, 0x00, 0xa0, 0xe3, 0x17, 0x0f, 0x08, 0xee, 0x15, 0x0f, 0x07, 0xee,
+		0xd5, 0x0f, 0x07, 0xee, 0x9a, 0x0f, 0x07, 0xee, 0x95, 0x0f, 0x07, 0xee,
+		0x08, 0x00, 0x00, 0xea, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0xf0, 0x41, 0x2d, 0xe9, 0x30, 0x10, 0x1f, 0xe5,
+		0x30, 0x20, 0x1f, 0xe5, 0x22, 0x21, 0xa0, 0xe1, 0x34, 0x80, 0x1f, 0xe5,
+		0x00, 0x00, 0x52, 0xe3, 0x59, 0x00, 0x00, 0x0a, 0x01, 0x00, 0x18, 0xe3,
+		0x15, 0x00, 0x00, 0x0a, 0x01, 0xc0, 0xa0, 0xe3, 0x01, 0x30, 0xa0, 0xe1,
+		0x02, 0x60, 0xa0, 0xe1, 0x23, 0x01, 0xa0, 0xe1, 0x1f, 0x00, 0x00, 0xe2,
+		0x01, 0x40, 0xa0, 0xe3, 0x14, 0x40, 0xa0, 0xe1, 0x04, 0x40, 0x83, 0xe4,
+		0x01, 0x60, 0x56, 0xe2, 0xf8, 0xff, 0xff, 0x1a, 0x01, 0x30, 0xa0, 0xe1,
+		0x02, 0x60, 0xa0, 0xe1, 0x23, 0x01, 0xa0, 0xe1, 0x1f, 0x00, 0x00, 0xe2,
+		0x01, 0x40, 0xa0, 0xe3, 0x14, 0x40, 0xa0, 0xe1, 0x00, 0x50, 0x93, 0xe5,
+		0x04, 0x00, 0x55, 0xe1, 0x48, 0x00, 0x00, 0x1a, 0x04, 0x30, 0x83, 0xe2,
+		0x01, 0x60, 0x56, 0xe2, 0xf5, 0xff, 0xff, 0x1a, 0x02, 0x00, 0x18, 0xe3,
+		0x1e, 0x00, 0x00, 0x0a, 0x02, 0xc0, 0xa0, 0xe3, 0x01, 0x30, 0xa0, 0xe1,
+		0x02, 0x60, 0xa0, 0xe1, 0x03, 0x40, 0xa0, 0xe1, 0x04, 0x40, 0x83, 0xe4,
+		0x01, 0x60, 0x56, 0xe2, 0xfb, 0xff, 0xff, 0x1a, 0x01, 0x30, 0xa0, 0xe1,
+		0x02, 0x60, 0xa0, 0xe1, 0x03, 0x40, 0xa0, 0xe1, 0x00, 0x50, 0x93, 0xe5,
+		0x04, 0x00, 0x55, 0xe1, 0x36, 0x00, 0x00, 0x1a, 0x04, 0x30, 0x83, 0xe2,
+		0x01, 0x60, 0x56, 0xe2, 0xf8, 0xff, 0xff, 0x1a, 0x01, 0x30, 0xa0, 0xe1,
+		0x02, 0x60, 0xa0, 0xe1, 0x03, 0x40, 0xe0, 0xe1, 0x04, 0x40, 0x83, 0xe4,
+		0x01, 0x60, 0x56, 0xe2, 0xfb, 0xff, 0xff, 0x1a, 0x01, 0x30, 0xa0, 0xe1,
+		0x02, 0x60, 0xa0, 0xe1, 0x03, 0x40, 0xe0, 0xe1, 0x00, 0x50, 0x93, 0xe5,
+		0x04, 0x00, 0x55, 0xe1, 0x27, 0x00, 0x00, 0x1a, 0x04, 0x30, 0x83, 0xe2,
+		0x01, 0x60, 0x56, 0xe2, 0xf8, 0xff, 0xff, 0x1a, 0x04, 0x00, 0x18, 0xe3,
+		0x16, 0x00, 0x00, 0x0a, 0x04, 0xc0, 0xa0, 0xe3, 0x2c, 0x71, 0x1f, 0xe5,
+		0x01, 0x30, 0xa0, 0xe1, 0x02, 0x60, 0xa0, 0xe1, 0x87, 0x76, 0x27, 0xe0,
+		0xa7, 0x78, 0x27, 0xe0, 0x87, 0x72, 0x27, 0xe0, 0x04, 0x70, 0x83, 0xe4,
+		0x01, 0x60, 0x56, 0xe2, 0xf9, 0xff, 0xff, 0x1a, 0x50, 0x71, 0x1f, 0xe5,
+		0x01, 0x30, 0xa0, 0xe1, 0x02, 0x60, 0xa0, 0xe1, 0x87, 0x76, 0x27, 0xe0,
+		0xa7, 0x78, 0x27, 0xe0, 0x87, 0x72, 0x27, 0xe0, 0x07, 0x40, 0xa0, 0xe1,
+		0x00, 0x50, 0x93, 0xe5, 0x04, 0x00, 0x55, 0xe1, 0x0e, 0x00, 0x00, 0x1a,
+		0x04, 0x30, 0x83, 0xe2, 0x01, 0x60, 0x56, 0xe2, 0xf5, 0xff, 0xff, 0x1a,
+		0x08, 0x00, 0x18, 0xe3, 0x05, 0x00, 0x00, 0x0a, 0x88, 0x41, 0x1f, 0xe5,
+		0x01, 0x30, 0xa0, 0xe1, 0x02, 0x60, 0xa0, 0xe1, 0x04, 0x40, 0x83, 0xe4,
+		0x01, 0x60, 0x56, 0xe2, 0xfc, 0xff, 0xff, 0x1a, 0x00, 0xc0, 0xa0, 0xe3,
+		0x00, 0x30, 0xa0, 0xe3, 0x00, 0x40, 0xa0, 0xe3, 0x00, 0x50, 0xa0, 0xe3,
+		0x6b, 0x0f, 0x4f, 0xe2, 0x00, 0xc0, 0x80, 0xe5, 0x04, 0x30, 0x80, 0xe5,
+		0x08, 0x40, 0x80, 0xe5, 0x0c, 0x50, 0x80, 0xe5, 0x00, 0x00, 0xa0, 0xe3,
+		0xf0, 0x81, 0xbd, 0xe8,
+	};
+
+	return rock_memtest_progress(ctx, payload, sizeof(payload), 0x1c, scratch, addr, len, mode, value, r);
+}
+
+int rock_memtest_arm64_progress(struct xrock_ctx_t * ctx, uint32_t scratch, uint32_t addr, uint32_t len, uint32_t mode, uint32_t value, struct memtest_result_t * r)
+{
+	static const uint8_t payload[] = {
+		0xdf, 0x3f, 0x03, 0xd5, 0x9f, 0x3f, 0x03, 0xd5, 0x0a, 0x00, 0x00, 0x14,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0xe1, 0xfe, 0xff, 0x18, 0xe2, 0xfe, 0xff, 0x18, 0x42, 0x7c, 0x02, 0x53,
+		0xc8, 0xfe, 0xff, 0x18, 0x82, 0x0a, 0x00, 0x34, 0x88, 0x02, 0x00, 0x36,
+		0x2a, 0x00, 0x80, 0x52, 0x2b, 0x00, 0x80, 0x52, 0xe3, 0x03, 0x01, 0xaa,
+		0xe6, 0x03, 0x02, 0x2a, 0x69, 0x7c, 0x02, 0x53, 0x64, 0x21, 0xc9, 0x1a,
+		0x64, 0x44, 0x00, 0xb8, 0xc6, 0x04, 0x00, 0x71, 0x81, 0xff, 0xff, 0x54,
+		0xe3, 0x03, 0x01, 0xaa, 0xe6, 0x03, 0x02, 0x2a, 0x69, 0x7c, 0x02, 0x53,
+		0x64, 0x21, 0xc9, 0x1a, 0x65, 0x00, 0x40, 0xb9, 0xbf, 0x00, 0x04, 0x6b,
+		0xe1, 0x08, 0x00, 0x54, 0x63, 0x10, 0x00, 0x91, 0xc6, 0x04, 0x00, 0x71,
+		0x21, 0xff, 0xff, 0x54, 0x08, 0x04, 0x08, 0x36, 0x4a, 0x00, 0x80, 0x52,
+		0xe3, 0x03, 0x01, 0xaa, 0xe6, 0x03, 0x02, 0x2a, 0xe4, 0x03, 0x03, 0x2a,
+		0x64, 0x44, 0x00, 0xb8, 0xc6, 0x04, 0x00, 0x71, 0xa1, 0xff, 0xff, 0x54,
+		0xe3, 0x03, 0x01, 0xaa, 0xe6, 0x03, 0x02, 0x2a, 0xe4, 0x03, 0x03, 0x2a,
+		0x65, 0x00, 0x40, 0xb9, 0xbf, 0x00, 0x04, 0x6b, 0xc1, 0x06, 0x00, 0x54,
+		0x63, 0x10, 0x00, 0x91, 0xc6, 0x04, 0x00, 0x71, 0x41, 0xff, 0xff, 0x54,
+		0xe3, 0x03, 0x01, 0xaa, 0xe6, 0x03, 0x02, 0x2a, 0xe4, 0x03, 0x23, 0x2a,
+		0x64, 0x44, 0x00, 0xb8, 0xc6, 0x04, 0x00, 0x71, 0xa1, 0xff, 0xff, 0x54,
+		0xe3, 0x03, 0x01, 0xaa, 0xe6, 0x03, 0x02, 0x2a, 0xe4, 0x03, 0x23, 0x2a,
+		0x65, 0x00, 0x40, 0xb9, 0xbf, 0x00, 0x04, 0x6b, 0xe1, 0x04, 0x00, 0x54,
+		0x63, 0x10, 0x00, 0x91, 0xc6, 0x04, 0x00, 0x71, 0x41, 0xff, 0xff, 0x54,
+		0x08, 0x03, 0x10, 0x36, 0x8a, 0x00, 0x80, 0x52, 0xe7, 0xf7, 0xff, 0x18,
+		0xe3, 0x03, 0x01, 0xaa, 0xe6, 0x03, 0x02, 0x2a, 0xe7, 0x34, 0x07, 0x4a,
+		0xe7, 0x44, 0x47, 0x4a, 0xe7, 0x14, 0x07, 0x4a, 0x67, 0x44, 0x00, 0xb8,
+		0xc6, 0x04, 0x00, 0x71, 0x61, 0xff, 0xff, 0x54, 0xc7, 0xf6, 0xff, 0x18,
+		0xe3, 0x03, 0x01, 0xaa, 0xe6, 0x03, 0x02, 0x2a, 0xe7, 0x34, 0x07, 0x4a,
+		0xe7, 0x44, 0x47, 0x4a, 0xe7, 0x14, 0x07, 0x4a, 0xe4, 0x03, 0x07, 0x2a,
+		0x65, 0x00, 0x40, 0xb9, 0xbf, 0x00, 0x04, 0x6b, 0xe1, 0x01, 0x00, 0x54,
+		0x63, 0x10, 0x00, 0x91, 0xc6, 0x04, 0x00, 0x71, 0xe1, 0xfe, 0xff, 0x54,
+		0xe8, 0x00, 0x18, 0x36, 0x24, 0xf5, 0xff, 0x18, 0xe3, 0x03, 0x01, 0xaa,
+		0xe6, 0x03, 0x02, 0x2a, 0x64, 0x44, 0x00, 0xb8, 0xc6, 0x04, 0x00, 0x71,
+		0xc1, 0xff, 0xff, 0x54, 0x0a, 0x00, 0x80, 0x52, 0x03, 0x00, 0x80, 0x52,
+		0x04, 0x00, 0x80, 0x52, 0x05, 0x00, 0x80, 0x52, 0x00, 0xf4, 0xff, 0x10,
+		0x0a, 0x00, 0x00, 0xb9, 0x03, 0x04, 0x00, 0xb9, 0x04, 0x08, 0x00, 0xb9,
+		0x05, 0x0c, 0x00, 0xb9, 0x00, 0x00, 0x80, 0xd2, 0xc0, 0x03, 0x5f, 0xd6,
+	};
+
+	return rock_memtest_progress(ctx, payload, sizeof(payload), 0x0c, scratch, addr, len, mode, value, r);
+}
+
 int rock_otp_read(struct xrock_ctx_t * ctx, uint8_t * buf, int len)
 {
 	struct usb_request_t req;
@@ -1008,15 +1661,15 @@ int rock_otp_read(struct xrock_ctx_t * ctx, uint8_t * buf, int len)
 
 	memset(&req, 0, sizeof(struct usb_request_t));
 	put_unaligned_be32(&req.signature[0], USB_REQUEST_SIGN);
-	put_unaligned_be32(&req.tag[0], make_tag());
+	put_unaligned_be32(&req.tag[0], make_tag(ctx));
 	put_unaligned_le32(&req.length[0], len);
 	req.flag = USB_DIRECTION_IN;
 	req.cmdlen = 6;
 	req.cmd.opcode = OPCODE_READ_OTP_CHIP;
-	usb_bulk_send(ctx->hdl, ctx->epout, &req, sizeof(struct usb_request_t));
-	usb_bulk_recv(ctx->hdl, ctx->epin, buf, len);
-	usb_bulk_recv(ctx->hdl, ctx->epin, &res, sizeof(struct usb_response_t));
-	if((get_unaligned_be32(&res.signature[0]) != USB_RESPONSE_SIGN) || (memcmp(&res.tag[0], &req.tag[0], 4) != 0))
+	if(!usb_bulk_send(ctx, ctx->epout, &req, sizeof(struct usb_request_t))
+		|| !usb_bulk_recv(ctx, ctx->epin, buf, len)
+		|| !usb_bulk_recv(ctx, ctx->epin, &res, sizeof(struct usb_response_t))
+		|| !usb_response_check(ctx, &req, &res))
 		return 0;
 	return 1;
 }
@@ -1066,7 +1719,7 @@ int rock_vs_read(struct xrock_ctx_t * ctx, int type, int index, uint8_t * buf, i
 
 	memset(&req, 0, sizeof(struct usb_request_t));
 	put_unaligned_be32(&req.signature[0], USB_REQUEST_SIGN);
-	put_unaligned_be32(&req.tag[0], make_tag());
+	put_unaligned_be32(&req.tag[0], make_tag(ctx));
 	put_unaligned_le32(&req.length[0], len);
 	req.flag = USB_DIRECTION_IN;
 	req.cmdlen = 10;
@@ -1076,10 +1729,10 @@ int rock_vs_read(struct xrock_ctx_t * ctx, int type, int index, uint8_t * buf, i
 	put_unaligned_be16(&req.cmd.address[2], type);
 	put_unaligned_be16(&req.cmd.size[0], len);
 
-	usb_bulk_send(ctx->hdl, ctx->epout, &req, sizeof(struct usb_request_t));
-	usb_bulk_recv(ctx->hdl, ctx->epin, buf, len);
-	usb_bulk_recv(ctx->hdl, ctx->epin, &res, sizeof(struct usb_response_t));
-	if((get_unaligned_be32(&res.signature[0]) != USB_RESPONSE_SIGN) || (memcmp(&res.tag[0], &req.tag[0], 4) != 0))
+	if(!usb_bulk_send(ctx, ctx->epout, &req, sizeof(struct usb_request_t))
+		|| !usb_bulk_recv(ctx, ctx->epin, buf, len)
+		|| !usb_bulk_recv(ctx, ctx->epin, &res, sizeof(struct usb_response_t))
+		|| !usb_response_check(ctx, &req, &res))
 		return 0;
 	return 1;
 }
@@ -1091,7 +1744,7 @@ int rock_vs_write(struct xrock_ctx_t * ctx, int type, int index, uint8_t * buf,
 
 	memset(&req, 0, sizeof(struct usb_request_t));
 	put_unaligned_be32(&req.signature[0], USB_REQUEST_SIGN);
-	put_unaligned_be32(&req.tag[0], make_tag());
+	put_unaligned_be32(&req.tag[0], make_tag(ctx));
 	put_unaligned_le32(&req.length[0], len);
 	req.flag = USB_DIRECTION_OUT;
 	req.cmdlen = 10;
@@ -1101,10 +1754,10 @@ int rock_vs_write(struct xrock_ctx_t * ctx, int type, int index, uint8_t * buf,
 	put_unaligned_be16(&req.cmd.address[2], type);
 	put_unaligned_be16(&req.cmd.size[0], len);
 
-	usb_bulk_send(ctx->hdl, ctx->epout, &req, sizeof(struct usb_request_t));
-	usb_bulk_send(ctx->hdl, ctx->epout, buf, len);
-	usb_bulk_recv(ctx->hdl, ctx->epin, &res, sizeof(struct usb_response_t));
-	if((get_unaligned_be32(&res.signature[0]) != USB_RESPONSE_SIGN) || (memcmp(&res.tag[0], &req.tag[0], 4) != 0))
+	if(!usb_bulk_send(ctx, ctx->epout, &req, sizeof(struct usb_request_t))
+		|| !usb_bulk_send(ctx, ctx->epout, buf, len)
+		|| !usb_bulk_recv(ctx, ctx->epin, &res, sizeof(struct usb_response_t))
+		|| !usb_response_check(ctx, &req, &res))
 		return 0;
 	return 1;
 }
@@ -1117,16 +1770,16 @@ enum storage_type_t rock_storage_read(struct xrock_ctx_t * ctx)
 
 	memset(&req, 0, sizeof(struct usb_request_t));
 	put_unaligned_be32(&req.signature[0], USB_REQUEST_SIGN);
-	put_unaligned_be32(&req.tag[0], make_tag());
+	put_unaligned_be32(&req.tag[0], make_tag(ctx));
 	put_unaligned_le32(&req.length[0], 4);
 	req.flag = USB_DIRECTION_IN;
 	req.cmdlen = 6;
 	req.cmd.opcode = OPCODE_READ_STORAGE;
 
-	usb_bulk_send(ctx->hdl, ctx->epout, &req, sizeof(struct usb_request_t));
-	usb_bulk_recv(ctx->hdl, ctx->epin, buf, 4);
-	usb_bulk_recv(ctx->hdl, ctx->epin, &res, sizeof(struct usb_response_t));
-	if((get_unaligned_be32(&res.signature[0]) != USB_RESPONSE_SIGN) || (memcmp(&res.tag[0], &req.tag[0], 4) != 0))
+	if(!usb_bulk_send(ctx, ctx->epout, &req, sizeof(struct usb_request_t))
+		|| !usb_bulk_recv(ctx, ctx->epin, buf, 4)
+		|| !usb_bulk_recv(ctx, ctx->epin, &res, sizeof(struct usb_response_t))
+		|| !usb_response_check(ctx, &req, &res))
 		return STORAGE_TYPE_UNKNOWN;
 	enum storage_type_t type = (enum storage_type_t)get_unaligned_le32(buf);
 	switch(type)
@@ -1156,7 +1809,7 @@ int rock_storage_switch(struct xrock_ctx_t * ctx, enum storage_type_t type)
 
 	memset(&req, 0, sizeof(struct usb_request_t));
 	put_unaligned_be32(&req.signature[0], USB_REQUEST_SIGN);
-	put_unaligned_be32(&req.tag[0], make_tag());
+	put_unaligned_be32(&req.tag[0], make_tag(ctx));
 	put_unaligned_le32(&req.length[0], 0);
 	req.flag = USB_DIRECTION_OUT;
 	req.cmdlen = 6;
@@ -1196,14 +1849,42 @@ int rock_storage_switch(struct xrock_ctx_t * ctx, enum storage_type_t type)
 	default:
 		break;
 	}
+	ctx->erase_block = 0;
 
-	usb_bulk_send(ctx->hdl, ctx->epout, &req, sizeof(struct usb_request_t));
-	usb_bulk_recv(ctx->hdl, ctx->epin, &res, sizeof(struct usb_response_t));
-	if((get_unaligned_be32(&res.signature[0]) != USB_RESPONSE_SIGN) || (memcmp(&res.tag[0], &req.tag[0], 4) != 0))
+	if(!usb_bulk_send(ctx, ctx->epout, &req, sizeof(struct usb_request_t))
+		|| !usb_bulk_recv(ctx, ctx->epin, &res, sizeof(struct usb_response_t))
+		|| !usb_response_check(ctx, &req, &res))
 		return 0;
 	return 1;
 }
 
+int rock_dram_valid(struct xrock_ctx_t * ctx, uint32_t addr, uint32_t len)
+{
+	uint64_t base, end;
+
+	if(!ctx->chip || (ctx->chip->dram_size == 0))
+		return 1;
+	base = ctx->chip->dram_base;
+	end = base + ctx->chip->dram_size;
+	return ((addr >= base) && ((uint64_t)addr + len <= end)) ? 1 : 0;
+}
+
+uint32_t rock_idb_sector(struct xrock_ctx_t * ctx, enum storage_type_t type)
+{
+	const struct chip_idb_t * idb = (ctx->chip && ctx->chip->idb) ? ctx->chip->idb : &idb_default;
+
+	switch(type)
+	{
+	case STORAGE_TYPE_SPINOR:
+		return idb->spinor;
+	case STORAGE_TYPE_SPINAND:
+		return idb->spinand;
+	default:
+		break;
+	}
+	return idb->block;
+}
+
 int rock_flash_detect(struct xrock_ctx_t * ctx, struct flash_info_t * info)
 {
 	struct usb_request_t req;
@@ -1211,27 +1892,27 @@ int rock_flash_detect(struct xrock_ctx_t * ctx, struct flash_info_t * info)
 
 	memset(&req, 0, sizeof(struct usb_request_t));
 	put_unaligned_be32(&req.signature[0], USB_REQUEST_SIGN);
-	put_unaligned_be32(&req.tag[0], make_tag());
+	put_unaligned_be32(&req.tag[0], make_tag(ctx));
 	put_unaligned_le32(&req.length[0], 11);
 	req.flag = USB_DIRECTION_IN;
 	req.cmdlen = 6;
 	req.cmd.opcode = OPCODE_READ_FLASH_INFO;
-	usb_bulk_send(ctx->hdl, ctx->epout, &req, sizeof(struct usb_request_t));
-	usb_bulk_recv(ctx->hdl, ctx->epin, info, 11);
-	usb_bulk_recv(ctx->hdl, ctx->epin, &res, sizeof(struct usb_response_t));
-	if((get_unaligned_be32(&res.signature[0]) != USB_RESPONSE_SIGN) || (memcmp(&res.tag[0], &req.tag[0], 4) != 0))
+	if(!usb_bulk_send(ctx, ctx->epout, &req, sizeof(struct usb_request_t))
+		|| !usb_bulk_recv(ctx, ctx->epin, info, 11)
+		|| !usb_bulk_recv(ctx, ctx->epin, &res, sizeof(struct usb_response_t))
+		|| !usb_response_check(ctx, &req, &res))
 		return 0;
 	memset(&req, 0, sizeof(struct usb_request_t));
 	put_unaligned_be32(&req.signature[0], USB_REQUEST_SIGN);
-	put_unaligned_be32(&req.tag[0], make_tag());
+	put_unaligned_be32(&req.tag[0], make_tag(ctx));
 	put_unaligned_le32(&req.length[0], 5);
 	req.flag = USB_DIRECTION_IN;
 	req.cmdlen = 6;
 	req.cmd.opcode = OPCODE_READ_FLASH_ID;
-	usb_bulk_send(ctx->hdl, ctx->epout, &req, sizeof(struct usb_request_t));
-	usb_bulk_recv(ctx->hdl, ctx->epin, &info->id[0], 5);
-	usb_bulk_recv(ctx->hdl, ctx->epin, &res, sizeof(struct usb_response_t));
-	if((get_unaligned_be32(&res.signature[0]) != USB_RESPONSE_SIGN) || (memcmp(&res.tag[0], &req.tag[0], 4) != 0))
+	if(!usb_bulk_send(ctx, ctx->epout, &req, sizeof(struct usb_request_t))
+		|| !usb_bulk_recv(ctx, ctx->epin, &info->id[0], 5)
+		|| !usb_bulk_recv(ctx, ctx->epin, &res, sizeof(struct usb_response_t))
+		|| !usb_response_check(ctx, &req, &res))
 		return 0;
 	return 1;
 }
@@ -1243,7 +1924,7 @@ static inline int rock_flash_erase_lba_raw(struct xrock_ctx_t * ctx, uint32_t se
 
 	memset(&req, 0, sizeof(struct usb_request_t));
 	put_unaligned_be32(&req.signature[0], USB_REQUEST_SIGN);
-	put_unaligned_be32(&req.tag[0], make_tag());
+	put_unaligned_be32(&req.tag[0], make_tag(ctx));
 	put_unaligned_le32(&req.length[0], 0);
 	req.flag = USB_DIRECTION_OUT;
 	req.cmdlen = 10;
@@ -1251,9 +1932,9 @@ static inline int rock_flash_erase_lba_raw(struct xrock_ctx_t * ctx, uint32_t se
 	put_unaligned_be32(&req.cmd.address[0], sec);
 	put_unaligned_be16(&req.cmd.size[0], (uint16_t)cnt);
 
-	usb_bulk_send(ctx->hdl, ctx->epout, &req, sizeof(struct usb_request_t));
-	usb_bulk_recv(ctx->hdl, ctx->epin, &res, sizeof(struct usb_response_t));
-	if((get_unaligned_be32(&res.signature[0]) != USB_RESPONSE_SIGN) || (memcmp(&res.tag[0], &req.tag[0], 4) != 0))
+	if(!usb_bulk_send(ctx, ctx->epout, &req, sizeof(struct usb_request_t))
+		|| !usb_bulk_recv(ctx, ctx->epin, &res, sizeof(struct usb_response_t))
+		|| !usb_response_check(ctx, &req, &res))
 		return 0;
 	return 1;
 }
@@ -1265,7 +1946,37 @@ static inline int rock_flash_read_lba_raw(struct xrock_ctx_t * ctx, uint32_t sec
 
 	memset(&req, 0, sizeof(struct usb_request_t));
 	put_unaligned_be32(&req.signature[0], USB_REQUEST_SIGN);
-	put_unaligned_be32(&req.tag[0], make_tag());
+	put_unaligned_be32(&req.tag[0], make_tag(ctx));
+	put_unaligned_le32(&req.length[0], cnt << 9);
+	req.flag = USB_DIRECTION_IN;
+	req.cmdlen = 10;
+	req.cmd.opcode = OPCODE_READ_LBA;
+	req.cmd.subcode = 0;
+	put_unaligned_be32(&req.cmd.address[0], sec);
+	put_unaligned_be16(&req.cmd.size[0], (uint16_t)cnt);
+
+	if(!usb_bulk_send(ctx, ctx->epout, &req, sizeof(struct usb_request_t))
+		|| !usb_bulk_recv(ctx, ctx->epin, buf, cnt << 9)
+		|| !usb_bulk_recv(ctx, ctx->epin, &res, sizeof(struct usb_response_t))
+		|| !usb_response_check(ctx, &req, &res))
+		return 0;
+	return 1;
+}
+
+/*
+ * Same as rock_flash_read_lba_raw, but a failed or stalled transfer is not fatal.
+ * The status stage is always drained so the next command stays in sync, and the
+ * command status in the response is checked too.
+ */
+int rock_flash_read_lba_try(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt, void * buf)
+{
+	struct usb_request_t req;
+	struct usb_response_t res;
+	int r;
+
+	memset(&req, 0, sizeof(struct usb_request_t));
+	put_unaligned_be32(&req.signature[0], USB_REQUEST_SIGN);
+	put_unaligned_be32(&req.tag[0], make_tag(ctx));
 	put_unaligned_le32(&req.length[0], cnt << 9);
 	req.flag = USB_DIRECTION_IN;
 	req.cmdlen = 10;
@@ -1274,11 +1985,24 @@ static inline int rock_flash_read_lba_raw(struct xrock_ctx_t * ctx, uint32_t sec
 	put_unaligned_be32(&req.cmd.address[0], sec);
 	put_unaligned_be16(&req.cmd.size[0], (uint16_t)cnt);
 
-	usb_bulk_send(ctx->hdl, ctx->epout, &req, sizeof(struct usb_request_t));
-	usb_bulk_recv(ctx->hdl, ctx->epin, buf, cnt << 9);
-	usb_bulk_recv(ctx->hdl, ctx->epin, &res, sizeof(struct usb_response_t));
-	if((get_unaligned_be32(&res.signature[0]) != USB_RESPONSE_SIGN) || (memcmp(&res.tag[0], &req.tag[0], 4) != 0))
+	if(!usb_bulk_send(ctx, ctx->epout, &req, sizeof(struct usb_request_t)))
+		return 0;
+	r = usb_bulk_recv_status(ctx->hdl, ctx->epin, buf, cnt << 9);
+	memset(&res, 0, sizeof(struct usb_response_t));
+	if(!usb_bulk_recv(ctx, ctx->epin, &res, sizeof(struct usb_response_t)))
+	{
+		libusb_clear_halt(ctx->hdl, ctx->epin);
+		libusb_clear_halt(ctx->hdl, ctx->epout);
+		return 0;
+	}
+	if(!usb_response_check(ctx, &req, &res))
+		return 0;
+	if((r != 0) || (res.status != 0))
+	{
+		ctx->error = (r != 0) ? XROCK_ERROR_USB : XROCK_ERROR_PROTOCOL;
+		ctx->usb_error = r;
 		return 0;
+	}
 	return 1;
 }
 
@@ -1289,7 +2013,7 @@ static inline int rock_flash_write_lba_raw(struct xrock_ctx_t * ctx, uint32_t se
 
 	memset(&req, 0, sizeof(struct usb_request_t));
 	put_unaligned_be32(&req.signature[0], USB_REQUEST_SIGN);
-	put_unaligned_be32(&req.tag[0], make_tag());
+	put_unaligned_be32(&req.tag[0], make_tag(ctx));
 	put_unaligned_le32(&req.length[0], cnt << 9);
 	req.flag = USB_DIRECTION_OUT;
 	req.cmdlen = 10;
@@ -1298,36 +2022,124 @@ static inline int rock_flash_write_lba_raw(struct xrock_ctx_t * ctx, uint32_t se
 	put_unaligned_be32(&req.cmd.address[0], sec);
 	put_unaligned_be16(&req.cmd.size[0], (uint16_t)cnt);
 
-	usb_bulk_send(ctx->hdl, ctx->epout, &req, sizeof(struct usb_request_t));
-	usb_bulk_send(ctx->hdl, ctx->epout, buf, cnt << 9);
-	usb_bulk_recv(ctx->hdl, ctx->epin, &res, sizeof(struct usb_response_t));
-	if((get_unaligned_be32(&res.signature[0]) != USB_RESPONSE_SIGN) || (memcmp(&res.tag[0], &req.tag[0], 4) != 0))
+	if(!usb_bulk_send(ctx, ctx->epout, &req, sizeof(struct usb_request_t))
+		|| !usb_bulk_send(ctx, ctx->epout, buf, cnt << 9)
+		|| !usb_bulk_recv(ctx, ctx->epin, &res, sizeof(struct usb_response_t))
+		|| !usb_response_check(ctx, &req, &res))
 		return 0;
 	return 1;
 }
 
-int rock_flash_erase_lba(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt)
+/*
+ * Erase block size in sectors for the current storage media, one where there
+ * are no erase blocks to align to, like emmc and sd. It is read once and
+ * cached until the storage is switched.
+ */
+uint32_t rock_flash_erase_block(struct xrock_ctx_t * ctx, enum storage_type_t * type)
+{
+	struct flash_info_t info;
+	enum storage_type_t t = STORAGE_TYPE_UNKNOWN;
+	uint32_t block = 1;
+
+	if(ctx->erase_block == 0)
+	{
+		if(rock_capability_support(ctx, CAPABILITY_TYPE_SWITCH_STORAGE))
+			t = rock_storage_read(ctx);
+		switch(t)
+		{
+		case STORAGE_TYPE_EMMC:
+		case STORAGE_TYPE_SD:
+		case STORAGE_TYPE_SD1:
+			break;
+		default:
+			memset(&info, 0, sizeof(struct flash_info_t));
+			if(rock_flash_detect(ctx, &info) && (info.block_size > 0) && (info.block_size <= 16384))
+				block = info.block_size;
+			break;
+		}
+		ctx->erase_block = block;
+		ctx->erase_type = t;
+	}
+	if(type)
+		*type = ctx->erase_type;
+	return ctx->erase_block;
+}
+
+/*
+ * Sectors per flash command for large ranges, from the chip profile
+ */
+static inline uint32_t rock_lba_chunk(struct xrock_ctx_t * ctx)
+{
+	if(ctx->chip && ctx->chip->lba_chunk)
+		return ctx->chip->lba_chunk;
+	return 16384;
+}
+
+/*
+ * Erase [sec, sec + cnt) with the least number of commands, the misaligned
+ * head and tail are erased on their own and the body in whole erase blocks,
+ * so the loader never has to split a block for us.
+ */
+static int rock_flash_erase_plan(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt, uint32_t block, uint32_t maxsec, struct progress_t * p)
 {
 	uint32_t n;
 
+	if(block == 0)
+		return 1;
+	maxsec = (maxsec > block) ? (maxsec - maxsec % block) : block;
 	while(cnt > 0)
 	{
-		n = cnt > 16384 ? 16384 : cnt;
+		if(sec % block)
+			n = XMIN(block - sec % block, cnt);
+		else if(cnt >= block)
+			n = XMIN(cnt - cnt % block, maxsec);
+		else
+			n = cnt;
 		if(!rock_flash_erase_lba_raw(ctx, sec, n))
 			return 0;
 		sec += n;
 		cnt -= n;
+		if(p)
+			progress_update(p, (uint64_t)n << 9);
 	}
 	return 1;
 }
 
+/*
+ * Erase only the erase blocks a write of [sec, sec + cnt) covers completely,
+ * partial blocks at the edges still hold data we must not lose. This is done
+ * on raw nand, spi nand and spi nor only.
+ */
+int rock_flash_erase_ahead(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt)
+{
+	enum storage_type_t type;
+	uint32_t block = rock_flash_erase_block(ctx, &type);
+	uint32_t start, end;
+
+	if((type != STORAGE_TYPE_FLASH) && (type != STORAGE_TYPE_SPINAND) && (type != STORAGE_TYPE_SPINOR))
+		return 1;
+	if(block <= 1)
+		return 1;
+	start = (uint32_t)(((uint64_t)sec + block - 1) / block * block);
+	end = (uint32_t)(((uint64_t)sec + cnt) / block * block);
+	if(end <= start)
+		return 1;
+	return rock_flash_erase_plan(ctx, start, end - start, block, rock_lba_chunk(ctx), NULL);
+}
+
+int rock_flash_erase_lba(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt)
+{
+	return rock_flash_erase_plan(ctx, sec, cnt, rock_flash_erase_block(ctx, NULL), rock_lba_chunk(ctx), NULL);
+}
+
 int rock_flash_read_lba(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt, void * buf)
 {
+	uint32_t max = rock_lba_chunk(ctx);
 	uint32_t n;
 
 	while(cnt > 0)
 	{
-		n = cnt > 16384 ? 16384 : cnt;
+		n = cnt > max ? max : cnt;
 		if(!rock_flash_read_lba_raw(ctx, sec, n, buf))
 			return 0;
 		sec += n;
@@ -1339,11 +2151,12 @@ int rock_flash_read_lba(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt, vo
 
 int rock_flash_write_lba(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt, void * buf)
 {
+	uint32_t max = rock_lba_chunk(ctx);
 	uint32_t n;
 
 	while(cnt > 0)
 	{
-		n = cnt > 16384 ? 16384 : cnt;
+		n = cnt > max ? max : cnt;
 		if(!rock_flash_write_lba_raw(ctx, sec, n, buf))
 			return 0;
 		sec += n;
@@ -1355,22 +2168,21 @@ int rock_flash_write_lba(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt, v
 
 int rock_flash_erase_lba_progress(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt)
 {
-	int MAXSEC = 16384;
+	int MAXSEC = rock_lba_chunk(ctx);
 	struct progress_t p;
-	uint32_t n;
+	uint32_t block;
 
 	if(cnt <= 65536)
 		MAXSEC = 128;
 
-	progress_start(&p, (uint64_t)cnt << 9);
-	while(cnt > 0)
+	if(!rock_flash_update_invalidate(ctx, sec, cnt))
+		return 0;
+	block = rock_flash_erase_block(ctx, NULL);
+	rock_progress_start(ctx, &p, (uint64_t)cnt << 9);
+	if(!rock_flash_erase_plan(ctx, sec, cnt, block, MAXSEC, &p))
 	{
-		n = cnt > MAXSEC ? MAXSEC : cnt;
-		if(!rock_flash_erase_lba_raw(ctx, sec, n))
-			return 0;
-		sec += n;
-		cnt -= n;
-		progress_update(&p, (uint64_t)n << 9);
+		progress_stop(&p);
+		return 0;
 	}
 	progress_stop(&p);
 	return 1;
@@ -1378,14 +2190,14 @@ int rock_flash_erase_lba_progress(struct xrock_ctx_t * ctx, uint32_t sec, uint32
 
 int rock_flash_read_lba_progress(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt, void * buf)
 {
-	int MAXSEC = 16384;
+	int MAXSEC = rock_lba_chunk(ctx);
 	struct progress_t p;
 	uint32_t n;
 
 	if(cnt <= 65536)
 		MAXSEC = 128;
 
-	progress_start(&p, (uint64_t)cnt << 9);
+	rock_progress_start(ctx, &p, (uint64_t)cnt << 9);
 	while(cnt > 0)
 	{
 		n = cnt > MAXSEC ? MAXSEC : cnt;
@@ -1402,14 +2214,16 @@ int rock_flash_read_lba_progress(struct xrock_ctx_t * ctx, uint32_t sec, uint32_
 
 int rock_flash_write_lba_progress(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt, void * buf)
 {
-	int MAXSEC = 16384;
+	int MAXSEC = rock_lba_chunk(ctx);
 	struct progress_t p;
 	uint32_t n;
 
 	if(cnt <= 65536)
 		MAXSEC = 128;
 
-	progress_start(&p, (uint64_t)cnt << 9);
+	if(!rock_flash_erase_ahead(ctx, sec, cnt))
+		return 0;
+	rock_progress_start(ctx, &p, (uint64_t)cnt << 9);
 	while(cnt > 0)
 	{
 		n = cnt > MAXSEC ? MAXSEC : cnt;
@@ -1424,13 +2238,28 @@ int rock_flash_write_lba_progress(struct xrock_ctx_t * ctx, uint32_t sec, uint32
 	return 1;
 }
 
+int rock_loader_upgrade_progress(struct xrock_ctx_t * ctx, struct rkloader_ctx_t * lctx)
+{
+	uint32_t sec = rock_idb_sector(ctx, rock_storage_read(ctx));
+
+	return rock_flash_write_lba_progress(ctx, sec, lctx->idblen / 512, lctx->idbbuf);
+}
+
 int rock_flash_read_lba_to_file_progress(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt, const char * filename)
 {
-	int MAXSEC = 16384;
+	int MAXSEC = rock_lba_chunk(ctx);
+	char path[4096];
+
+	/* A manifest left by an older dump must never describe this one */
+	snprintf(path, sizeof(path), "%s.merkle", filename);
+	remove(path);
 
 	FILE * f = fopen(filename, "w");
 	if(!f)
+	{
+		ctx->error = XROCK_ERROR_FILE;
 		return 0;
+	}
 
 	if(cnt <= 65536)
 		MAXSEC = 128;
@@ -1438,18 +2267,29 @@ int rock_flash_read_lba_to_file_progress(struct xrock_ctx_t * ctx, uint32_t sec,
 	void * buf = malloc(MAXSEC << 9);
 	if(!buf)
 	{
+		ctx->error = XROCK_ERROR_NOMEM;
+		fclose(f);
+		return 0;
+	}
+
+	struct merkle_ctx_t * mctx = merkle_alloc(MERKLE_LEAF_SIZE);
+	if(!mctx)
+	{
+		ctx->error = XROCK_ERROR_NOMEM;
+		free(buf);
 		fclose(f);
 		return 0;
 	}
 
 	struct progress_t p;
-	progress_start(&p, (uint64_t)cnt << 9);
+	rock_progress_start(ctx, &p, (uint64_t)cnt << 9);
 	while(cnt > 0)
 	{
 		uint32_t n = cnt > MAXSEC ? MAXSEC : cnt;
 		memset(buf, 0, MAXSEC << 9);
 		if(!rock_flash_read_lba_raw(ctx, sec, n, buf))
 		{
+			merkle_free(mctx);
 			if(buf)
 				free(buf);
 			if(f)
@@ -1458,30 +2298,56 @@ int rock_flash_read_lba_to_file_progress(struct xrock_ctx_t * ctx, uint32_t sec,
 		}
 		if(fwrite(buf, 512, n, f) != n)
 		{
+			ctx->error = XROCK_ERROR_FILE;
+			merkle_free(mctx);
 			if(buf)
 				free(buf);
 			if(f)
 				fclose(f);
 			return 0;
 		}
+		if(!merkle_update(mctx, buf, (size_t)n << 9))
+		{
+			ctx->error = XROCK_ERROR_NOMEM;
+			merkle_free(mctx);
+			free(buf);
+			fclose(f);
+			return 0;
+		}
 		sec += n;
 		cnt -= n;
 		progress_update(&p, (uint64_t)n << 9);
 	}
 	progress_stop(&p);
 
+	int ret = 1;
+	if(!merkle_finish(mctx))
+	{
+		ctx->error = XROCK_ERROR_NOMEM;
+		ret = 0;
+	}
+	else if(!merkle_save(mctx, path))
+	{
+		ctx->error = XROCK_ERROR_FILE;
+		remove(path);
+		ret = 0;
+	}
+	merkle_free(mctx);
 	free(buf);
 	fclose(f);
-	return 1;
+	return ret;
 }
 
 int rock_flash_write_lba_from_file_progress(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t maxcnt, const char * filename)
 {
-	int MAXSEC = 16384;
+	int MAXSEC = rock_lba_chunk(ctx);
 
 	FILE * f = fopen(filename, "r");
 	if(!f)
+	{
+		ctx->error = XROCK_ERROR_FILE;
 		return 0;
+	}
 
 	fseek(f, 0, SEEK_END);
 	int64_t len = ftell(f);
@@ -1506,18 +2372,26 @@ int rock_flash_write_lba_from_file_progress(struct xrock_ctx_t * ctx, uint32_t s
 	void * buf = malloc(MAXSEC << 9);
 	if(!buf)
 	{
+		ctx->error = XROCK_ERROR_NOMEM;
 		fclose(f);
 		return 0;
 	}
 
+	if(!rock_flash_update_invalidate(ctx, sec, cnt) || !rock_flash_erase_ahead(ctx, sec, cnt))
+	{
+		free(buf);
+		fclose(f);
+		return 0;
+	}
 	struct progress_t p;
-	progress_start(&p, (uint64_t)cnt << 9);
+	rock_progress_start(ctx, &p, (uint64_t)cnt << 9);
 	while(cnt > 0)
 	{
 		uint32_t n = cnt > MAXSEC ? MAXSEC : cnt;
 		memset(buf, 0, MAXSEC << 9);
 		if(fread(buf, 512, n, f) != n)
 		{
+			ctx->error = XROCK_ERROR_FILE;
 			if(buf)
 				free(buf);
 			if(f)
@@ -1542,3 +2416,366 @@ int rock_flash_write_lba_from_file_progress(struct xrock_ctx_t * ctx, uint32_t s
 	fclose(f);
 	return 1;
 }
+
+/*
+ * Asynchronous jobs, every chunk is one command whose request, data and
+ * response stages are chained bulk transfers. They all complete from libusb
+ * event handling, so one thread polling the libusb file descriptors can drive
+ * any number of contexts, each context runs at most one job at a time.
+ */
+enum {
+	JOB_FLASH_READ,
+	JOB_FLASH_WRITE,
+	JOB_READ,
+	JOB_WRITE,
+	JOB_VS_READ,
+	JOB_VS_WRITE,
+};
+
+enum {
+	JOB_STAGE_REQUEST,
+	JOB_STAGE_DATA,
+	JOB_STAGE_RESPONSE,
+};
+
+struct xrock_job_t {
+	struct xrock_ctx_t * ctx;
+	struct libusb_transfer * transfer;
+	xrock_job_callback_t callback;
+	void * data;
+	struct progress_t p;
+	struct usb_request_t req;
+	struct usb_response_t res;
+	int kind;
+	int stage;
+	int cancel;
+	uint8_t * buf;
+	uint32_t addr;
+	uint32_t max;
+	int index;
+	int type;
+	uint64_t total;
+	uint64_t offset;
+	uint32_t chunk;
+	uint32_t xfer;
+};
+
+static void rock_job_request(struct xrock_job_t * job)
+{
+	struct usb_request_t * req = &job->req;
+	uint64_t left = job->total - job->offset;
+	uint32_t n;
+
+	memset(req, 0, sizeof(struct usb_request_t));
+	put_unaligned_be32(&req->signature[0], USB_REQUEST_SIGN);
+	put_unaligned_be32(&req->tag[0], make_tag(job->ctx));
+	req->cmdlen = 10;
+	switch(job->kind)
+	{
+	case JOB_FLASH_READ:
+	case JOB_FLASH_WRITE:
+		n = XMIN((uint32_t)(left >> 9), job->max);
+		job->chunk = n << 9;
+		put_unaligned_le32(&req->length[0], n << 9);
+		req->flag = (job->kind == JOB_FLASH_READ) ? USB_DIRECTION_IN : USB_DIRECTION_OUT;
+		req->cmd.opcode = (job->kind == JOB_FLASH_READ) ? OPCODE_READ_LBA : OPCODE_WRITE_LBA;
+		put_unaligned_be32(&req->cmd.address[0], job->addr + (uint32_t)(job->offset >> 9));
+		put_unaligned_be16(&req->cmd.size[0], (uint16_t)n);
+		break;
+	case JOB_READ:
+	case JOB_WRITE:
+		n = (uint32_t)XMIN(left, (uint64_t)job->max);
+		job->chunk = n;
+		put_unaligned_le32(&req->length[0], 0);
+		req->flag = (job->kind == JOB_READ) ? USB_DIRECTION_IN : USB_DIRECTION_OUT;
+		req->cmd.opcode = (job->kind == JOB_READ) ? OPCODE_READ_SDRAM : OPCODE_WRITE_SDRAM;
+		put_unaligned_be32(&req->cmd.address[0], job->addr + (uint32_t)job->offset);
+		put_unaligned_be16(&req->cmd.size[0], (uint16_t)n);
+		break;
+	case JOB_VS_READ:
+	case JOB_VS_WRITE:
+		n = (uint32_t)job->total;
+		job->chunk = n;
+		put_unaligned_le32(&req->length[0], n);
+		req->flag = (job->kind == JOB_VS_READ) ? USB_DIRECTION_IN : USB_DIRECTION_OUT;
+		req->cmd.opcode = (job->kind == JOB_VS_READ) ? OPCODE_READ_VENDOR_STORAGE : OPCODE_WRITE_VENDOR_STORAGE;
+		put_unaligned_be16(&req->cmd.address[0], job->index);
+		put_unaligned_be16(&req->cmd.address[2], job->type);
+		put_unaligned_be16(&req->cmd.size[0], n);
+		break;
+	default:
+		break;
+	}
+}
+
+static void rock_job_finish(struct xrock_job_t * job, int ok)
+{
+	struct xrock_ctx_t * ctx = job->ctx;
+	xrock_job_callback_t callback = job->callback;
+	void * data = job->data;
+
+	if(ok)
+		progress_stop(&job->p);
+	ctx->job = NULL;
+	libusb_free_transfer(job->transfer);
+	free(job);
+	if(callback)
+		callback(ctx, ok, data);
+}
+
+static void LIBUSB_CALL rock_job_callback(struct libusb_transfer * transfer);
+
+static int rock_job_submit(struct xrock_job_t * job, int ep, void * buf, uint32_t len)
+{
+	int r;
+
+	libusb_fill_bulk_transfer(job->transfer, job->ctx->hdl, ep, buf, len, rock_job_callback, job, 2000 * (1 + len / (128 * 1024)));
+	r = libusb_submit_transfer(job->transfer);
+	if(r != 0)
+	{
+		job->ctx->error = XROCK_ERROR_USB;
+		job->ctx->usb_error = r;
+		return 0;
+	}
+	return 1;
+}
+
+static int rock_job_next(struct xrock_job_t * job)
+{
+	struct xrock_ctx_t * ctx = job->ctx;
+
+	switch(job->stage)
+	{
+	case JOB_STAGE_REQUEST:
+		return rock_job_submit(job, ctx->epout, &job->req, sizeof(struct usb_request_t));
+	case JOB_STAGE_DATA:
+		if(job->req.flag == USB_DIRECTION_IN)
+			return rock_job_submit(job, ctx->epin, job->buf + job->offset + job->xfer, job->chunk - job->xfer);
+		return rock_job_submit(job, ctx->epout, job->buf + job->offset + job->xfer, job->chunk - job->xfer);
+	case JOB_STAGE_RESPONSE:
+		memset(&job->res, 0, sizeof(struct usb_response_t));
+		return rock_job_submit(job, ctx->epin, &job->res, sizeof(struct usb_response_t));
+	default:
+		break;
+	}
+	return 0;
+}
+
+static void LIBUSB_CALL rock_job_callback(struct libusb_transfer * transfer)
+{
+	struct xrock_job_t * job = (struct xrock_job_t *)transfer->user_data;
+	struct xrock_ctx_t * ctx = job->ctx;
+
+	if(transfer->status != LIBUSB_TRANSFER_COMPLETED)
+	{
+		ctx->error = XROCK_ERROR_USB;
+		switch(transfer->status)
+		{
+		case LIBUSB_TRANSFER_TIMED_OUT:
+			ctx->usb_error = LIBUSB_ERROR_TIMEOUT;
+			break;
+		case LIBUSB_TRANSFER_CANCELLED:
+			ctx->usb_error = LIBUSB_ERROR_INTERRUPTED;
+			break;
+		case LIBUSB_TRANSFER_STALL:
+			ctx->usb_error = LIBUSB_ERROR_PIPE;
+			break;
+		case LIBUSB_TRANSFER_NO_DEVICE:
+			ctx->usb_error = LIBUSB_ERROR_NO_DEVICE;
+			break;
+		case LIBUSB_TRANSFER_OVERFLOW:
+			ctx->usb_error = LIBUSB_ERROR_OVERFLOW;
+			break;
+		default:
+			ctx->usb_error = LIBUSB_ERROR_IO;
+			break;
+		}
+		rock_job_finish(job, 0);
+		return;
+	}
+	if(job->cancel)
+	{
+		ctx->error = XROCK_ERROR_USB;
+		ctx->usb_error = LIBUSB_ERROR_INTERRUPTED;
+		rock_job_finish(job, 0);
+		return;
+	}
+	switch(job->stage)
+	{
+	case JOB_STAGE_REQUEST:
+		job->stage = (job->chunk > 0) ? JOB_STAGE_DATA : JOB_STAGE_RESPONSE;
+		job->xfer = 0;
+		break;
+	case JOB_STAGE_DATA:
+		job->xfer += transfer->actual_length;
+		if(job->xfer >= job->chunk)
+			job->stage = JOB_STAGE_RESPONSE;
+		else if(transfer->actual_length == 0)
+		{
+			ctx->error = XROCK_ERROR_PROTOCOL;
+			rock_job_finish(job, 0);
+			return;
+		}
+		break;
+	case JOB_STAGE_RESPONSE:
+		if((transfer->actual_length != sizeof(struct usb_response_t)) || !usb_response_check(ctx, &job->req, &job->res))
+		{
+			ctx->error = XROCK_ERROR_PROTOCOL;
+			rock_job_finish(job, 0);
+			return;
+		}
+		job->offset += job->chunk;
+		progress_update(&job->p, job->chunk);
+		if(job->offset >= job->total)
+		{
+			rock_job_finish(job, 1);
+			return;
+		}
+		rock_job_request(job);
+		job->stage = JOB_STAGE_REQUEST;
+		break;
+	default:
+		break;
+	}
+	if(!rock_job_next(job))
+		rock_job_finish(job, 0);
+}
+
+static struct xrock_job_t * rock_job_alloc(struct xrock_ctx_t * ctx, int kind, uint32_t addr, void * buf, uint64_t total, uint32_t max, xrock_job_callback_t callback, void * data)
+{
+	struct xrock_job_t * job;
+
+	if(!ctx || !ctx->hdl || ctx->job || !buf || (total == 0))
+		return NULL;
+	job = calloc(1, sizeof(struct xrock_job_t));
+	if(!job)
+	{
+		ctx->error = XROCK_ERROR_NOMEM;
+		return NULL;
+	}
+	job->transfer = libusb_alloc_transfer(0);
+	if(!job->transfer)
+	{
+		ctx->error = XROCK_ERROR_NOMEM;
+		free(job);
+		return NULL;
+	}
+	job->ctx = ctx;
+	job->callback = callback;
+	job->data = data;
+	job->kind = kind;
+	job->buf = buf;
+	job->addr = addr;
+	job->total = total;
+	job->max = max;
+	job->stage = JOB_STAGE_REQUEST;
+	return job;
+}
+
+static struct xrock_job_t * rock_job_start(struct xrock_job_t * job)
+{
+	if(job)
+	{
+		rock_job_request(job);
+		rock_progress_start(job->ctx, &job->p, job->total);
+		if(!rock_job_next(job))
+		{
+			libusb_free_transfer(job->transfer);
+			free(job);
+			return NULL;
+		}
+		job->ctx->job = job;
+	}
+	return job;
+}
+
+struct xrock_job_t * rock_async_flash_read(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt, void * buf, xrock_job_callback_t callback, void * data)
+{
+	return rock_job_start(rock_job_alloc(ctx, JOB_FLASH_READ, sec, buf, (uint64_t)cnt << 9, (cnt <= 65536) ? 128 : rock_lba_chunk(ctx), callback, data));
+}
+
+/*
+ * Unlike rock_flash_write_lba_progress there is no erase ahead, on raw nand
+ * the range must be erased before submitting the job.
+ */
+struct xrock_job_t * rock_async_flash_write(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt, void * buf, xrock_job_callback_t callback, void * data)
+{
+	return rock_job_start(rock_job_alloc(ctx, JOB_FLASH_WRITE, sec, buf, (uint64_t)cnt << 9, (cnt <= 65536) ? 128 : rock_lba_chunk(ctx), callback, data));
+}
+
+struct xrock_job_t * rock_async_read(struct xrock_ctx_t * ctx, uint32_t addr, void * buf, size_t len, xrock_job_callback_t callback, void * data)
+{
+	return rock_job_start(rock_job_alloc(ctx, JOB_READ, addr, buf, len, 16384, callback, data));
+}
+
+struct xrock_job_t * rock_async_write(struct xrock_ctx_t * ctx, uint32_t addr, void * buf, size_t len, xrock_job_callback_t callback, void * data)
+{
+	return rock_job_start(rock_job_alloc(ctx, JOB_WRITE, addr, buf, len, 16384, callback, data));
+}
+
+struct xrock_job_t * rock_async_vs_read(struct xrock_ctx_t * ctx, int type, int index, uint8_t * buf, int len, xrock_job_callback_t callback, void * data)
+{
+	struct xrock_job_t * job;
+
+	if((len <= 0) || (len > 512))
+		return NULL;
+	job = rock_job_alloc(ctx, JOB_VS_READ, 0, buf, len, len, callback, data);
+	if(job)
+	{
+		job->type = type;
+		job->index = index;
+	}
+	return rock_job_start(job);
+}
+
+struct xrock_job_t * rock_async_vs_write(struct xrock_ctx_t * ctx, int type, int index, uint8_t * buf, int len, xrock_job_callback_t callback, void * data)
+{
+	struct xrock_job_t * job;
+
+	if((len <= 0) || (len > 512))
+		return NULL;
+	job = rock_job_alloc(ctx, JOB_VS_WRITE, 0, buf, len, len, callback, data);
+	if(job)
+	{
+		job->type = type;
+		job->index = index;
+	}
+	return rock_job_start(job);
+}
+
+/*
+ * The callback still runs, with a failure. A command cut in the middle leaves
+ * the loader waiting for the rest, so reset or reopen the chip afterwards.
+ */
+int rock_async_cancel(struct xrock_job_t * job)
+{
+	if(job)
+	{
+		job->cancel = 1;
+		libusb_cancel_transfer(job->transfer);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * The event loop glue, the returned list is freed by libusb_free_pollfds().
+ * Pending timeouts are reported by xrock_async_timeout(), which returns 1 and
+ * fills tv when libusb needs to be called back before the fds become ready.
+ */
+const struct libusb_pollfd ** xrock_async_pollfds(libusb_context * context)
+{
+	return libusb_get_pollfds(context);
+}
+
+int xrock_async_timeout(libusb_context * context, struct timeval * tv)
+{
+	return (libusb_get_next_timeout(context, tv) == 1) ? 1 : 0;
+}
+
+int xrock_async_handle(libusb_context * context)
+{
+	struct timeval tv = { 0, 0 };
+
+	return (libusb_handle_events_timeout_completed(context, &tv, NULL) == 0) ? 1 : 0;
+}
@@ -43,9 +43,52 @@ enum storage_type_t {
 	STORAGE_TYPE_PCIE					= (1 << 11),
 };
 
+enum memtest_mode_t {
+	MEMTEST_MODE_WALKING_ONES			= (1 << 0),
+	MEMTEST_MODE_ADDRESS				= (1 << 1),
+	MEMTEST_MODE_RANDOM					= (1 << 2),
+	MEMTEST_MODE_FILL					= (1 << 3),
+};
+
+enum xrock_error_t {
+	XROCK_ERROR_NONE					= 0,
+	XROCK_ERROR_USB						= -1,
+	XROCK_ERROR_PROTOCOL				= -2,
+	XROCK_ERROR_NOMEM					= -3,
+	XROCK_ERROR_FILE					= -4,
+	XROCK_ERROR_NODEV					= -5,
+	XROCK_ERROR_THREAD					= -6,
+	XROCK_ERROR_FORMAT					= -7,
+	XROCK_ERROR_VERIFY					= -8,
+};
+
+struct xrock_ctx_t;
+struct xrock_job_t;
+
+typedef void (*xrock_job_callback_t)(struct xrock_ctx_t * ctx, int ok, void * data);
+
+enum chip_arch_t {
+	CHIP_ARCH_UNKNOWN					= 0,
+	CHIP_ARCH_ARM32						= 1,
+	CHIP_ARCH_ARM64						= 2,
+};
+
+struct chip_idb_t {
+	uint32_t block;		/* Idb sector on flash, emmc and sd */
+	uint32_t spinor;	/* Idb sector on spi nor */
+	uint32_t spinand;	/* Idb sector on spi nand */
+};
+
 struct chip_t {
 	uint16_t pid;
 	char * name;
+	enum chip_arch_t arch;		/* Cpu state of maskrom and loader, picks the extra payloads */
+	uint32_t sram_base;			/* Sram base, zero if unknown */
+	uint32_t dram_base;			/* Dram base */
+	uint32_t dram_size;			/* Dram window below the io region, zero if unknown */
+	int usb3;					/* Otg port is usb3 capable */
+	uint32_t lba_chunk;			/* Sectors per flash command for large ranges */
+	const struct chip_idb_t * idb;
 };
 
 struct xrock_ctx_t {
@@ -55,6 +98,15 @@ struct xrock_ctx_t {
 	int epout;
 	int epin;
 	int maskrom;
+	int usb3;
+	uint32_t tag;
+	enum xrock_error_t error;
+	int usb_error;
+	progress_hook_t progress;
+	void * progress_data;
+	struct xrock_job_t * job;
+	uint32_t erase_block;		/* Cached erase block size in sectors, zero if not read yet */
+	enum storage_type_t erase_type;
 };
 
 struct flash_info_t {
@@ -68,15 +120,34 @@ struct flash_info_t {
 	uint8_t id[5];
 };
 
+struct memtest_result_t {
+	uint32_t status;	/* The failed test mode, zero if passed */
+	uint32_t address;
+	uint32_t expect;
+	uint32_t actual;
+};
+
+int xrock_probe(libusb_device * device);
+char * xrock_path(libusb_device * device, char * buf, size_t len);
+int xrock_path_match(const char * list, const char * path);
+int xrock_open(struct xrock_ctx_t * ctx, libusb_device * device);
 int xrock_init(struct xrock_ctx_t * ctx);
-void rock_maskrom_upload_memory(struct xrock_ctx_t * ctx, uint32_t code, void * buf, uint64_t len, int rc4);
-void rock_maskrom_upload_file(struct xrock_ctx_t * ctx, uint32_t code, const char * filename, int rc4);
-void rock_maskrom_dump_arm32(struct xrock_ctx_t * ctx, uint32_t uart, uint32_t addr, uint32_t len, int rc4);
-void rock_maskrom_dump_arm64(struct xrock_ctx_t * ctx, uint32_t uart, uint32_t addr, uint32_t len, int rc4);
-void rock_maskrom_write_arm32_progress(struct xrock_ctx_t * ctx, uint32_t addr, void * buf, size_t len, int rc4);
-void rock_maskrom_write_arm64_progress(struct xrock_ctx_t * ctx, uint32_t addr, void * buf, size_t len, int rc4);
-void rock_maskrom_exec_arm32(struct xrock_ctx_t * ctx, uint32_t addr, int rc4);
-void rock_maskrom_exec_arm64(struct xrock_ctx_t * ctx, uint32_t addr, int rc4);
+struct xrock_ctx_t * xrock_ctx_alloc(libusb_context * context, const char * path);
+void xrock_ctx_free(struct xrock_ctx_t * ctx);
+void xrock_ctx_set_progress(struct xrock_ctx_t * ctx, progress_hook_t hook, void * data);
+int xrock_ctx_error(struct xrock_ctx_t * ctx);
+const char * xrock_ctx_strerror(struct xrock_ctx_t * ctx);
+void rock_progress_start(struct xrock_ctx_t * ctx, struct progress_t * p, uint64_t total);
+int rock_maskrom_upload_memory(struct xrock_ctx_t * ctx, uint32_t code, void * buf, uint64_t len, int rc4);
+int rock_maskrom_upload_file(struct xrock_ctx_t * ctx, uint32_t code, const char * filename, int rc4);
+int rock_maskrom_dump_arm32(struct xrock_ctx_t * ctx, uint32_t uart, uint32_t addr, uint32_t len, int rc4);
+int rock_maskrom_dump_arm64(struct xrock_ctx_t * ctx, uint32_t uart, uint32_t addr, uint32_t len, int rc4);
+int rock_maskrom_bindump_arm32(struct xrock_ctx_t * ctx, uint32_t uart, uint32_t addr, uint32_t len, int rc4);
+int rock_maskrom_bindump_arm64(struct xrock_ctx_t * ctx, uint32_t uart, uint32_t addr, uint32_t len, int rc4);
+int rock_maskrom_write_arm32_progress(struct xrock_ctx_t * ctx, uint32_t addr, void * buf, size_t len, int rc4);
+int rock_maskrom_write_arm64_progress(struct xrock_ctx_t * ctx, uint32_t addr, void * buf, size_t len, int rc4);
+int rock_maskrom_exec_arm32(struct xrock_ctx_t * ctx, uint32_t addr, int rc4);
+int rock_maskrom_exec_arm64(struct xrock_ctx_t * ctx, uint32_t addr, int rc4);
 int rock_ready(struct xrock_ctx_t * ctx);
 int rock_version(struct xrock_ctx_t * ctx, uint8_t * buf);
 int rock_capability(struct xrock_ctx_t * ctx, uint8_t * buf);
@@ -87,6 +158,10 @@ int rock_read(struct xrock_ctx_t * ctx, uint32_t addr, void * buf, size_t len);
 int rock_write(struct xrock_ctx_t * ctx, uint32_t addr, void * buf, size_t len);
 int rock_read_progress(struct xrock_ctx_t * ctx, uint32_t addr, void * buf, size_t len);
 int rock_write_progress(struct xrock_ctx_t * ctx, uint32_t addr, void * buf, size_t len);
+int rock_crc32_arm32(struct xrock_ctx_t * ctx, uint32_t scratch, uint32_t addr, uint32_t len, uint32_t * crc);
+int rock_crc32_arm64(struct xrock_ctx_t * ctx, uint32_t scratch, uint32_t addr, uint32_t len, uint32_t * crc);
+int rock_memtest_arm32_progress(struct xrock_ctx_t * ctx, uint32_t scratch, uint32_t addr, uint32_t len, uint32_t mode, uint32_t value, struct memtest_result_t * r);
+int rock_memtest_arm64_progress(struct xrock_ctx_t * ctx, uint32_t scratch, uint32_t addr, uint32_t len, uint32_t mode, uint32_t value, struct memtest_result_t * r);
 int rock_otp_read(struct xrock_ctx_t * ctx, uint8_t * buf, int len);
 int rock_sn_read(struct xrock_ctx_t * ctx, char * sn);
 int rock_sn_write(struct xrock_ctx_t * ctx, char * sn);
@@ -94,15 +169,31 @@ int rock_vs_read(struct xrock_ctx_t * ctx, int type, int index, uint8_t * buf, i
 int rock_vs_write(struct xrock_ctx_t * ctx, int type, int index, uint8_t * buf, int len);
 enum storage_type_t rock_storage_read(struct xrock_ctx_t * ctx);
 int rock_storage_switch(struct xrock_ctx_t * ctx, enum storage_type_t type);
+uint32_t rock_idb_sector(struct xrock_ctx_t * ctx, enum storage_type_t type);
+int rock_dram_valid(struct xrock_ctx_t * ctx, uint32_t addr, uint32_t len);
 int rock_flash_detect(struct xrock_ctx_t * ctx, struct flash_info_t * info);
+uint32_t rock_flash_erase_block(struct xrock_ctx_t * ctx, enum storage_type_t * type);
 int rock_flash_erase_lba(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt);
+int rock_flash_erase_ahead(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt);
 int rock_flash_read_lba(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt, void * buf);
+int rock_flash_read_lba_try(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt, void * buf);
 int rock_flash_write_lba(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt, void * buf);
 int rock_flash_erase_lba_progress(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt);
 int rock_flash_read_lba_progress(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt, void * buf);
 int rock_flash_write_lba_progress(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt, void * buf);
+int rock_loader_upgrade_progress(struct xrock_ctx_t * ctx, struct rkloader_ctx_t * lctx);
 int rock_flash_read_lba_to_file_progress(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt, const char * filename);
 int rock_flash_write_lba_from_file_progress(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t maxcnt, const char * filename);
+struct xrock_job_t * rock_async_flash_read(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt, void * buf, xrock_job_callback_t callback, void * data);
+struct xrock_job_t * rock_async_flash_write(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt, void * buf, xrock_job_callback_t callback, void * data);
+struct xrock_job_t * rock_async_read(struct xrock_ctx_t * ctx, uint32_t addr, void * buf, size_t len, xrock_job_callback_t callback, void * data);
+struct xrock_job_t * rock_async_write(struct xrock_ctx_t * ctx, uint32_t addr, void * buf, size_t len, xrock_job_callback_t callback, void * data);
+struct xrock_job_t * rock_async_vs_read(struct xrock_ctx_t * ctx, int type, int index, uint8_t * buf, int len, xrock_job_callback_t callback, void * data);
+struct xrock_job_t * rock_async_vs_write(struct xrock_ctx_t * ctx, int type, int index, uint8_t * buf, int len, xrock_job_callback_t callback, void * data);
+int rock_async_cancel(struct xrock_job_t * job);
+const struct libusb_pollfd ** xrock_async_pollfds(libusb_context * context);
+int xrock_async_timeout(libusb_context * context, struct timeval * tv);
+int xrock_async_handle(libusb_context * context);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,357 @@
+#include <schedule.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+
+struct schedule_job_t {
+	char path[32];
+	char * line[SCHEDULE_MAX_LINES];
+	int nline;
+};
+
+struct schedule_t;
+
+struct schedule_dev_t {
+	struct xrock_ctx_t ctx;
+	struct schedule_t * sched;
+	struct schedule_job_t * job;
+	char path[32];
+	int index;
+	int bus;
+	pthread_t thread;
+	int started;
+	int ret;
+	int step;
+	uint64_t cost;
+	double wait;
+	double time;
+};
+
+struct schedule_t {
+	struct schedule_job_t job[SCHEDULE_MAX_JOBS];
+	int njob;
+	struct schedule_dev_t * dev[SCHEDULE_MAX_DEVICES];
+	int ndev;
+	int perbus;
+	int busy[256];
+	schedule_exec_t exec;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+static double schedule_time(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+static uint64_t schedule_file_size(const char * filename)
+{
+	struct stat st;
+
+	if(filename && (stat(filename, &st) == 0) && (st.st_size > 0))
+		return st.st_size;
+	return 64 * 1024 * 1024;
+}
+
+/*
+ * Estimate the bulk data of a step in bytes, zero means a short control step
+ * which never waits for the bus.
+ */
+static uint64_t schedule_cost(const char * line)
+{
+	char buf[4096];
+	char * w[8];
+	char * p;
+	int n = 0;
+
+	strncpy(buf, line, sizeof(buf) - 1);
+	buf[sizeof(buf) - 1] = '\0';
+	p = buf;
+	while(isspace((unsigned char)*p) || (*p == '-'))
+		p++;
+	while(*p && (n < ARRAY_SIZE(w)))
+	{
+		w[n++] = p;
+		while(*p && !isspace((unsigned char)*p))
+			p++;
+		if(*p)
+			*p++ = '\0';
+		while(isspace((unsigned char)*p))
+			p++;
+	}
+	if(n == 0)
+		return 0;
+	if(!strcmp(w[0], "flash") && (n >= 2))
+	{
+		if(!strcmp(w[1], "write") || !strcmp(w[1], "update"))
+			return schedule_file_size((n >= 4) ? w[3] : NULL);
+		if(!strcmp(w[1], "read") || !strcmp(w[1], "erase") || !strcmp(w[1], "scrub"))
+		{
+			uint64_t cnt = (n >= 4) ? strtoull(w[3], NULL, 0) : 0;
+			return cnt ? (cnt << 9) : ((uint64_t)1 << 40);
+		}
+		if(!strcmp(w[1], "backup") || !strcmp(w[1], "restore"))
+			return (uint64_t)1 << 40;
+		return 0;
+	}
+	if(!strcmp(w[0], "download") || !strcmp(w[0], "upgrade") || !strcmp(w[0], "maskrom"))
+		return schedule_file_size((n >= 2) ? w[1] : NULL);
+	if(!strcmp(w[0], "write"))
+		return schedule_file_size((n >= 3) ? w[2] : NULL);
+	if(!strcmp(w[0], "read"))
+		return (n >= 3) ? strtoull(w[2], NULL, 0) : 0;
+	if(!strcmp(w[0], "extra") && (n >= 2) && !strncmp(w[1], "maskrom-write", 13))
+		return schedule_file_size(w[n - 1]);
+	return 0;
+}
+
+/*
+ * A heavy step may start when its bus has a free slot and no other chip on
+ * the same bus is waiting with a smaller step, ties go to the lower index.
+ */
+static int schedule_turn(struct schedule_t * s, struct schedule_dev_t * d)
+{
+	if(s->busy[d->bus] >= s->perbus)
+		return 0;
+	for(int i = 0; i < s->ndev; i++)
+	{
+		struct schedule_dev_t * e = s->dev[i];
+		if((e != d) && (e->bus == d->bus) && (e->cost > 0))
+		{
+			if((e->cost < d->cost) || ((e->cost == d->cost) && (e->index < d->index)))
+				return 0;
+		}
+	}
+	return 1;
+}
+
+static void schedule_acquire(struct schedule_dev_t * d, uint64_t cost)
+{
+	struct schedule_t * s = d->sched;
+
+	pthread_mutex_lock(&s->lock);
+	d->cost = cost;
+	while(!schedule_turn(s, d))
+		pthread_cond_wait(&s->cond, &s->lock);
+	d->cost = 0;
+	s->busy[d->bus]++;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+}
+
+static void schedule_release(struct schedule_dev_t * d)
+{
+	struct schedule_t * s = d->sched;
+
+	pthread_mutex_lock(&s->lock);
+	s->busy[d->bus]--;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+}
+
+static void schedule_progress(void * data, uint64_t done, uint64_t total, double speed)
+{
+}
+
+static void * schedule_worker(void * data)
+{
+	struct schedule_dev_t * d = (struct schedule_dev_t *)data;
+	struct schedule_job_t * job = d->job;
+	double start = schedule_time(), t;
+	uint64_t cost;
+	int ok;
+
+	progress_set_hook(schedule_progress, d);
+	d->ret = 1;
+	for(int i = 0; i < job->nline; i++)
+	{
+		cost = schedule_cost(job->line[i]);
+		if(cost > 0)
+		{
+			t = schedule_time();
+			schedule_acquire(d, cost);
+			d->wait += schedule_time() - t;
+		}
+		printf("[%s] %s\r\n", d->path, job->line[i]);
+		t = schedule_time();
+		ok = d->sched->exec(&d->ctx, job->line[i]);
+		if(cost > 0)
+			schedule_release(d);
+		printf("[%s] %s, %.3f s\r\n", d->path, ok ? "done" : "failed", schedule_time() - t);
+		if(!ok)
+		{
+			d->ret = 0;
+			break;
+		}
+		d->step++;
+	}
+	progress_set_hook(NULL, NULL);
+	d->time = schedule_time() - start;
+	return NULL;
+}
+
+static void schedule_jobs_free(struct schedule_t * s)
+{
+	for(int i = 0; i < s->njob; i++)
+	{
+		for(int j = 0; j < s->job[i].nline; j++)
+			free(s->job[i].line[j]);
+	}
+	s->njob = 0;
+}
+
+/*
+ * The job file holds '[port-path]' sections, '[*]' matches any other chip,
+ * each followed by the command lines for that port in script syntax.
+ */
+static int schedule_load(struct schedule_t * s, const char * jobfile)
+{
+	struct schedule_job_t * job = NULL;
+	char line[4096], * p, * e;
+	int ln = 0;
+	FILE * f;
+
+	f = fopen(jobfile, "r");
+	if(!f)
+	{
+		printf("ERROR: Can't open job file '%s'\r\n", jobfile);
+		return 0;
+	}
+	while(fgets(line, sizeof(line), f))
+	{
+		ln++;
+		line[strcspn(line, "\r\n")] = '\0';
+		p = line;
+		while(isspace((unsigned char)*p))
+			p++;
+		if(!*p || (*p == '#'))
+			continue;
+		if(*p == '[')
+		{
+			e = strchr(p, ']');
+			if(!e || (e - p - 1 <= 0) || (e - p - 1 >= sizeof(job->path)) || (s->njob >= SCHEDULE_MAX_JOBS))
+				break;
+			job = &s->job[s->njob++];
+			memset(job, 0, sizeof(struct schedule_job_t));
+			memcpy(job->path, p + 1, e - p - 1);
+			continue;
+		}
+		if(!job || (job->nline >= SCHEDULE_MAX_LINES) || !(job->line[job->nline] = strdup(p)))
+			break;
+		job->nline++;
+	}
+	if(!feof(f))
+	{
+		printf("ERROR: Invalid job file '%s' at line %d\r\n", jobfile, ln);
+		fclose(f);
+		schedule_jobs_free(s);
+		return 0;
+	}
+	fclose(f);
+	return 1;
+}
+
+static struct schedule_job_t * schedule_find(struct schedule_t * s, const char * path)
+{
+	struct schedule_job_t * any = NULL;
+
+	for(int i = 0; i < s->njob; i++)
+	{
+		if(!strcmp(s->job[i].path, path))
+			return &s->job[i];
+		if(!strcmp(s->job[i].path, "*"))
+			any = &s->job[i];
+	}
+	return any;
+}
+
+int xrock_schedule(libusb_context * context, const char * jobfile, int perbus, schedule_exec_t exec)
+{
+	struct schedule_t * s;
+	struct schedule_job_t * job;
+	libusb_device ** list = NULL;
+	char path[32];
+	int count, nfail = 0, i;
+
+	s = calloc(1, sizeof(struct schedule_t));
+	if(!s)
+		return 0;
+	s->perbus = (perbus > 0) ? perbus : 1;
+	s->exec = exec;
+	if(!schedule_load(s, jobfile))
+	{
+		free(s);
+		return 0;
+	}
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->cond, NULL);
+
+	count = libusb_get_device_list(context, &list);
+	for(i = 0; (i < count) && (s->ndev < SCHEDULE_MAX_DEVICES); i++)
+	{
+		if(!xrock_probe(list[i]))
+			continue;
+		job = schedule_find(s, xrock_path(list[i], path, sizeof(path)));
+		if(!job)
+			continue;
+		struct schedule_dev_t * d = calloc(1, sizeof(struct schedule_dev_t));
+		if(!d)
+			break;
+		d->ctx.context = context;
+		if(xrock_open(&d->ctx, list[i]))
+		{
+			strcpy(d->path, path);
+			d->sched = s;
+			d->job = job;
+			d->index = s->ndev;
+			d->bus = libusb_get_bus_number(list[i]);
+			s->dev[s->ndev++] = d;
+		}
+		else
+		{
+			printf("ERROR: Can't open chip at '%s'\r\n", path);
+			if(d->ctx.hdl)
+				libusb_close(d->ctx.hdl);
+			free(d);
+			nfail++;
+		}
+	}
+	if(list)
+		libusb_free_device_list(list, 1);
+	if(s->ndev == 0)
+		printf("ERROR: No chip matches the job file\r\n");
+
+	for(i = 0; i < s->ndev; i++)
+	{
+		if(pthread_create(&s->dev[i]->thread, NULL, schedule_worker, s->dev[i]) == 0)
+			s->dev[i]->started = 1;
+	}
+	for(i = 0; i < s->ndev; i++)
+	{
+		if(s->dev[i]->started)
+			pthread_join(s->dev[i]->thread, NULL);
+	}
+
+	printf("%-16s %-10s %-4s %-8s %-6s %-10s %s\r\n", "Device", "Chip", "Bus", "Result", "Steps", "Wait", "Time");
+	for(i = 0; i < s->ndev; i++)
+	{
+		struct schedule_dev_t * d = s->dev[i];
+		printf("%-16s %-10s %-4d %-8s %2d/%-3d %8.3f s %.3f s\r\n", d->path, d->ctx.chip->name, d->bus,
+			(d->started && d->ret) ? "OK" : "FAILED", d->step, d->job->nline, d->wait, d->time);
+		if(!d->started || !d->ret)
+			nfail++;
+		if(d->ctx.hdl)
+		{
+			libusb_release_interface(d->ctx.hdl, 0);
+			libusb_close(d->ctx.hdl);
+		}
+		free(d);
+	}
+	pthread_cond_destroy(&s->cond);
+	pthread_mutex_destroy(&s->lock);
+	schedule_jobs_free(s);
+	count = s->ndev;
+	free(s);
+	return ((count > 0) && (nfail == 0)) ? 1 : 0;
+}
@@ -0,0 +1,28 @@
+#ifndef __SCHEDULE_H__
+#define __SCHEDULE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <rock.h>
+#include <pthread.h>
+
+/*
+ * Station job scheduler, a job file maps usb port paths to command lists.
+ * Chips run in parallel, but bulk heavy steps are limited per usb bus, the
+ * host controller, and the waiting step with the least data goes first.
+ */
+#define SCHEDULE_MAX_JOBS		(64)
+#define SCHEDULE_MAX_LINES		(256)
+#define SCHEDULE_MAX_DEVICES	(64)
+
+typedef int (*schedule_exec_t)(struct xrock_ctx_t * ctx, const char * line);
+
+int xrock_schedule(libusb_context * context, const char * jobfile, int perbus, schedule_exec_t exec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SCHEDULE_H__ */
@@ -0,0 +1,228 @@
+#include <scrub.h>
+
+struct scrub_chunk_t {
+	uint32_t sec;
+	uint32_t cnt;
+	uint32_t bad;
+	double latency;
+};
+
+struct scrub_ctx_t {
+	struct xrock_ctx_t * ctx;
+	uint32_t * bad;
+	uint32_t nbad;
+	uint32_t maxbad;
+	uint32_t block;
+	int failures;
+};
+
+static double scrub_time(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+static int scrub_add_bad(struct scrub_ctx_t * sctx, uint32_t sec)
+{
+	if(sctx->nbad >= sctx->maxbad)
+	{
+		uint32_t max = sctx->maxbad ? sctx->maxbad * 2 : 64;
+		uint32_t * bad = realloc(sctx->bad, max * sizeof(uint32_t));
+		if(!bad)
+			return 0;
+		sctx->bad = bad;
+		sctx->maxbad = max;
+	}
+	sctx->bad[sctx->nbad++] = sec;
+	return 1;
+}
+
+static void scrub_fill_marker(void * buf)
+{
+	int len = strlen(SCRUB_BAD_MARKER);
+
+	for(int i = 0; i < 512; i += len)
+		memcpy((char *)buf + i, SCRUB_BAD_MARKER, XMIN(len, 512 - i));
+}
+
+static int scrub_mark_bad(struct scrub_ctx_t * sctx, uint32_t sec, uint32_t cnt, void * buf)
+{
+	for(uint32_t i = 0; i < cnt; i++)
+	{
+		scrub_fill_marker(buf + (i << 9));
+		if(!scrub_add_bad(sctx, sec + i))
+			return -1;
+	}
+	return cnt;
+}
+
+/*
+ * Read [sec, sec + cnt), bisecting failed ranges down to the erase block.
+ * Only failed reads of a whole erase block count towards the limit, the
+ * larger ones above a single bad sector always fail too. Returns the number of bad sectors found, or -1 on host side errors.
+ */
+static int scrub_read(struct scrub_ctx_t * sctx, uint32_t sec, uint32_t cnt, void * buf)
+{
+	int l, r;
+
+	if(sctx->failures >= SCRUB_MAX_FAILURES)
+		return scrub_mark_bad(sctx, sec, cnt, buf);
+	if(rock_flash_read_lba_try(sctx->ctx, sec, cnt, buf))
+	{
+		sctx->failures = 0;
+		return 0;
+	}
+	if(cnt <= sctx->block)
+	{
+		sctx->failures++;
+		return scrub_mark_bad(sctx, sec, cnt, buf);
+	}
+	l = scrub_read(sctx, sec, cnt / 2, buf);
+	if(l < 0)
+		return -1;
+	r = scrub_read(sctx, sec + cnt / 2, cnt - cnt / 2, buf + ((cnt / 2) << 9));
+	if(r < 0)
+		return -1;
+	return l + r;
+}
+
+static int scrub_map_save(struct scrub_chunk_t * chunk, uint32_t nchunk, struct scrub_ctx_t * sctx, const char * map)
+{
+	const char * ext = strrchr(map, '.');
+	int json = (ext && !strcasecmp(ext, ".json")) ? 1 : 0;
+	FILE * f;
+	uint32_t i;
+
+	f = fopen(map, "w");
+	if(!f)
+		return 0;
+	if(json)
+	{
+		fprintf(f, "{\n\t\"chunks\": [\n");
+		for(i = 0; i < nchunk; i++)
+			fprintf(f, "\t\t{ \"sector\": %u, \"count\": %u, \"latency_ms\": %.3f, \"speed_kbs\": %.1f, \"bad\": %u }%s\n",
+				chunk[i].sec, chunk[i].cnt, chunk[i].latency * 1000.0,
+				chunk[i].latency > 0 ? ((double)chunk[i].cnt / 2.0) / chunk[i].latency : 0.0,
+				chunk[i].bad, (i + 1 < nchunk) ? "," : "");
+		fprintf(f, "\t],\n\t\"bad_sectors\": [");
+		for(i = 0; i < sctx->nbad; i++)
+			fprintf(f, "%s%u", i ? ", " : "", sctx->bad[i]);
+		fprintf(f, "]\n}\n");
+	}
+	else
+	{
+		fprintf(f, "sector,count,latency_ms,speed_kbs,bad\n");
+		for(i = 0; i < nchunk; i++)
+			fprintf(f, "%u,%u,%.3f,%.1f,%u\n", chunk[i].sec, chunk[i].cnt, chunk[i].latency * 1000.0,
+				chunk[i].latency > 0 ? ((double)chunk[i].cnt / 2.0) / chunk[i].latency : 0.0, chunk[i].bad);
+	}
+	if(fclose(f) != 0)
+		return 0;
+	return 1;
+}
+
+int rock_flash_scrub_progress(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt, const char * map, const char * filename, struct scrub_report_t * report)
+{
+	struct scrub_ctx_t sctx;
+	struct scrub_chunk_t * chunk;
+	struct progress_t p;
+	uint32_t nchunk, i, slowest = 0;
+	double t, total = 0;
+	void * buf;
+	FILE * f = NULL;
+	int bad, ret = 1;
+
+	nchunk = (cnt + SCRUB_CHUNK_SECTORS - 1) / SCRUB_CHUNK_SECTORS;
+	chunk = calloc(XMAX(nchunk, (uint32_t)1), sizeof(struct scrub_chunk_t));
+	if(!chunk)
+	{
+		ctx->error = XROCK_ERROR_NOMEM;
+		return 0;
+	}
+	buf = malloc(SCRUB_CHUNK_SECTORS << 9);
+	if(!buf)
+	{
+		ctx->error = XROCK_ERROR_NOMEM;
+		free(chunk);
+		return 0;
+	}
+	if(filename)
+	{
+		f = fopen(filename, "wb");
+		if(!f)
+		{
+			ctx->error = XROCK_ERROR_FILE;
+			free(buf);
+			free(chunk);
+			return 0;
+		}
+	}
+	memset(&sctx, 0, sizeof(struct scrub_ctx_t));
+	sctx.ctx = ctx;
+	sctx.block = rock_flash_erase_block(ctx, NULL);
+	if(sctx.block == 0)
+		sctx.block = 1;
+
+	rock_progress_start(ctx, &p, (uint64_t)cnt << 9);
+	for(i = 0; i < nchunk; i++)
+	{
+		uint32_t n = XMIN(cnt - i * SCRUB_CHUNK_SECTORS, (uint32_t)SCRUB_CHUNK_SECTORS);
+		chunk[i].sec = sec + i * SCRUB_CHUNK_SECTORS;
+		chunk[i].cnt = n;
+		sctx.failures = 0;
+		t = scrub_time();
+		bad = scrub_read(&sctx, chunk[i].sec, n, buf);
+		chunk[i].latency = scrub_time() - t;
+		if(bad < 0)
+		{
+			ctx->error = XROCK_ERROR_NOMEM;
+			ret = 0;
+			break;
+		}
+		chunk[i].bad = bad;
+		total += chunk[i].latency;
+		if(chunk[i].latency > chunk[slowest].latency)
+			slowest = i;
+		if(f && (fwrite(buf, 512, n, f) != n))
+		{
+			ctx->error = XROCK_ERROR_FILE;
+			ret = 0;
+			break;
+		}
+		progress_update(&p, (uint64_t)n << 9);
+	}
+	progress_stop(&p);
+
+	if(ret)
+	{
+		if(scrub_map_save(chunk, nchunk, &sctx, map))
+		{
+			/* The bad reads were expected, don't leave their code behind */
+			ctx->error = XROCK_ERROR_NONE;
+			if(report)
+			{
+				report->nchunk = nchunk;
+				report->nbad = sctx.nbad;
+				report->bad = sctx.bad;
+				report->average = nchunk ? total / nchunk : 0.0;
+				report->slowest = chunk[slowest].latency;
+				report->slowest_sector = chunk[slowest].sec;
+				sctx.bad = NULL;
+			}
+		}
+		else
+		{
+			ctx->error = XROCK_ERROR_FILE;
+			ret = 0;
+		}
+	}
+
+	if(f)
+		fclose(f);
+	if(sctx.bad)
+		free(sctx.bad);
+	free(buf);
+	free(chunk);
+	return ret;
+}
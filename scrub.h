@@ -0,0 +1,42 @@
+#ifndef __SCRUB_H__
+#define __SCRUB_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <rock.h>
+
+/*
+ * Flash scrub reads the whole region chunk by chunk, records the read latency
+ * of every chunk into a heatmap (csv, or json when the name ends with '.json')
+ * and bisects failed chunks down to the bad sectors instead of aborting. Bad
+ * sectors are filled with a marker in the optional image file. Bisection
+ * stops at the erase block size, and after a run of failed erase block reads
+ * in a chunk the rest of it is marked bad without reading, so a dead part
+ * can't keep the scrub waiting on timeouts for hours.
+ */
+#define SCRUB_CHUNK_SECTORS		(2048)
+#define SCRUB_MAX_FAILURES		(16)
+#define SCRUB_BAD_MARKER		"XROCK-BAD-SECTOR"
+
+/*
+ * Summary of a finished scrub, the bad sector list is allocated for the
+ * caller, who must free it.
+ */
+struct scrub_report_t {
+	uint32_t nchunk;
+	uint32_t nbad;
+	uint32_t * bad;
+	double average;
+	double slowest;
+	uint32_t slowest_sector;
+};
+
+int rock_flash_scrub_progress(struct xrock_ctx_t * ctx, uint32_t sec, uint32_t cnt, const char * map, const char * filename, struct scrub_report_t * report);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SCRUB_H__ */
@@ -0,0 +1,841 @@
+#include <serve.h>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#define SERVE_MAX_PARAMS		(32)
+#define SERVE_MAX_ARGS			(64)
+
+struct serve_device_t {
+	struct xrock_ctx_t ctx;
+	libusb_device * device;
+	struct serve_job_t * job;
+	char path[32];
+	int gone;
+};
+
+struct serve_client_t {
+	int fd;
+	int jobs;
+	int closed;
+	size_t len;
+	char buf[SERVE_MAX_LINE];
+};
+
+struct serve_request_t {
+	char id[64];
+	char * key[SERVE_MAX_PARAMS];
+	char * value[SERVE_MAX_PARAMS];
+	int nparam;
+	char * args[SERVE_MAX_ARGS + 1];
+	int nargs;
+	char store[SERVE_MAX_LINE];
+};
+
+struct serve_job_t {
+	pthread_t thread;
+	struct serve_ctx_t * sctx;
+	struct serve_client_t * client;
+	struct serve_request_t * req;
+	struct serve_device_t * dev;
+	double last;
+	int done;
+};
+
+struct serve_ctx_t {
+	libusb_context * context;
+	serve_exec_t exec;
+	struct serve_device_t * device[SERVE_MAX_DEVICES];
+	struct serve_client_t * client[SERVE_MAX_CLIENTS];
+	int fd;
+	int rescan;
+};
+
+static volatile sig_atomic_t serve_running;
+
+/*
+ * Jobs run on their own threads and reply on their client's socket, the lock
+ * keeps lines from different threads whole and guards the job done flags.
+ */
+static pthread_mutex_t serve_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void serve_signal(int sig)
+{
+	serve_running = 0;
+}
+
+static double serve_time(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+static const char * json_skip(const char * p)
+{
+	while(isspace((unsigned char)*p))
+		p++;
+	return p;
+}
+
+static const char * json_string(const char * p, char ** out, char ** store)
+{
+	char * o = *store;
+	unsigned int v;
+
+	p++;
+	while(*p && (*p != '"'))
+	{
+		if(*p == '\\')
+		{
+			p++;
+			switch(*p)
+			{
+			case 'n': *o++ = '\n'; break;
+			case 'r': *o++ = '\r'; break;
+			case 't': *o++ = '\t'; break;
+			case 'b': *o++ = '\b'; break;
+			case 'f': *o++ = '\f'; break;
+			case 'u':
+				if(!isxdigit((unsigned char)p[1]) || !isxdigit((unsigned char)p[2]) || !isxdigit((unsigned char)p[3]) || !isxdigit((unsigned char)p[4]))
+					return NULL;
+				sscanf(p + 1, "%4x", &v);
+				*o++ = (v < 0x80) ? v : '?';
+				p += 4;
+				break;
+			case '\0':
+				return NULL;
+			default:
+				*o++ = *p;
+				break;
+			}
+			p++;
+		}
+		else
+			*o++ = *p++;
+	}
+	if(*p != '"')
+		return NULL;
+	*o++ = '\0';
+	*out = *store;
+	*store = o;
+	return p + 1;
+}
+
+static const char * json_scalar(const char * p, char ** out, char ** store)
+{
+	char * o = *store;
+
+	while(isalnum((unsigned char)*p) || (*p == '-') || (*p == '+') || (*p == '.'))
+		*o++ = *p++;
+	if(o == *store)
+		return NULL;
+	*o++ = '\0';
+	*out = *store;
+	*store = o;
+	return p;
+}
+
+static char * json_escape(char * buf, size_t len, const char * s)
+{
+	size_t o = 0;
+
+	while(*s && (o + 7 < len))
+	{
+		unsigned char c = *s++;
+		if((c == '"') || (c == '\\'))
+		{
+			buf[o++] = '\\';
+			buf[o++] = c;
+		}
+		else if(c < 0x20)
+			o += sprintf(buf + o, "\\u%04x", c);
+		else
+			buf[o++] = c;
+	}
+	buf[o] = '\0';
+	return buf;
+}
+
+/*
+ * Parse a flat json object, string and scalar members become named parameters
+ * and the members of the 'args' array become the command line for 'exec'.
+ */
+static int serve_parse(struct serve_request_t * req, const char * line)
+{
+	char * store = req->store;
+	char * key, * val;
+	const char * p, * v;
+
+	req->id[0] = '\0';
+	req->nparam = 0;
+	req->nargs = 0;
+	p = json_skip(line);
+	if(*p != '{')
+		return 0;
+	p = json_skip(p + 1);
+	if(*p == '}')
+		return 1;
+	while(1)
+	{
+		if((*p != '"') || !(p = json_string(p, &key, &store)))
+			return 0;
+		p = json_skip(p);
+		if(*p != ':')
+			return 0;
+		p = json_skip(p + 1);
+		v = p;
+		if(*p == '"')
+			p = json_string(p, &val, &store);
+		else if(*p == '[')
+		{
+			p = json_skip(p + 1);
+			while(p && (*p != ']'))
+			{
+				p = (*p == '"') ? json_string(p, &val, &store) : json_scalar(p, &val, &store);
+				if(!p)
+					return 0;
+				if(!strcmp(key, "args") && (req->nargs < SERVE_MAX_ARGS))
+					req->args[req->nargs++] = val;
+				p = json_skip(p);
+				if(*p == ',')
+					p = json_skip(p + 1);
+				else if(*p != ']')
+					return 0;
+			}
+			if(!p)
+				return 0;
+			p++;
+			val = NULL;
+		}
+		else
+			p = json_scalar(p, &val, &store);
+		if(!p)
+			return 0;
+		if(!strcmp(key, "id"))
+		{
+			if(p - v < sizeof(req->id))
+				snprintf(req->id, sizeof(req->id), "%.*s", (int)(p - v), v);
+		}
+		else if(val && (req->nparam < SERVE_MAX_PARAMS))
+		{
+			req->key[req->nparam] = key;
+			req->value[req->nparam] = val;
+			req->nparam++;
+		}
+		p = json_skip(p);
+		if(*p == ',')
+			p = json_skip(p + 1);
+		else if(*p == '}')
+			return 1;
+		else
+			return 0;
+	}
+}
+
+static const char * serve_param(struct serve_request_t * req, const char * key)
+{
+	for(int i = 0; i < req->nparam; i++)
+	{
+		if(!strcmp(req->key[i], key))
+			return req->value[i];
+	}
+	return NULL;
+}
+
+static uint32_t serve_param_uint(struct serve_request_t * req, const char * key, uint32_t def)
+{
+	const char * v = serve_param(req, key);
+	return v ? strtoul(v, NULL, 0) : def;
+}
+
+static void serve_send(int fd, const char * fmt, ...)
+{
+	char buf[8192];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof(buf) - 1, fmt, ap);
+	va_end(ap);
+	if(len < 0)
+		return;
+	if(len > sizeof(buf) - 2)
+		len = sizeof(buf) - 2;
+	buf[len++] = '\n';
+	pthread_mutex_lock(&serve_lock);
+	for(int o = 0, n; o < len; o += n)
+	{
+		n = send(fd, buf + o, len - o, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if((n < 0) && (errno == EINTR))
+			n = 0;
+		else if(n <= 0)
+		{
+			/*
+			 * The client does not keep up reading, drop it instead of stalling the
+			 * loop for everyone, the poll loop sees the hangup and frees it
+			 */
+			shutdown(fd, SHUT_RDWR);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&serve_lock);
+}
+
+static void serve_reply(int fd, struct serve_request_t * req, int ok, const char * extra)
+{
+	serve_send(fd, "{\"id\":%s,\"ok\":%s%s%s}", req->id[0] ? req->id : "null", ok ? "true" : "false", (extra && extra[0]) ? "," : "", extra ? extra : "");
+}
+
+static void serve_error(int fd, struct serve_request_t * req, const char * msg)
+{
+	char buf[512];
+
+	snprintf(buf, sizeof(buf), "\"error\":\"%s\"", msg);
+	serve_reply(fd, req, 0, buf);
+}
+
+static void serve_broadcast(struct serve_ctx_t * sctx, const char * event, struct serve_device_t * dev)
+{
+	for(int i = 0; i < SERVE_MAX_CLIENTS; i++)
+	{
+		if(sctx->client[i] && !sctx->client[i]->closed)
+			serve_send(sctx->client[i]->fd, "{\"event\":\"%s\",\"device\":\"%s\",\"chip\":\"%s\",\"maskrom\":%s}",
+				event, dev->path, dev->ctx.chip->name, dev->ctx.maskrom ? "true" : "false");
+	}
+}
+
+static void serve_device_close(struct serve_device_t * dev)
+{
+	if(dev->ctx.hdl)
+	{
+		libusb_release_interface(dev->ctx.hdl, 0);
+		libusb_close(dev->ctx.hdl);
+	}
+	libusb_unref_device(dev->device);
+	free(dev);
+}
+
+/*
+ * Sync the device table with the bus, held devices keep a reference so their
+ * libusb_device pointer stays unique until they are gone.
+ */
+static void serve_scan(struct serve_ctx_t * sctx)
+{
+	libusb_device ** list = NULL;
+	int count, i, j, found;
+
+	sctx->rescan = 0;
+	count = libusb_get_device_list(sctx->context, &list);
+	for(i = 0; i < SERVE_MAX_DEVICES; i++)
+	{
+		if(sctx->device[i] && !sctx->device[i]->gone)
+		{
+			for(j = 0, found = 0; (j < count) && !found; j++)
+				found = (list[j] == sctx->device[i]->device) ? 1 : 0;
+			if(!found)
+			{
+				serve_broadcast(sctx, "detach", sctx->device[i]);
+				if(sctx->device[i]->job)
+					sctx->device[i]->gone = 1;
+				else
+				{
+					serve_device_close(sctx->device[i]);
+					sctx->device[i] = NULL;
+				}
+			}
+		}
+	}
+	for(j = 0; j < count; j++)
+	{
+		if(!xrock_probe(list[j]))
+			continue;
+		for(i = 0, found = 0; (i < SERVE_MAX_DEVICES) && !found; i++)
+			found = (sctx->device[i] && (sctx->device[i]->device == list[j])) ? 1 : 0;
+		if(found)
+			continue;
+		for(i = 0; (i < SERVE_MAX_DEVICES) && sctx->device[i]; i++);
+		if(i >= SERVE_MAX_DEVICES)
+			break;
+		struct serve_device_t * dev = calloc(1, sizeof(struct serve_device_t));
+		if(!dev)
+			break;
+		dev->ctx.context = sctx->context;
+		if(xrock_open(&dev->ctx, list[j]))
+		{
+			dev->device = libusb_ref_device(list[j]);
+			xrock_path(list[j], dev->path, sizeof(dev->path));
+			sctx->device[i] = dev;
+			serve_broadcast(sctx, "attach", dev);
+		}
+		else
+		{
+			if(dev->ctx.hdl)
+				libusb_close(dev->ctx.hdl);
+			free(dev);
+		}
+	}
+	if(list)
+		libusb_free_device_list(list, 1);
+}
+
+static int LIBUSB_CALL serve_hotplug(libusb_context * context, libusb_device * device, libusb_hotplug_event event, void * data)
+{
+	struct serve_ctx_t * sctx = (struct serve_ctx_t *)data;
+
+	sctx->rescan = 1;
+	return 0;
+}
+
+static struct serve_device_t * serve_find(struct serve_ctx_t * sctx, const char * path)
+{
+	struct serve_device_t * dev = NULL;
+	int n = 0;
+
+	for(int i = 0; i < SERVE_MAX_DEVICES; i++)
+	{
+		if(sctx->device[i] && !sctx->device[i]->gone)
+		{
+			if(path && !strcmp(sctx->device[i]->path, path))
+				return sctx->device[i];
+			dev = sctx->device[i];
+			n++;
+		}
+	}
+	return (!path && (n == 1)) ? dev : NULL;
+}
+
+static void serve_progress(void * data, uint64_t done, uint64_t total, double speed)
+{
+	struct serve_job_t * job = (struct serve_job_t *)data;
+	double now = serve_time();
+
+	if((done < total) && (now - job->last < 0.1))
+		return;
+	job->last = now;
+	serve_send(job->client->fd, "{\"event\":\"progress\",\"id\":%s,\"device\":\"%s\",\"done\":%llu,\"total\":%llu,\"speed\":%.0f}",
+		job->req->id[0] ? job->req->id : "null", job->dev->path, (unsigned long long)done, (unsigned long long)total, speed);
+}
+
+static int serve_flash_range(struct xrock_ctx_t * ctx, struct serve_request_t * req, uint32_t * sec, uint32_t * cnt, uint32_t * total)
+{
+	struct flash_info_t info;
+
+	if(!rock_flash_detect(ctx, &info))
+		return 0;
+	*sec = serve_param_uint(req, "sector", 0);
+	*total = info.sector_total;
+	if(*sec >= info.sector_total)
+		return 0;
+	if(cnt)
+	{
+		*cnt = serve_param_uint(req, "count", 0);
+		if((*cnt == 0) || (*cnt > info.sector_total - *sec))
+			*cnt = info.sector_total - *sec;
+	}
+	return 1;
+}
+
+static void serve_command(struct serve_ctx_t * sctx, struct serve_device_t * dev, int fd, struct serve_request_t * req, const char * cmd)
+{
+	struct xrock_ctx_t * ctx = &dev->ctx;
+	char extra[4096], str[1200];
+	uint8_t buf[512];
+	uint32_t sec, cnt, total;
+	const char * v;
+	int ok = 0;
+
+	extra[0] = '\0';
+	if(!strcmp(cmd, "ready"))
+		ok = rock_ready(ctx);
+	else if(!strcmp(cmd, "version") || !strcmp(cmd, "capability"))
+	{
+		ok = !strcmp(cmd, "version") ? rock_version(ctx, buf) : rock_capability(ctx, buf);
+		if(ok)
+		{
+			for(int i = 0; i < (!strcmp(cmd, "version") ? 16 : 8); i++)
+				sprintf(str + i * 2, "%02x", buf[i]);
+			snprintf(extra, sizeof(extra), "\"%s\":\"%s\"", cmd, str);
+		}
+	}
+	else if(!strcmp(cmd, "reset"))
+	{
+		v = serve_param(req, "maskrom");
+		ok = rock_reset(ctx, (v && !strcmp(v, "true")) ? 1 : 0);
+	}
+	else if(!strcmp(cmd, "storage"))
+	{
+		enum storage_type_t type = rock_storage_read(ctx);
+		snprintf(extra, sizeof(extra), "\"storage\":%d", type);
+		ok = 1;
+	}
+	else if(!strcmp(cmd, "flash-info"))
+	{
+		struct flash_info_t info;
+		ok = rock_flash_detect(ctx, &info);
+		if(ok)
+			snprintf(extra, sizeof(extra), "\"sector_total\":%u,\"block_size\":%u,\"page_size\":%u,\"ecc_bits\":%u,\"manufacturer\":%u,\"id\":\"%02x%02x%02x%02x%02x\"",
+				info.sector_total, info.block_size, info.page_size, info.ecc_bits, info.manufacturer_id,
+				info.id[0], info.id[1], info.id[2], info.id[3], info.id[4]);
+	}
+	else if(!strcmp(cmd, "flash-read") && serve_param(req, "file"))
+	{
+		if(serve_flash_range(ctx, req, &sec, &cnt, &total))
+			ok = rock_flash_read_lba_to_file_progress(ctx, sec, cnt, serve_param(req, "file"));
+	}
+	else if(!strcmp(cmd, "flash-write") && serve_param(req, "file"))
+	{
+		if(serve_flash_range(ctx, req, &sec, NULL, &total))
+			ok = rock_flash_write_lba_from_file_progress(ctx, sec, total, serve_param(req, "file"));
+	}
+	else if(!strcmp(cmd, "flash-erase"))
+	{
+		if(serve_flash_range(ctx, req, &sec, &cnt, &total))
+			ok = rock_flash_erase_lba_progress(ctx, sec, cnt);
+	}
+	else if(!strcmp(cmd, "sn"))
+	{
+		char sn[512 - 8 + 1];
+		v = serve_param(req, "sn");
+		if(v)
+		{
+			strncpy(sn, v, sizeof(sn) - 1);
+			sn[sizeof(sn) - 1] = '\0';
+			ok = rock_sn_write(ctx, sn);
+		}
+		else if((ok = rock_sn_read(ctx, sn)))
+			snprintf(extra, sizeof(extra), "\"sn\":\"%s\"", json_escape(str, sizeof(str), sn));
+	}
+	else if(!strcmp(cmd, "vs-read"))
+	{
+		int len = XMIN((int)serve_param_uint(req, "length", 512), 512);
+		if((len > 0) && (ok = rock_vs_read(ctx, serve_param_uint(req, "type", 0), serve_param_uint(req, "index", 0), buf, len)))
+		{
+			for(int i = 0; i < len; i++)
+				sprintf(str + i * 2, "%02x", buf[i]);
+			snprintf(extra, sizeof(extra), "\"data\":\"%s\"", str);
+		}
+	}
+	else if(!strcmp(cmd, "vs-write") && serve_param(req, "data"))
+	{
+		v = serve_param(req, "data");
+		int len = XMIN((int)strlen(v) / 2, 512);
+		for(int i = 0; i < len; i++)
+			buf[i] = hex_string(v, i * 2);
+		if(len > 0)
+			ok = rock_vs_write(ctx, serve_param_uint(req, "type", 0), serve_param_uint(req, "index", 0), buf, len);
+	}
+	else if(!strcmp(cmd, "exec") && (req->nargs > 0) && sctx->exec)
+	{
+		static char name[] = "xrock";
+		char * argv[SERVE_MAX_ARGS + 1];
+		argv[0] = name;
+		for(int i = 0; i < req->nargs; i++)
+			argv[i + 1] = req->args[i];
+		fflush(stdout);
+		ok = sctx->exec(ctx, req->nargs + 1, argv);
+		fflush(stdout);
+	}
+	else
+	{
+		serve_error(fd, req, "unknown command");
+		return;
+	}
+	serve_reply(fd, req, ok, extra);
+}
+
+static void * serve_worker(void * data)
+{
+	struct serve_job_t * job = (struct serve_job_t *)data;
+
+	progress_set_hook(serve_progress, job);
+	serve_command(job->sctx, job->dev, job->client->fd, job->req, serve_param(job->req, "cmd"));
+	progress_set_hook(NULL, NULL);
+	pthread_mutex_lock(&serve_lock);
+	job->done = 1;
+	pthread_mutex_unlock(&serve_lock);
+	return NULL;
+}
+
+static void serve_client_close(struct serve_ctx_t * sctx, int idx)
+{
+	struct serve_client_t * c = sctx->client[idx];
+
+	if(c->jobs > 0)
+	{
+		/*
+		 * A running job still replies on this socket, keep the fd until it is reaped
+		 */
+		shutdown(c->fd, SHUT_RDWR);
+		c->closed = 1;
+		return;
+	}
+	close(c->fd);
+	free(c);
+	sctx->client[idx] = NULL;
+}
+
+/*
+ * Join the finished jobs, or all of them when the server stops
+ */
+static void serve_reap(struct serve_ctx_t * sctx, int wait)
+{
+	struct serve_device_t * dev;
+	struct serve_job_t * job;
+	int done;
+
+	for(int i = 0; i < SERVE_MAX_DEVICES; i++)
+	{
+		dev = sctx->device[i];
+		if(!dev || !(job = dev->job))
+			continue;
+		pthread_mutex_lock(&serve_lock);
+		done = job->done;
+		pthread_mutex_unlock(&serve_lock);
+		if(!done && !wait)
+			continue;
+		pthread_join(job->thread, NULL);
+		dev->job = NULL;
+		job->client->jobs--;
+		for(int j = 0; j < SERVE_MAX_CLIENTS; j++)
+		{
+			if((sctx->client[j] == job->client) && job->client->closed)
+				serve_client_close(sctx, j);
+		}
+		free(job->req);
+		free(job);
+		if(dev->gone)
+		{
+			serve_device_close(dev);
+			sctx->device[i] = NULL;
+		}
+	}
+}
+
+static void serve_request(struct serve_ctx_t * sctx, struct serve_client_t * c, const char * line)
+{
+	struct serve_request_t * req;
+	struct serve_device_t * dev;
+	struct serve_job_t * job;
+	char extra[8192];
+	int fd = c->fd;
+	const char * cmd;
+	int o = 0;
+
+	req = malloc(sizeof(struct serve_request_t));
+	if(!req)
+		return;
+	if(!serve_parse(req, line) || !(cmd = serve_param(req, "cmd")))
+	{
+		serve_error(fd, req, "invalid request");
+		free(req);
+		return;
+	}
+	if(!strcmp(cmd, "devices"))
+	{
+		o += snprintf(extra + o, sizeof(extra) - o, "\"devices\":[");
+		for(int i = 0, n = 0; i < SERVE_MAX_DEVICES; i++)
+		{
+			dev = sctx->device[i];
+			if(dev && !dev->gone)
+				o += snprintf(extra + o, sizeof(extra) - o, "%s{\"device\":\"%s\",\"chip\":\"%s\",\"maskrom\":%s}",
+					n++ ? "," : "", dev->path, dev->ctx.chip->name, dev->ctx.maskrom ? "true" : "false");
+		}
+		snprintf(extra + o, sizeof(extra) - o, "]");
+		serve_reply(fd, req, 1, extra);
+	}
+	else if(!(dev = serve_find(sctx, serve_param(req, "device"))))
+		serve_error(fd, req, "no such device");
+	else if(dev->job)
+		serve_error(fd, req, "device busy");
+	else if(!(job = calloc(1, sizeof(struct serve_job_t))))
+		serve_error(fd, req, "out of memory");
+	else
+	{
+		/*
+		 * The chip runs the request on its own thread, the loop keeps serving
+		 * the other clients, the other chips and hotplug meanwhile
+		 */
+		job->sctx = sctx;
+		job->client = c;
+		job->req = req;
+		job->dev = dev;
+		if(pthread_create(&job->thread, NULL, serve_worker, job) == 0)
+		{
+			dev->job = job;
+			c->jobs++;
+			return;
+		}
+		free(job);
+		serve_error(fd, req, "can't start job");
+	}
+	free(req);
+}
+
+static void serve_client_read(struct serve_ctx_t * sctx, int idx)
+{
+	struct serve_client_t * c = sctx->client[idx];
+	char * p, * e;
+	ssize_t n;
+
+	n = recv(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len, 0);
+	if((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)))
+		return;
+	if(n <= 0)
+	{
+		serve_client_close(sctx, idx);
+		return;
+	}
+	c->len += n;
+	c->buf[c->len] = '\0';
+	p = c->buf;
+	while((e = strchr(p, '\n')))
+	{
+		*e = '\0';
+		if(*json_skip(p))
+			serve_request(sctx, c, p);
+		p = e + 1;
+	}
+	c->len -= p - c->buf;
+	memmove(c->buf, p, c->len);
+	if(c->len >= sizeof(c->buf) - 1)
+		c->len = 0;
+}
+
+int xrock_serve(libusb_context * context, const char * path, serve_exec_t exec)
+{
+	struct serve_ctx_t sctx;
+	struct sockaddr_un addr;
+	struct pollfd pfd[SERVE_MAX_CLIENTS + 1];
+	struct timeval tv = { 0, 0 };
+	libusb_hotplug_callback_handle hotplug;
+	struct stat st;
+	mode_t mask;
+	int hashotplug = 0;
+	double last = 0;
+	int i, n, ret;
+
+	if(strlen(path) >= sizeof(addr.sun_path))
+		return 0;
+	memset(&sctx, 0, sizeof(struct serve_ctx_t));
+	sctx.context = context;
+	sctx.exec = exec;
+	sctx.fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(sctx.fd < 0)
+		return 0;
+	if((stat(path, &st) == 0) && S_ISSOCK(st.st_mode))
+		unlink(path);
+	memset(&addr, 0, sizeof(struct sockaddr_un));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	/*
+	 * The socket can flash any attached chip, only the owner and the group may connect
+	 */
+	mask = umask(0117);
+	ret = bind(sctx.fd, (struct sockaddr *)&addr, sizeof(struct sockaddr_un));
+	umask(mask);
+	if((ret != 0) || (listen(sctx.fd, 8) != 0))
+	{
+		close(sctx.fd);
+		return 0;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, serve_signal);
+	signal(SIGTERM, serve_signal);
+	if(libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG))
+	{
+		if(libusb_hotplug_register_callback(context, LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT,
+			LIBUSB_HOTPLUG_NO_FLAGS, 0x2207, LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY, serve_hotplug, &sctx, &hotplug) == 0)
+			hashotplug = 1;
+	}
+	serve_scan(&sctx);
+	printf("Serving on '%s'\r\n", path);
+	fflush(stdout);
+
+	serve_running = 1;
+	while(serve_running)
+	{
+		pfd[0].fd = sctx.fd;
+		pfd[0].events = POLLIN;
+		for(i = 0, n = 1; i < SERVE_MAX_CLIENTS; i++)
+		{
+			if(sctx.client[i] && !sctx.client[i]->closed)
+			{
+				pfd[n].fd = sctx.client[i]->fd;
+				pfd[n].events = POLLIN;
+				n++;
+			}
+		}
+		if(poll(pfd, n, 200) > 0)
+		{
+			for(i = 0, n = 1; i < SERVE_MAX_CLIENTS; i++)
+			{
+				if(sctx.client[i] && !sctx.client[i]->closed)
+				{
+					if(pfd[n].revents & (POLLIN | POLLHUP | POLLERR))
+						serve_client_read(&sctx, i);
+					n++;
+				}
+			}
+			if(pfd[0].revents & POLLIN)
+			{
+				int fd = accept(sctx.fd, NULL, NULL);
+				if(fd >= 0)
+					fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+				for(i = 0; (i < SERVE_MAX_CLIENTS) && sctx.client[i]; i++);
+				if((fd >= 0) && (i < SERVE_MAX_CLIENTS) && (sctx.client[i] = malloc(sizeof(struct serve_client_t))))
+				{
+					sctx.client[i]->fd = fd;
+					sctx.client[i]->jobs = 0;
+					sctx.client[i]->closed = 0;
+					sctx.client[i]->len = 0;
+				}
+				else if(fd >= 0)
+					close(fd);
+			}
+		}
+		libusb_handle_events_timeout_completed(context, &tv, NULL);
+		serve_reap(&sctx, 0);
+		if(sctx.rescan || (!hashotplug && (serve_time() - last > 1.0)))
+		{
+			serve_scan(&sctx);
+			last = serve_time();
+		}
+	}
+
+	serve_reap(&sctx, 1);
+	if(hashotplug)
+		libusb_hotplug_deregister_callback(context, hotplug);
+	for(i = 0; i < SERVE_MAX_CLIENTS; i++)
+	{
+		if(sctx.client[i])
+		{
+			close(sctx.client[i]->fd);
+			free(sctx.client[i]);
+		}
+	}
+	for(i = 0; i < SERVE_MAX_DEVICES; i++)
+	{
+		if(sctx.device[i])
+			serve_device_close(sctx.device[i]);
+	}
+	close(sctx.fd);
+	unlink(path);
+	return 1;
+}
+#else
+int xrock_serve(libusb_context * context, const char * path, serve_exec_t exec)
+{
+	printf("ERROR: The serve command is not supported on this platform\r\n");
+	return 0;
+}
+#endif
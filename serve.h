@@ -0,0 +1,27 @@
+#ifndef __SERVE_H__
+#define __SERVE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <rock.h>
+
+/*
+ * Long running daemon keeping every attached chip open, requests and replies
+ * are json objects, one per line, on a unix domain socket. Attach, detach and
+ * progress are pushed to the clients as events.
+ */
+#define SERVE_MAX_DEVICES		(32)
+#define SERVE_MAX_CLIENTS		(16)
+#define SERVE_MAX_LINE			(64 * 1024)
+
+typedef int (*serve_exec_t)(struct xrock_ctx_t * ctx, int argc, char * argv[]);
+
+int xrock_serve(libusb_context * context, const char * path, serve_exec_t exec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __SERVE_H__ */
@@ -0,0 +1,82 @@
+/*
+ * Host side check of the crc16 and crc32 paths, the slicing-by-8, the carry
+ * less multiply folding and the multithreaded sums must be bit exact with the
+ * byte table loop for random lengths, unaligned starts and every tail length.
+ * The sources are included to reach their static paths.
+ */
+#include "../crc16.c"
+#include "../crc32.c"
+
+#define CRC_CHECK_ROUNDS		(4096)
+#define CRC_CHECK_SIZE			(64 * 1024)
+#define CRC_CHECK_LARGE			(40 * 1024 * 1024 + 13)
+
+static uint32_t crc_check_seed = 0x2545f491;
+
+static uint32_t crc_check_random(void)
+{
+	crc_check_seed ^= crc_check_seed << 13;
+	crc_check_seed ^= crc_check_seed >> 17;
+	crc_check_seed ^= crc_check_seed << 5;
+	return crc_check_seed;
+}
+
+static int crc_check_fail(const char * path, int off, int len)
+{
+	printf("FAIL: %s at offset %d, length %d\r\n", path, off, len);
+	return 1;
+}
+
+int main(int argc, char * argv[])
+{
+	uint8_t * buf;
+	uint32_t init, c32;
+	uint16_t c16;
+	int off, len, fail = 0;
+
+	buf = malloc(CRC_CHECK_LARGE);
+	if(!buf)
+		return 1;
+	for(int i = 0; i < CRC_CHECK_LARGE; i++)
+		buf[i] = crc_check_random();
+	crc16_sum(0, buf, 0);
+	crc32_sum(0, buf, 0);
+
+	for(int i = 0; i < CRC_CHECK_ROUNDS; i++)
+	{
+		off = crc_check_random() & 15;
+		if(i & 1)
+			len = ((crc_check_random() % (CRC_CHECK_SIZE - 32)) & ~15) + (i >> 1) % 16;
+		else
+			len = crc_check_random() % (CRC_FOLD_MIN_LENGTH * 2);
+		init = crc_check_random();
+
+		c16 = crc16_sum_bytes(init, buf + off, len);
+		if(crc16_sum_slice(init, buf + off, len) != c16)
+			fail |= crc_check_fail("crc16 slice", off, len);
+		if(crc16_fold.fold && (len >= CRC_FOLD_MIN_LENGTH) && (crc16_sum_fold(init, buf + off, len) != c16))
+			fail |= crc_check_fail("crc16 fold", off, len);
+		if(crc16_sum(init, buf + off, len) != c16)
+			fail |= crc_check_fail("crc16 sum", off, len);
+
+		c32 = crc32_sum_bytes(init, buf + off, len);
+		if(crc32_sum_slice(init, buf + off, len) != c32)
+			fail |= crc_check_fail("crc32 slice", off, len);
+		if(crc32_fold.fold && (len >= CRC_FOLD_MIN_LENGTH) && (crc32_sum_fold(init, buf + off, len) != c32))
+			fail |= crc_check_fail("crc32 fold", off, len);
+		if(crc32_sum(init, buf + off, len) != c32)
+			fail |= crc_check_fail("crc32 sum", off, len);
+	}
+
+	off = 3;
+	len = CRC_CHECK_LARGE - off;
+	init = crc_check_random();
+	if(crc32_sum_parallel(init, buf + off, len) != crc32_sum_bytes(init, buf + off, len))
+		fail |= crc_check_fail("crc32 parallel", off, len);
+	free(buf);
+
+	if(!crc16_fold.fold || !crc32_fold.fold)
+		printf("No carry-less multiply on this cpu, the fold paths are not checked\r\n");
+	printf("%s\r\n", fail ? "Crc check failed" : "Crc check passed");
+	return fail ? 1 : 0;
+}
@@ -0,0 +1,267 @@
+/*
+ * Host side emulation of the _memmove routine in the arm64 maskrom write
+ * payload. The payload bytes are parsed from the array embedded in rock.c, so
+ * the check runs what is shipped, and only the few instructions the copy uses
+ * are decoded. Every size, alignment and overlap in both directions must give
+ * the same result as memmove() and leave the bytes around the range alone.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define MEMMOVE_ENTRY			(0xc)
+#define MEMMOVE_BASE			(0x10000)
+#define MEMMOVE_SIZE			(4096)
+#define MEMMOVE_RETURN			(0xdead0)
+#define MEMMOVE_MAX_STEPS		(1000000)
+
+struct a64_cpu_t {
+	uint64_t x[32];
+	uint64_t pc;
+	int z, c;
+	const uint8_t * code;
+	size_t ncode;
+	uint8_t * mem;
+	int unaligned;
+};
+
+static int64_t a64_sext(uint64_t v, int bits)
+{
+	return (int64_t)(v << (64 - bits)) >> (64 - bits);
+}
+
+static uint64_t a64_reg(struct a64_cpu_t * cpu, int r)
+{
+	return (r == 31) ? 0 : cpu->x[r];
+}
+
+static uint8_t * a64_mem(struct a64_cpu_t * cpu, uint64_t addr, int len)
+{
+	if((addr < MEMMOVE_BASE) || (addr + len > MEMMOVE_BASE + MEMMOVE_SIZE))
+		return NULL;
+	return cpu->mem + (addr - MEMMOVE_BASE);
+}
+
+static void a64_subs(struct a64_cpu_t * cpu, int rd, uint64_t a, uint64_t b)
+{
+	cpu->z = (a == b) ? 1 : 0;
+	cpu->c = (a >= b) ? 1 : 0;
+	if(rd != 31)
+		cpu->x[rd] = a - b;
+}
+
+static int a64_cond(struct a64_cpu_t * cpu, int cond)
+{
+	switch(cond)
+	{
+	case 0x0: return cpu->z;
+	case 0x1: return !cpu->z;
+	case 0x2: return cpu->c;
+	case 0x3: return !cpu->c;
+	case 0x8: return cpu->c && !cpu->z;
+	case 0x9: return !cpu->c || cpu->z;
+	default:
+		return -1;
+	}
+}
+
+/*
+ * Run from pc until the routine returns to the link register, zero on an
+ * unknown instruction, a stray access or a runaway loop
+ */
+static int a64_run(struct a64_cpu_t * cpu)
+{
+	uint32_t w;
+	uint64_t addr, off;
+	uint8_t * p;
+	int rd, rn, rt, t;
+
+	for(int steps = 0; steps < MEMMOVE_MAX_STEPS; steps++)
+	{
+		if(cpu->pc == MEMMOVE_RETURN)
+			return 1;
+		if((cpu->pc & 3) || (cpu->pc + 4 > cpu->ncode))
+			return 0;
+		w = cpu->code[cpu->pc] | (cpu->code[cpu->pc + 1] << 8) | (cpu->code[cpu->pc + 2] << 16) | ((uint32_t)cpu->code[cpu->pc + 3] << 24);
+		rd = w & 31;
+		rn = (w >> 5) & 31;
+		cpu->pc += 4;
+		if((w & 0xffe0ffe0) == 0xaa0003e0)
+			cpu->x[rd] = a64_reg(cpu, (w >> 16) & 31);
+		else if((w & 0xff200000) == 0xca000000)
+			cpu->x[rd] = a64_reg(cpu, rn) ^ a64_reg(cpu, (w >> 16) & 31);
+		else if((w & 0xff200000) == 0x8b000000)
+			cpu->x[rd] = a64_reg(cpu, rn) + a64_reg(cpu, (w >> 16) & 31);
+		else if((w & 0xffe0fc00) == 0xeb000000)
+			a64_subs(cpu, rd, a64_reg(cpu, rn), a64_reg(cpu, (w >> 16) & 31));
+		else if((w & 0xffc00000) == 0xf1000000)
+			a64_subs(cpu, rd, a64_reg(cpu, rn), (w >> 10) & 0xfff);
+		else if((w & 0xffc00000) == 0xd1000000)
+			cpu->x[rd] = a64_reg(cpu, rn) - ((w >> 10) & 0xfff);
+		else if(((w & 0xffff001f) == 0xf240001f) && (((w >> 10) & 63) < 63))
+		{
+			/* tst xn, #(2^k - 1), the only logical immediates the copy uses */
+			cpu->z = (a64_reg(cpu, rn) & ((2ULL << ((w >> 10) & 63)) - 1)) ? 0 : 1;
+			cpu->c = 0;
+		}
+		else if((w & 0xff000010) == 0x54000000)
+		{
+			if((t = a64_cond(cpu, w & 15)) < 0)
+				return 0;
+			if(t)
+				cpu->pc += 4 * a64_sext((w >> 5) & 0x7ffff, 19) - 4;
+		}
+		else if((w & 0xfc000000) == 0x14000000)
+			cpu->pc += 4 * a64_sext(w & 0x3ffffff, 26) - 4;
+		else if((w & 0xff000000) == 0xb4000000)
+		{
+			if(a64_reg(cpu, rd) == 0)
+				cpu->pc += 4 * a64_sext((w >> 5) & 0x7ffff, 19) - 4;
+		}
+		else if((w & 0xffa00400) == 0x38000400)
+		{
+			/* ldrb/strb wt, [xn], #imm and [xn, #imm]! */
+			off = a64_sext((w >> 12) & 0x1ff, 9);
+			addr = (w & (1 << 11)) ? cpu->x[rn] + off : cpu->x[rn];
+			if(!(p = a64_mem(cpu, addr, 1)))
+				return 0;
+			if(w & (1 << 22))
+				cpu->x[rd] = *p;
+			else
+				*p = cpu->x[rd];
+			cpu->x[rn] += off;
+		}
+		else if((w & 0xfe800000) == 0xa8800000)
+		{
+			/* ldp/stp xt, xt2, [xn], #imm and [xn, #imm]! */
+			rt = (w >> 10) & 31;
+			off = a64_sext((w >> 15) & 0x7f, 7) * 8;
+			addr = (w & (1 << 24)) ? cpu->x[rn] + off : cpu->x[rn];
+			if(!(p = a64_mem(cpu, addr, 16)))
+				return 0;
+			if(addr & 7)
+				cpu->unaligned++;
+			if(w & (1 << 22))
+			{
+				memcpy(&cpu->x[rd], p, 8);
+				memcpy(&cpu->x[rt], p + 8, 8);
+			}
+			else
+			{
+				memcpy(p, &cpu->x[rd], 8);
+				memcpy(p + 8, &cpu->x[rt], 8);
+			}
+			cpu->x[rn] += off;
+		}
+		else if(w == 0xd65f03c0)
+			cpu->pc = cpu->x[30];
+		else
+		{
+			printf("Unknown instruction 0x%08x at 0x%llx\r\n", w, (unsigned long long)(cpu->pc - 4));
+			return 0;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Parse the payload[] array of rock_maskrom_write_arm64() out of rock.c
+ */
+static size_t payload_load(const char * filename, uint8_t * buf, size_t size)
+{
+	char line[1024], * p, * e;
+	size_t n = 0;
+	int state = 0;
+	FILE * f;
+
+	f = fopen(filename, "r");
+	if(!f)
+		return 0;
+	while(fgets(line, sizeof(line), f))
+	{
+		if((state == 0) && strstr(line, "rock_maskrom_write_arm64(") && (line[0] != '\t'))
+			state = 1;
+		else if((state == 1) && strstr(line, "payload[] = {"))
+			state = 2;
+		else if(state == 2)
+		{
+			if(strstr(line, "};"))
+				break;
+			for(p = line; (p = strstr(p, "0x")) && (n < size); p = e)
+				buf[n++] = strtoul(p, &e, 16);
+		}
+	}
+	fclose(f);
+	return n;
+}
+
+int main(int argc, char * argv[])
+{
+	static uint8_t code[4096], mem[MEMMOVE_SIZE], ref[MEMMOVE_SIZE];
+	struct a64_cpu_t cpu;
+	uint32_t seed = 0x2545f491;
+	size_t ncode, src, dst, len;
+	int cases = 0, fail = 0, unaligned = 0;
+
+	ncode = payload_load((argc > 1) ? argv[1] : "rock.c", code, sizeof(code));
+	if(ncode <= MEMMOVE_ENTRY)
+	{
+		printf("Can't find the arm64 write payload\r\n");
+		return 1;
+	}
+	for(len = 0; len < 600; len += (len < 80) ? 1 : 37)
+	{
+		for(int sa = 0; sa < 16; sa++)
+		{
+			for(int da = 0; da < 16; da++)
+			{
+				for(int k = 0; k < 4; k++)
+				{
+					/* apart, overlapping forward, overlapping backward and the same address */
+					src = 1024 + sa;
+					dst = (k == 0) ? 2560 + da : 1024 + da;
+					if(k == 1)
+						dst += len / 3 + 1;
+					else if(k == 2)
+						src += len / 3 + 1;
+					else if(k == 3)
+						dst = src;
+					for(int i = 0; i < MEMMOVE_SIZE; i++)
+					{
+						seed ^= seed << 13;
+						seed ^= seed >> 17;
+						seed ^= seed << 5;
+						mem[i] = seed;
+					}
+					memcpy(ref, mem, sizeof(mem));
+					memmove(ref + dst, ref + src, len);
+
+					memset(&cpu, 0, sizeof(cpu));
+					cpu.code = code;
+					cpu.ncode = ncode;
+					cpu.mem = mem;
+					cpu.pc = MEMMOVE_ENTRY;
+					cpu.x[0] = MEMMOVE_BASE + dst;
+					cpu.x[1] = MEMMOVE_BASE + src;
+					cpu.x[2] = len;
+					cpu.x[30] = MEMMOVE_RETURN;
+					if(!a64_run(&cpu) || (memcmp(mem, ref, sizeof(mem)) != 0))
+					{
+						if(fail++ < 8)
+							printf("FAIL: memmove dst +%zu, src +%zu, length %zu\r\n", dst, src, len);
+					}
+					unaligned += cpu.unaligned;
+					cases++;
+				}
+			}
+		}
+	}
+	if(unaligned)
+	{
+		printf("FAIL: %d ldp/stp accesses are not 8 bytes aligned\r\n", unaligned);
+		fail++;
+	}
+	printf("Memmove check %s, %d cases\r\n", fail ? "failed" : "passed", cases);
+	return fail ? 1 : 0;
+}
@@ -0,0 +1,273 @@
+#include <uart.h>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <fcntl.h>
+#include <termios.h>
+
+struct uart_baud_t {
+	int baud;
+	speed_t speed;
+};
+
+struct uart_reader_t {
+	int fd;
+	int pos;
+	int len;
+	uint8_t buf[4096];
+};
+
+static const struct uart_baud_t uart_baud[] = {
+	{ 9600, B9600 },
+	{ 19200, B19200 },
+	{ 38400, B38400 },
+	{ 57600, B57600 },
+	{ 115200, B115200 },
+#ifdef B230400
+	{ 230400, B230400 },
+#endif
+#ifdef B460800
+	{ 460800, B460800 },
+#endif
+#ifdef B921600
+	{ 921600, B921600 },
+#endif
+#ifdef B1000000
+	{ 1000000, B1000000 },
+#endif
+#ifdef B1500000
+	{ 1500000, B1500000 },
+#endif
+#ifdef B2000000
+	{ 2000000, B2000000 },
+#endif
+#ifdef B3000000
+	{ 3000000, B3000000 },
+#endif
+};
+
+static int uart_open(const char * tty, int baud)
+{
+	struct termios t;
+	int fd, i;
+
+	for(i = 0; i < ARRAY_SIZE(uart_baud); i++)
+	{
+		if(uart_baud[i].baud == baud)
+			break;
+	}
+	if(i >= ARRAY_SIZE(uart_baud))
+	{
+		printf("ERROR: Unsupported baud rate %d\r\n", baud);
+		return -1;
+	}
+	fd = open(tty, O_RDWR | O_NOCTTY);
+	if(fd < 0)
+	{
+		printf("ERROR: Can't open '%s'\r\n", tty);
+		return -1;
+	}
+	if(tcgetattr(fd, &t) < 0)
+	{
+		printf("ERROR: The '%s' is not a tty\r\n", tty);
+		close(fd);
+		return -1;
+	}
+	cfmakeraw(&t);
+	t.c_cflag |= CLOCAL | CREAD;
+	t.c_cflag &= ~CSTOPB;
+#ifdef CRTSCTS
+	t.c_cflag &= ~CRTSCTS;
+#endif
+	t.c_cc[VMIN] = 0;
+	t.c_cc[VTIME] = 0;
+	cfsetispeed(&t, uart_baud[i].speed);
+	cfsetospeed(&t, uart_baud[i].speed);
+	if(tcsetattr(fd, TCSANOW, &t) < 0)
+	{
+		printf("ERROR: Can't set '%s' to %d baud\r\n", tty, baud);
+		close(fd);
+		return -1;
+	}
+	tcflush(fd, TCIOFLUSH);
+	return fd;
+}
+
+/*
+ * Read one byte, waiting at most timeout ms or forever if negative, returns -1 on timeout
+ */
+static int uart_getc(struct uart_reader_t * r, int timeout)
+{
+	struct pollfd pfd;
+	int n;
+
+	while(r->pos >= r->len)
+	{
+		pfd.fd = r->fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		n = poll(&pfd, 1, timeout);
+		if(n < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		if(n == 0)
+			return -1;
+		n = read(r->fd, r->buf, sizeof(r->buf));
+		if(n < 0)
+		{
+			if((errno == EINTR) || (errno == EAGAIN))
+				continue;
+			return -1;
+		}
+		if((n == 0) && (pfd.revents & POLLHUP))
+			return -1;
+		r->pos = 0;
+		r->len = n;
+	}
+	return r->buf[r->pos++];
+}
+
+static int uart_read(struct uart_reader_t * r, uint8_t * buf, int len, int timeout)
+{
+	int c;
+
+	while(len-- > 0)
+	{
+		if((c = uart_getc(r, timeout)) < 0)
+			return 0;
+		*buf++ = c;
+	}
+	return 1;
+}
+
+static void uart_reply(int fd, uint8_t type, uint16_t seq)
+{
+	uint8_t b[2] = { type, seq & 0xff };
+
+	if(write(fd, b, sizeof(b)) == sizeof(b))
+		tcdrain(fd);
+}
+
+/*
+ * Expand the data of a frame into a block, returns the block length or -1 if malformed
+ */
+static int uart_decode(uint8_t flags, const uint8_t * data, int len, uint8_t * block)
+{
+	int n = 0;
+
+	if(!(flags & UART_FRAME_RLE))
+	{
+		memcpy(block, data, len);
+		return len;
+	}
+	if(len & 0x1)
+		return -1;
+	for(int i = 0; i < len; i += 2)
+	{
+		int cnt = data[i] + 1;
+		if(n + cnt > UART_FRAME_BLOCK)
+			return -1;
+		memset(&block[n], data[i + 1], cnt);
+		n += cnt;
+	}
+	return n;
+}
+
+int xrock_uart_capture(const char * tty, const char * filename, int baud)
+{
+	struct uart_reader_t r;
+	uint8_t hdr[6], crc[2];
+	uint8_t data[UART_FRAME_BLOCK];
+	uint8_t block[UART_FRAME_BLOCK];
+	uint64_t total = 0;
+	uint32_t count = 0, retry = 0;
+	uint16_t seq, len;
+	int started = 0, done = 0, ok = 0;
+	FILE * out;
+	int c, n;
+
+	memset(&r, 0, sizeof(struct uart_reader_t));
+	r.fd = uart_open(tty, baud);
+	if(r.fd < 0)
+		return 0;
+	out = fopen(filename, "wb");
+	if(!out)
+	{
+		printf("ERROR: Can't create '%s'\r\n", filename);
+		close(r.fd);
+		return 0;
+	}
+	printf("Waiting for dump on '%s' at %d baud\r\n", tty, baud);
+	while(1)
+	{
+		c = uart_getc(&r, done ? 500 : (started ? 10000 : -1));
+		if(c < 0)
+		{
+			if(done)
+				ok = 1;
+			else
+				printf("ERROR: Timeout after %u blocks\r\n", count);
+			break;
+		}
+		if((c != UART_FRAME_SYNC0) || (uart_getc(&r, 1000) != UART_FRAME_SYNC1))
+			continue;
+		if(!uart_read(&r, hdr, sizeof(hdr), 1000))
+			continue;
+		seq = hdr[0] | (hdr[1] << 8);
+		len = hdr[2] | (hdr[3] << 8);
+		if((len > UART_FRAME_BLOCK) || (hdr[5] != 0))
+			continue;
+		if(!uart_read(&r, data, len, 1000) || !uart_read(&r, crc, sizeof(crc), 1000))
+			continue;
+		if(crc16_sum(crc16_sum(0xffff, hdr, sizeof(hdr)), data, len) != (crc[0] | (crc[1] << 8)))
+		{
+			uart_reply(r.fd, UART_NAK, seq);
+			retry++;
+			continue;
+		}
+		if(started && (seq == (uint16_t)(count - 1)))
+		{
+			uart_reply(r.fd, UART_ACK, seq);
+			continue;
+		}
+		if(done || (seq != (uint16_t)count))
+		{
+			printf("ERROR: Unexpected block %u, expect %u, the dump was started before capture\r\n", seq, (uint16_t)count);
+			break;
+		}
+		n = uart_decode(hdr[4], data, len, block);
+		if(n < 0)
+		{
+			uart_reply(r.fd, UART_NAK, seq);
+			retry++;
+			continue;
+		}
+		if(fwrite(block, 1, n, out) != n)
+		{
+			printf("ERROR: Can't write '%s'\r\n", filename);
+			break;
+		}
+		uart_reply(r.fd, UART_ACK, seq);
+		started = 1;
+		total += n;
+		count++;
+		if(hdr[4] & UART_FRAME_END)
+			done = 1;
+	}
+	if(fclose(out) != 0)
+		ok = 0;
+	close(r.fd);
+	if(ok)
+		printf("Captured %llu bytes in %u blocks, %u retries\r\n", (unsigned long long)total, count - 1, retry);
+	return ok;
+}
+#else
+int xrock_uart_capture(const char * tty, const char * filename, int baud)
+{
+	printf("ERROR: The uart-capture command is not supported on this platform\r\n");
+	return 0;
+}
+#endif
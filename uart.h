@@ -0,0 +1,32 @@
+#ifndef __UART_H__
+#define __UART_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <rock.h>
+
+/*
+ * Host side of the binary maskrom dump. The payload sends the memory over the
+ * debug uart in frames of a5 5a, seq16, len16, flags, 0, data and crc16 of seq
+ * to data, all little endian. Data is raw or rle (count - 1, value) pairs, an
+ * empty frame with the end flag closes the dump. Every frame is answered with
+ * ack or nak followed by the low byte of seq, the payload resends on nak or
+ * after a timeout.
+ */
+#define UART_FRAME_SYNC0		(0xa5)
+#define UART_FRAME_SYNC1		(0x5a)
+#define UART_FRAME_RLE			(1 << 0)
+#define UART_FRAME_END			(1 << 1)
+#define UART_FRAME_BLOCK		(1024)
+#define UART_ACK				(0x06)
+#define UART_NAK				(0x15)
+
+int xrock_uart_capture(const char * tty, const char * filename, int baud);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __UART_H__ */